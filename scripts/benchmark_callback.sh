@@ -0,0 +1,79 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Builds each given revision and runs the audio callback benchmark on it:
+# the headless app on the free-running virtual device, which logs the
+# CallbackMonitor stats when it quits. Revisions before the virtual
+# device and callback monitor were added can't be measured this way.
+#
+# Usage: scripts/benchmark_callback.sh [-d seconds] [-c channels] [-b block] rev...
+
+# Settings
+APP_NAME="MoPanning"
+CONFIG="Release"
+DURATION=20
+CHANNELS=8
+BLOCK_SIZE=512
+WORK_DIR="build/benchmark"
+
+while getopts "d:c:b:" opt; do
+  case "${opt}" in
+    d) DURATION="${OPTARG}" ;;
+    c) CHANNELS="${OPTARG}" ;;
+    b) BLOCK_SIZE="${OPTARG}" ;;
+    *) echo "Usage: $0 [-d seconds] [-c channels] [-b block] rev..."; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [[ $# -eq 0 ]]; then
+  echo "Usage: $0 [-d seconds] [-c channels] [-b block] rev..."
+  exit 1
+fi
+
+REPO_DIR="$(git rev-parse --show-toplevel)"
+mkdir -p "${REPO_DIR}/${WORK_DIR}"
+
+for REV in "$@"; do
+  SHA="$(git -C "${REPO_DIR}" rev-parse --short "${REV}")"
+  TREE="${REPO_DIR}/${WORK_DIR}/${SHA}"
+
+  # Build the revision in its own worktree, sharing the JUCE checkout
+  if [[ ! -d "${TREE}" ]]; then
+    git -C "${REPO_DIR}" worktree add --detach "${TREE}" "${SHA}"
+    rmdir "${TREE}/JUCE"
+    ln -s "${REPO_DIR}/JUCE" "${TREE}/JUCE"
+  fi
+
+  cmake -S "${TREE}" -B "${TREE}/build" -DCMAKE_BUILD_TYPE="${CONFIG}"
+  cmake --build "${TREE}/build" --config "${CONFIG}"
+
+  # Locate the executable
+  CANDIDATES=(
+    "${TREE}/build/${APP_NAME}_artefacts/${CONFIG}/${APP_NAME}"
+    "${TREE}/build/${APP_NAME}_artefacts/${CONFIG}/${APP_NAME}.app/Contents/MacOS/${APP_NAME}"
+    "${TREE}/build/${APP_NAME}_artefacts/${APP_NAME}"
+  )
+
+  APP=""
+  for c in "${CANDIDATES[@]}"; do
+    if [[ -x "$c" ]]; then
+      APP="$c"
+      break
+    fi
+  done
+
+  if [[ -z "${APP}" ]]; then
+    echo "Could not find ${APP_NAME} in ${TREE}/build."
+    exit 1
+  fi
+
+  # The stats are logged on quit
+  LOG="${REPO_DIR}/${WORK_DIR}/${SHA}.log"
+  "${APP}" --headless --virtual-device --free-run \
+           --channels="${CHANNELS}" --block-size="${BLOCK_SIZE}" \
+           --duration="${DURATION}" > "${LOG}" 2>&1 || true
+
+  echo "== ${REV} (${SHA})"
+  grep -A1 "Audio callback:" "${LOG}" | tail -n 2 || echo "No callback stats in ${LOG}"
+done
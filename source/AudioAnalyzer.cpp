@@ -111,18 +111,38 @@ void AudioAnalyzer::setResultsPointer(std::array<TrackSlot, Constants::maxTracks
     results = resultsPtr;
 }
 
-void AudioAnalyzer::enqueueBlock(const juce::AudioBuffer<float>* buffer, int trackIndex)
+void AudioAnalyzer::enqueueBlock(const juce::AudioBuffer<float>* buffer, int numSamples, int trackIndex)
 {
     if (!buffer) return;
 
     // If trackIndex is greater than current number of workers, ignore until re-prepared
     if (trackIndex >= (int)workers.size() || workers[trackIndex] == nullptr)
     {
-        DBG("Skipping enqueue for track " << trackIndex << ": worker not ready");
+        RT_LOG("Skipping enqueue for track {}: worker not ready", trackIndex);
         return;
     }
 
-    workers[trackIndex]->pushBlock(*buffer);
+    workers[trackIndex]->pushBlock(*buffer, std::min(numSamples, buffer->getNumSamples()));
+}
+
+/*  Writes a routed track straight from the device inputs into the 
+    worker's ring buffer with gain applied, so no intermediate per-track
+    buffer is needed on the audio thread.
+*/
+void AudioAnalyzer::enqueueRouted(const float* const* inputChannelData, 
+                                  const ChannelRouter::Route& route,
+                                  int numSamples, float gain)
+{
+    const int trackIndex = route.trackIndex;
+
+    // If trackIndex is greater than current number of workers, ignore until re-prepared
+    if (trackIndex >= (int)workers.size() || workers[trackIndex] == nullptr)
+    {
+        RT_LOG("Skipping enqueue for track {}: worker not ready", trackIndex);
+        return;
+    }
+
+    workers[trackIndex]->pushRouted(inputChannelData, route, numSamples, gain);
 }
 
 
@@ -525,8 +545,15 @@ void AudioAnalyzer::analyzeBlock(const juce::AudioBuffer<float>& buffer,
     auto& buf = slot.buffers[next];
     buf = outResults;
 
+    // Nothing to show if this and the last result are both empty, so
+    // don't wake the renderer for it
+    const bool isNew = !buf.empty() || !slot.buffers[current].empty();
+
     // Publish new buffer atomically
     slot.activeIndex.store(next, std::memory_order_release);
+
+    if (isNew)
+        slot.generation.fetch_add(1, std::memory_order_release);
 }
 
 /*  Computes the FFT of each channel of the input buffer and stores the
@@ -30,6 +30,8 @@ asynchronously.
 
 #pragma once
 #include <JuceHeader.h>
+#include "ChannelRouter.h"
+#include "RTLogger.h"
 #include "Utils.h"
 
 using Complex = juce::dsp::Complex<float>;
@@ -49,7 +51,10 @@ public:
     void setResultsPointer(std::array<TrackSlot, Constants::maxTracks>* resultsPtr);
 
     // Called by audio thread
-    void enqueueBlock(const juce::AudioBuffer<float>* buffer, int trackIndex);
+    void enqueueBlock(const juce::AudioBuffer<float>* buffer, int numSamples, int trackIndex);
+    void enqueueRouted(const float* const* inputChannelData, 
+                       const ChannelRouter::Route& route,
+                       int numSamples, float gain);
 
     void setWindowSize(int newWindowSize);
     void setHopSize(int newHopSize);
@@ -273,43 +278,83 @@ public:
     /*  This function is called on audio thread to enqueue a copy of 
         the incoming audio block into the ring buffer. 
     */
-    void pushBlock(const juce::AudioBuffer<float>& newBlock)
+    void pushBlock(const juce::AudioBuffer<float>& newBlock, int numSamples)
+    {
+        pushSamples(newBlock.getArrayOfReadPointers(), newBlock.getNumChannels(),
+                    numSamples, 1.0f);
+    }
+
+    /*  This function is called on the audio thread to write one routed
+        track straight from the device inputs into the ring buffer, with
+        gain applied. Each ring channel is the sum of the route's terms
+        for that channel.
+    */
+    void pushRouted(const float* const* inputs, const ChannelRouter::Route& route, 
+                    int n, float gain)
     {
-        int n = newBlock.getNumSamples();
         int N = ringBuffer.getNumSamples();
+        int start = writePosition.load(std::memory_order_relaxed);
+
+        // Number of samples that fit before the ring buffer wraps around
+        int samplesToEnd = std::min(n, N - start);
 
         for (int ch = 0; ch < 2; ++ch)
         {
-            if (writePosition + n < N)
-            {
-                // We have room, copy the samples starting from writePosition
-                ringBuffer.copyFrom(ch, writePosition, newBlock, ch, 0, n);
-            }
-            else
-            {
-                int samplesToEnd = N - writePosition;
-                // Copy the samples from writePosition to end of the ring buffer
-                ringBuffer.copyFrom(ch, writePosition, newBlock, ch, 0, samplesToEnd);
+            float* dest = ringBuffer.getWritePointer(ch);
+            const auto& terms = route.terms[(size_t)ch];
+            const int numTerms = route.numTerms[(size_t)ch];
 
-                // Copy the rest of the samples from the start of the ring buffer
-                ringBuffer.copyFrom(ch, 0, newBlock, ch, samplesToEnd, n - samplesToEnd);
-            }
+            writeTerms(dest + start, inputs, terms, numTerms, 0, samplesToEnd, gain);
+
+            // Write the rest of the samples to the start of the ring buffer
+            if (samplesToEnd < n)
+                writeTerms(dest, inputs, terms, numTerms, samplesToEnd, n - samplesToEnd, gain);
         }
-        
+
         // Update the write position, wrapping around if necessary
-        writePosition = (writePosition + n) % N;
+        writePosition.store((start + n) % N, std::memory_order_release);
 
         // Notify worker thread that new data is available
         std::lock_guard<std::mutex> lock(mutex);
         cv.notify_one();
+    }
 
-        // DBG("PUSH Track " << trackIndex 
-        //     << " L[0]=" << newBlock.getSample(0, 0) 
-        //     << " R[0]=" << newBlock.getSample(1, 0)
-        //     << " RMS L=" << newBlock.getRMSLevel(0, 0, n)
-        //     << " R=" << newBlock.getRMSLevel(1, 0, n));
+    /*  This function is called on the audio thread to write a block of 
+        samples straight into the ring buffer, scaled by gain, in a 
+        single pass. A mono source (numChannels == 1) is written to both 
+        ring channels.
+    */
+    void pushSamples(const float* const* channels, int numChannels, int n, float gain)
+    {
+        if (numChannels <= 0 || n <= 0)
+            return;
+
+        int N = ringBuffer.getNumSamples();
+        int start = writePosition.load(std::memory_order_relaxed);
 
-        // DBG("Enqueued block on audio thread.");
+        // Number of samples that fit before the ring buffer wraps around
+        int samplesToEnd = std::min(n, N - start);
+
+        for (int ch = 0; ch < 2; ++ch)
+        {
+            const float* src = channels[std::min(ch, numChannels - 1)];
+            float* dest = ringBuffer.getWritePointer(ch);
+
+            juce::FloatVectorOperations::copyWithMultiply(dest + start, src, 
+                                                          gain, samplesToEnd);
+
+            // Copy the rest of the samples to the start of the ring buffer
+            if (samplesToEnd < n)
+                juce::FloatVectorOperations::copyWithMultiply(dest, src + samplesToEnd, 
+                                                              gain, n - samplesToEnd);
+        }
+        
+        // Update the write position, wrapping around if necessary
+        writePosition.store((start + n) % N, std::memory_order_release);
+
+        // Notify worker thread that new data is available
+        std::lock_guard<std::mutex> lock(mutex);
+        cv.notify_one();
     }
 
 private:
@@ -343,7 +388,8 @@ private:
                 // If we are too far behind, skip ahead to the latest data
                 readPosition = (writePosition - windowSize * 2 + N) % N;
                 overloaded = true;
-                // DBG("AnalyzerWorker overloaded, skipping ahead.");
+                RT_LOG("AnalyzerWorker {} overloaded, skipped {} samples", 
+                       trackIndex, samplesAvailable - windowSize * 2);
             }
 
             // Copy data from the ring buffer to the analysis buffer
@@ -391,8 +437,21 @@ private:
         }
     }
 
+    /*  Writes the sum of a route channel's terms, times gain, to dest. */
+    static void writeTerms(float* dest, const float* const* inputs,
+                           const std::array<ChannelRouter::Term, 2>& terms, int numTerms,
+                           int offset, int num, float gain)
+    {
+        juce::FloatVectorOperations::copyWithMultiply(dest, inputs[terms[0].input] + offset,
+                                                      terms[0].gain * gain, num);
+
+        for (int t = 1; t < numTerms; ++t)
+            juce::FloatVectorOperations::addWithMultiply(dest, inputs[terms[(size_t)t].input] + offset,
+                                                         terms[(size_t)t].gain * gain, num);
+    }
+
     juce::AudioBuffer<float> ringBuffer;
-    std::atomic<int> writePosition;
+    std::atomic<int> writePosition { 0 };
     int readPosition = 0;
 
     juce::AudioBuffer<float> analysisBuffer;
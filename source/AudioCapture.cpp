@@ -0,0 +1,284 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#include "AudioCapture.h"
+
+
+//=============================================================================
+AudioCapture::AudioCapture()
+    : juce::Thread("AudioCapture")
+{
+}
+
+AudioCapture::~AudioCapture()
+{
+    stop();
+}
+
+//=============================================================================
+void AudioCapture::prepare(double sampleRateIn, int numChannelsIn)
+{
+    sampleRate = sampleRateIn;
+    numChannels = numChannelsIn;
+}
+
+bool AudioCapture::start(const juce::File& wavFile, const juce::File& timelineFile,
+                         const CaptureSettings& settings)
+{
+    stop();
+
+    auto options = juce::AudioFormatWriterOptions()
+        .withSampleRate(sampleRate)
+        .withNumChannels(numChannels)
+        .withBitsPerSample(settings.floatAudio ? 32 : 24)
+        .withSampleFormat(settings.floatAudio ? juce::AudioFormatWriterOptions::SampleFormat::floatingPoint
+                                              : juce::AudioFormatWriterOptions::SampleFormat::integral);
+
+    auto fileStream = wavFile.createOutputStream();
+    if (fileStream == nullptr || !fileStream->openedOk())
+        return false;
+
+    std::unique_ptr<juce::OutputStream> outStream;
+    outStream.reset(fileStream.release());
+
+    juce::WavAudioFormat wav;
+    writer = wav.createWriterFor(outStream, options);
+
+    timelineFile.deleteFile();
+    timeline = std::make_unique<juce::FileOutputStream>(timelineFile);
+
+    if (writer == nullptr || !timeline->openedOk())
+    {
+        writer.reset();
+        timeline.reset();
+        return false;
+    }
+
+    *timeline << "sampleRate " << juce::String(sampleRate) << "\n";
+
+    // Everything the audio thread touches is allocated here, before it
+    // can see running
+    const int ringSamples = juce::roundToInt(sampleRate * ringSeconds);
+    ring.setSize(numChannels, ringSamples);
+    sampleFifo.setTotalSize(ringSamples);
+    sampleFifo.reset();
+    stamps.assign((size_t)maxBlocksQueued, {});
+    stampFifo.setTotalSize(maxBlocksQueued);
+    stampFifo.reset();
+
+    silence.setSize(numChannels, 4096);
+    silence.clear();
+    channelPointers.assign((size_t)numChannels, nullptr);
+
+    numSamplesPushed = 0;
+    numSamplesDropped = 0;
+    numSamplesWritten = 0;
+    lastFlushPosition = 0;
+
+    running.store(true, std::memory_order_release);
+    startThread(juce::Thread::Priority::high);
+    return true;
+}
+
+void AudioCapture::stop()
+{
+    if (!running.exchange(false))
+        return;
+
+    // Let a push already under way finish with the ring
+    while (numPushesActive.load() > 0)
+        juce::Thread::yield();
+
+    stopThread(-1);
+    writeQueuedBlocks();
+
+    // Blocks dropped at the very end still take up time
+    writeSilence(numSamplesPushed.load() - numSamplesWritten);
+
+    *timeline << "end " << juce::String(numSamplesWritten) << "\n";
+    timeline->flush();
+    timeline.reset();
+
+    // Finalizes the WAV header
+    writer.reset();
+
+    if (numSamplesDropped.load() > 0)
+        juce::Logger::writeToLog("Audio capture: " + juce::String(numSamplesDropped.load())
+                                 + " samples dropped and replaced with silence");
+}
+
+//=============================================================================
+void AudioCapture::push(const float* const* block, int numChannelsIn, int numSamples)
+{
+    if (numSamples <= 0)
+        return;
+
+    ++numPushesActive;
+
+    if (running.load(std::memory_order_acquire))
+    {
+        // The position advances even if the block is dropped, so the
+        // writer knows how much silence to put in its place
+        const auto position = numSamplesPushed.fetch_add(numSamples, std::memory_order_relaxed);
+
+        if (sampleFifo.getFreeSpace() < numSamples || stampFifo.getFreeSpace() < 1)
+        {
+            numSamplesDropped.fetch_add(numSamples, std::memory_order_relaxed);
+        }
+        else
+        {
+            int start1, size1, start2, size2;
+            sampleFifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                if (ch < numChannelsIn)
+                {
+                    ring.copyFrom(ch, start1, block[ch], size1);
+                    if (size2 > 0)
+                        ring.copyFrom(ch, start2, block[ch] + size1, size2);
+                }
+                else
+                {
+                    ring.clear(ch, start1, size1);
+                    if (size2 > 0)
+                        ring.clear(ch, start2, size2);
+                }
+            }
+
+            sampleFifo.finishedWrite(size1 + size2);
+
+            // The stamp goes after its samples, so the writer never reads
+            // a block that isn't all there
+            stampFifo.prepareToWrite(1, start1, size1, start2, size2);
+            stamps[(size_t)start1] = { position, numSamples };
+            stampFifo.finishedWrite(1);
+        }
+    }
+
+    --numPushesActive;
+}
+
+//=============================================================================
+void AudioCapture::run()
+{
+    while (!threadShouldExit())
+    {
+        if (!writeQueuedBlocks())
+            wait(writeIntervalMs);
+    }
+}
+
+bool AudioCapture::writeQueuedBlocks()
+{
+    const int numBlocks = stampFifo.getNumReady();
+    if (numBlocks == 0)
+        return false;
+
+    for (int i = 0; i < numBlocks; ++i)
+    {
+        int start1, size1, start2, size2;
+        stampFifo.prepareToRead(1, start1, size1, start2, size2);
+        const auto stamp = stamps[(size_t)start1];
+        stampFifo.finishedRead(1);
+
+        // Blocks dropped since the last one
+        writeSilence(stamp.position - numSamplesWritten);
+
+        sampleFifo.prepareToRead(stamp.numSamples, start1, size1, start2, size2);
+        writeFromRing(start1, size1);
+        writeFromRing(start2, size2);
+        sampleFifo.finishedRead(size1 + size2);
+    }
+
+    // Rewrite the header every second, so the audio survives a crash
+    if (numSamplesWritten - lastFlushPosition >= (juce::int64)sampleRate)
+    {
+        writer->flush();
+        timeline->flush();
+        lastFlushPosition = numSamplesWritten;
+    }
+
+    return true;
+}
+
+void AudioCapture::writeSilence(juce::int64 numSamples)
+{
+    if (numSamples <= 0)
+        return;
+
+    *timeline << "gap " << juce::String(numSamplesWritten) << " " << juce::String(numSamples) << "\n";
+
+    for (auto remaining = numSamples; remaining > 0;)
+    {
+        const int n = (int)std::min(remaining, (juce::int64)silence.getNumSamples());
+        writer->writeFromAudioSampleBuffer(silence, 0, n);
+        remaining -= n;
+    }
+
+    numSamplesWritten += numSamples;
+}
+
+void AudioCapture::writeFromRing(int start, int numSamples)
+{
+    if (numSamples <= 0)
+        return;
+
+    for (int ch = 0; ch < numChannels; ++ch)
+        channelPointers[(size_t)ch] = ring.getReadPointer(ch, start);
+
+    writer->writeFromFloatArrays(channelPointers.data(), numChannels, numSamples);
+    numSamplesWritten += numSamples;
+}
+
+//=============================================================================
+bool AudioCapture::readTimeline(const juce::File& timelineFile, Timeline& result)
+{
+    juce::StringArray lines;
+    timelineFile.readLines(lines);
+
+    bool finished = false;
+    result = {};
+
+    for (const auto& line : lines)
+    {
+        const auto tokens = juce::StringArray::fromTokens(line, false);
+        if (tokens.isEmpty())
+            continue;
+
+        if (tokens[0] == "sampleRate")
+        {
+            result.sampleRate = tokens[1].getDoubleValue();
+        }
+        else if (tokens[0] == "gap")
+        {
+            ++result.numGaps;
+            result.numGapSamples += tokens[2].getLargeIntValue();
+        }
+        else if (tokens[0] == "end")
+        {
+            result.numSamples = tokens[1].getLargeIntValue();
+            finished = true;
+        }
+    }
+
+    return finished && result.sampleRate > 0.0;
+}
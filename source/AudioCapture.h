@@ -0,0 +1,153 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "Utils.h"
+
+
+//=============================================================================
+/*  Records the audio that goes with a capture to a WAV file, along with
+    a timeline of when each part of it was heard.
+
+    The audio thread copies each block once, into a single-producer
+    single-consumer ring, and stamps it with its sample position (the
+    number of samples pushed since start(), the same count the capture
+    clock times video frames by). It never locks, waits or allocates. A background thread writes the ring to
+    the WAV as 24 bit or 32 bit float.
+
+    If the ring is ever full, the block is dropped, but its samples are
+    still counted. The writer sees the jump in position and writes
+    silence in its place, so every sample stays at its true position and
+    video frame n (at f fps) always starts at sample n * sampleRate / f.
+    That is all the alignment the muxer needs: the frames are timed by the
+    same sample count (see CaptureClock), so no other clock is recorded.
+
+    The timeline is a text file:
+
+        sampleRate <Hz>
+        gap <position> <numSamples>    dropped samples, written as silence
+        end <position>                 the number of samples in the WAV
+*/
+class AudioCapture : private juce::Thread
+{
+public:
+    //=========================================================================
+    AudioCapture();
+    ~AudioCapture() override;
+
+    //=========================================================================
+    /*  Sets the audio format. It takes effect the next time capture
+        starts.
+    */
+    void prepare(double sampleRateIn, int numChannelsIn);
+
+    /*  Starts writing the audio pushed from now on to wavFile, and its
+        timeline to timelineFile. Returns false if they couldn't be
+        created.
+    */
+    bool start(const juce::File& wavFile, const juce::File& timelineFile,
+               const CaptureSettings& settings);
+
+    /*  Writes out everything pushed so far and closes the files.
+    */
+    void stop();
+
+    bool isRunning() const { return running.load(); }
+
+    //=========================================================================
+    /*  Adds a block of audio. Call it from the audio thread only.
+    */
+    void push(const float* const* block, int numChannelsIn, int numSamples);
+
+    //=========================================================================
+    /*  What the timeline records about a finished capture.
+    */
+    struct Timeline
+    {
+        double sampleRate = 0.0;
+        juce::int64 numSamples = 0;
+        int numGaps = 0;
+        juce::int64 numGapSamples = 0;
+    };
+
+    /*  Reads the summary of a timeline file. Returns false if it isn't
+        one, or the capture didn't finish.
+    */
+    static bool readTimeline(const juce::File& timelineFile, Timeline& timeline);
+
+    /*  Counts for the current or last capture.
+    */
+    juce::int64 getNumSamples() const { return numSamplesPushed.load(); }
+    juce::int64 getNumDropped() const { return numSamplesDropped.load(); }
+
+private:
+    //=========================================================================
+    /*  A block's place in the capture, queued alongside its samples.
+    */
+    struct BlockStamp
+    {
+        juce::int64 position = 0;
+        int numSamples = 0;
+    };
+
+    //=========================================================================
+    /*  Writes the ring to the files until the thread is stopped.
+    */
+    void run() override;
+
+    /*  Writes every block queued so far. Returns false if there were
+        none.
+    */
+    bool writeQueuedBlocks();
+    void writeSilence(juce::int64 numSamples);
+    void writeFromRing(int start, int numSamples);
+
+    //=========================================================================
+    double sampleRate = 48000.0;
+    int numChannels = 2;
+
+    std::atomic<bool> running { false };
+    std::atomic<int> numPushesActive { 0 }; // So stop() knows the ring is free
+    std::atomic<juce::int64> numSamplesPushed { 0 };
+    std::atomic<juce::int64> numSamplesDropped { 0 };
+
+    // The ring, and the stamps for the blocks in it
+    juce::AudioBuffer<float> ring;
+    juce::AbstractFifo sampleFifo { 1 };
+    std::vector<BlockStamp> stamps;
+    juce::AbstractFifo stampFifo { 1 };
+
+    // Only used by the writer thread once started
+    std::unique_ptr<juce::AudioFormatWriter> writer;
+    std::unique_ptr<juce::FileOutputStream> timeline;
+    juce::AudioBuffer<float> silence;
+    std::vector<const float*> channelPointers;
+    juce::int64 numSamplesWritten = 0;
+    juce::int64 lastFlushPosition = 0;
+
+    static constexpr double ringSeconds = 2.0;
+    static constexpr int maxBlocksQueued = 4096;
+    static constexpr int writeIntervalMs = 10;
+
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioCapture)
+};
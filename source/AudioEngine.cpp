@@ -36,60 +36,49 @@ AudioEngine::~AudioEngine()
 }
 
 //=============================================================================
-void AudioEngine::fillAudioBuffers(const float *const *inputChannelData, int numInputChannels,
-                                   float *const *outputChannelData, int numOutputChannels,
+void AudioEngine::fillAudioBuffers(float *const *outputChannelData, int numOutputChannels,
                                    int numSamples, juce::AudioBuffer<float>& buffer, 
                                    bool isFirstTrack, float trackGainIn)
 {
+    // Streaming input never goes through an intermediate buffer
+    jassert(inputType == file);
+
     buffer.clear();
     juce::AudioSourceChannelInfo info(&buffer, 0, numSamples);
 
-    // Fill the analysis/intermediate buffer from the specified input
-    switch (inputType)
-    {
-        case file:
-            // Fill the buffer with audio data from the transport
-            transport.getNextAudioBlock(info);
-
-            break;
-
-        case streaming:
-            // Fill the buffer with the input data directly
-            if (numInputChannels >= 1)
-            {
-                // jassert (buffer.getNumChannels() >= 2);
-                // DBG("fillAudioBuffers: buffer channels = " << buffer.getNumChannels()
-                //     << " numSamples = " << numSamples);
-                buffer.copyFrom(0, 0, inputChannelData[0], numSamples);
-                buffer.applyGain(0, 0, numSamples, trackGainIn);
-            }
-            if (numInputChannels >= 2)
-            {
-                buffer.copyFrom(1, 0, inputChannelData[1], numSamples);
-                buffer.applyGain(1, 0, numSamples, trackGainIn);
-            }
-            
-            break;
-    }
-
-    const float* inL = buffer.getReadPointer(0);
-    const float* inR = buffer.getNumChannels() > 1 ? buffer.getReadPointer(1) : nullptr;
+    // Fill the buffer with audio data from the transport
+    transport.getNextAudioBlock(info);
 
     // Copy the filled buffer to the output channels
+    mixToOutput(buffer.getArrayOfReadPointers(), buffer.getNumChannels(),
+                outputChannelData, numOutputChannels,
+                numSamples, isFirstTrack, trackGainIn);
+}
+
+void AudioEngine::mixToOutput(const float *const *trackChannels, int numTrackChannels,
+                              float *const *outputChannelData, int numOutputChannels,
+                              int numSamples, bool isFirstTrack, float trackGainIn)
+{
+    using FVO = juce::FloatVectorOperations;
+
+    if (numTrackChannels <= 0 || numOutputChannels <= 0)
+        return;
+
+    const float* inL = trackChannels[0];
+    const float* inR = numTrackChannels > 1 ? trackChannels[1] : inL;
+
     if (numOutputChannels == 1)
     {
+        // Sum to mono
         float* out = outputChannelData[0];
+        const float halfGain = 0.5f * trackGainIn;
 
         if (isFirstTrack)
-        {
-            for (int i = 0; i < numSamples; ++i)
-                out[i] = ((inL[i] + (inR ? inR[i] : inL[i])) * 0.5f) * trackGainIn;
-        }
+            FVO::copyWithMultiply(out, inL, halfGain, numSamples);
         else
-        {
-            for (int i = 0; i < numSamples; ++i)
-                out[i] += ((inL[i] + (inR ? inR[i] : inL[i])) * 0.5f) * trackGainIn;
-        }
+            FVO::addWithMultiply(out, inL, halfGain, numSamples);
+
+        FVO::addWithMultiply(out, inR, halfGain, numSamples);
     }
     else
     {
@@ -98,22 +87,33 @@ void AudioEngine::fillAudioBuffers(const float *const *inputChannelData, int num
 
         if (isFirstTrack)
         {
-            for (int i = 0; i < numSamples; ++i)
-            {
-                outL[i] = inL[i] * trackGainIn;
-                outR[i] = (inR ? inR[i] : inL[i]) * trackGainIn;
-            }
+            FVO::copyWithMultiply(outL, inL, trackGainIn, numSamples);
+            FVO::copyWithMultiply(outR, inR, trackGainIn, numSamples);
         }
         else
         {
-            for (int i = 0; i < numSamples; ++i)
-            {
-                outL[i] += inL[i] * trackGainIn;
-                outR[i] += (inR ? inR[i] : inL[i]) * trackGainIn;
-            }
+            FVO::addWithMultiply(outL, inL, trackGainIn, numSamples);
+            FVO::addWithMultiply(outR, inR, trackGainIn, numSamples);
         }
     }
+}
 
+void AudioEngine::mixRouteToOutput(const float *const *inputChannelData,
+                                   const ChannelRouter::Route& route,
+                                   float *const *outputChannelData,
+                                   int numSamples, float trackGainIn)
+{
+    for (int ch = 0; ch < 2; ++ch)
+    {
+        for (int t = 0; t < route.numOutputTerms[(size_t)ch]; ++t)
+        {
+            const auto& term = route.outputTerms[(size_t)ch][(size_t)t];
+            juce::FloatVectorOperations::addWithMultiply(outputChannelData[ch], 
+                                                         inputChannelData[term.input],
+                                                         term.gain * trackGainIn, 
+                                                         numSamples);
+        }
+    }
 }
 
 bool AudioEngine::loadFile(const juce::File& file)
@@ -21,6 +21,7 @@
 
 #pragma once
 #include <JuceHeader.h>
+#include "ChannelRouter.h"
 #include "Utils.h"
 
 
@@ -35,16 +36,41 @@ public:
     AudioEngine();
     ~AudioEngine();
 
-    void fillAudioBuffers(const float *const *inputChannelData,
-                          int numInputChannels,
-                          float *const *outputChannelData,
+    /*  Fills buffer with the next block from the transport (file mode)
+        and mixes it into the output channels.
+    */
+    void fillAudioBuffers(float *const *outputChannelData,
                           int numOutputChannels,
                           int numSamples,
                           juce::AudioBuffer<float>& buffer,
                           bool isFirstTrack,
                           float trackGainIn);
 
+    /*  Mixes one track into the output channels with the given gain. 
+        
+        A mono track (numTrackChannels == 1) is sent to both outputs, and
+        a stereo track is summed when there is only one output channel.
+        The first track overwrites the output, later tracks add to it.
+    */
+    void mixToOutput(const float *const *trackChannels,
+                     int numTrackChannels,
+                     float *const *outputChannelData,
+                     int numOutputChannels,
+                     int numSamples,
+                     bool isFirstTrack,
+                     float trackGainIn);
+
+    /*  Adds one routed track from the device inputs to the output 
+        channels with the given gain. The outputs must already be cleared.
+    */
+    void mixRouteToOutput(const float *const *inputChannelData,
+                          const ChannelRouter::Route& route,
+                          float *const *outputChannelData,
+                          int numSamples,
+                          float trackGainIn);
+
     void setInputType(InputType type);
+    InputType getInputType() const { return inputType; }
 
     bool loadFile(const juce::File&);
     void togglePlayback();
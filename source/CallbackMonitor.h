@@ -0,0 +1,187 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+
+
+//=============================================================================
+/*  Measures how much of its deadline the audio callback uses.
+
+    The audio thread times each callback and records the elapsed time as
+    a fraction of the buffer period (numSamples / sampleRate) into a
+    fixed-bucket histogram. Everything is a relaxed atomic written by a
+    single thread, so recording never blocks or allocates. The message
+    thread takes snapshots for display and logging; the difference
+    between two snapshots gives the stats for the time in between.
+*/
+class CallbackMonitor
+{
+public:
+    //=========================================================================
+    static constexpr int numBuckets = 11; // 10% wide, the last one is >= 100%
+    static constexpr double nearMissLoad = 0.8;
+
+    struct Snapshot
+    {
+        std::array<uint64_t, numBuckets> buckets {};
+        uint64_t numCallbacks = 0;
+        uint64_t nearMisses = 0; // Callbacks that used >= nearMissLoad
+        uint64_t overruns = 0;   // Callbacks that missed the deadline
+        double totalLoad = 0.0;
+        double maxLoad = 0.0;
+        uint32_t numResets = 0; // Times prepare() has cleared the stats
+
+        double getMeanLoad() const
+        {
+            return numCallbacks > 0 ? totalLoad / (double)numCallbacks : 0.0;
+        }
+
+        /*  Returns the stats accumulated since an earlier snapshot. The
+            maximum can't be separated out, so it is the value since the
+            device started. If the device has restarted in between, this
+            is everything since then.
+        */
+        Snapshot since(const Snapshot& earlier) const
+        {
+            if (numResets != earlier.numResets)
+                return *this; // Cleared by prepare() in between
+
+            Snapshot d = *this;
+            for (size_t i = 0; i < buckets.size(); ++i)
+                d.buckets[i] -= earlier.buckets[i];
+            d.numCallbacks -= earlier.numCallbacks;
+            d.nearMisses -= earlier.nearMisses;
+            d.overruns -= earlier.overruns;
+            d.totalLoad -= earlier.totalLoad;
+            return d;
+        }
+
+        juce::String toString() const
+        {
+            juce::String s;
+            s << "Audio callback: " << (juce::int64)numCallbacks << " calls, "
+              << "mean " << juce::String(getMeanLoad() * 100.0, 1) << "%, "
+              << "max " << juce::String(maxLoad * 100.0, 1) << "%, "
+              << (juce::int64)nearMisses << " near misses, "
+              << (juce::int64)overruns << " overruns\n"
+              << "Load histogram (10% buckets):";
+
+            for (auto count : buckets)
+                s << " " << (juce::int64)count;
+
+            return s;
+        }
+    };
+
+    //=========================================================================
+    /*  Sets the sample rate used to compute the deadline, and clears the
+        stats. Call this when the device is about to start, while the 
+        callback isn't running.
+    */
+    void prepare(double newSampleRate)
+    {
+        secondsPerSample.store(newSampleRate > 0.0 ? 1.0 / newSampleRate : 0.0);
+
+        for (auto& bucket : buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        numCallbacks.store(0, std::memory_order_relaxed);
+        nearMisses.store(0, std::memory_order_relaxed);
+        overruns.store(0, std::memory_order_relaxed);
+        totalLoad.store(0.0, std::memory_order_relaxed);
+        maxLoad.store(0.0, std::memory_order_relaxed);
+        numResets.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*  Records one callback. Called on the audio thread only. */
+    void record(juce::int64 startTicks, juce::int64 endTicks, int numSamples)
+    {
+        const double period = numSamples * secondsPerSample.load(std::memory_order_relaxed);
+        if (period <= 0.0)
+            return;
+
+        const double elapsed = juce::Time::highResolutionTicksToSeconds(endTicks - startTicks);
+        const double load = elapsed / period;
+
+        const int bucket = juce::jlimit(0, numBuckets - 1, (int)(load * 10.0));
+        buckets[(size_t)bucket].fetch_add(1, std::memory_order_relaxed);
+        numCallbacks.fetch_add(1, std::memory_order_relaxed);
+
+        if (load >= nearMissLoad)
+            nearMisses.fetch_add(1, std::memory_order_relaxed);
+        if (load >= 1.0)
+            overruns.fetch_add(1, std::memory_order_relaxed);
+
+        // Single writer, so plain load/store is enough here
+        totalLoad.store(totalLoad.load(std::memory_order_relaxed) + load, std::memory_order_relaxed);
+        if (load > maxLoad.load(std::memory_order_relaxed))
+            maxLoad.store(load, std::memory_order_relaxed);
+    }
+
+    /*  Returns a copy of the current stats. Safe to call from any thread. */
+    Snapshot getSnapshot() const
+    {
+        Snapshot s;
+        for (size_t i = 0; i < buckets.size(); ++i)
+            s.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        s.numCallbacks = numCallbacks.load(std::memory_order_relaxed);
+        s.nearMisses = nearMisses.load(std::memory_order_relaxed);
+        s.overruns = overruns.load(std::memory_order_relaxed);
+        s.totalLoad = totalLoad.load(std::memory_order_relaxed);
+        s.maxLoad = maxLoad.load(std::memory_order_relaxed);
+        s.numResets = numResets.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    //=========================================================================
+    /*  Times the scope it lives in and records it as one callback. */
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(CallbackMonitor& m, int n)
+            : monitor(m), numSamples(n),
+              startTicks(juce::Time::getHighResolutionTicks()) {}
+
+        ~ScopedTimer()
+        {
+            monitor.record(startTicks, juce::Time::getHighResolutionTicks(), numSamples);
+        }
+
+    private:
+        CallbackMonitor& monitor;
+        int numSamples;
+        juce::int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedTimer)
+    };
+
+private:
+    //=========================================================================
+    std::atomic<double> secondsPerSample { 0.0 };
+
+    std::array<std::atomic<uint64_t>, numBuckets> buckets {};
+    std::atomic<uint64_t> numCallbacks { 0 };
+    std::atomic<uint64_t> nearMisses { 0 };
+    std::atomic<uint64_t> overruns { 0 };
+    std::atomic<double> totalLoad { 0.0 };
+    std::atomic<double> maxLoad { 0.0 };
+    std::atomic<uint32_t> numResets { 0 };
+};
@@ -0,0 +1,245 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public
+    License along with this program. If not, see
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "Utils.h"
+
+
+//=============================================================================
+/*  Describes where one track gets its audio from.
+
+    Source channels are device input channel numbers (as shown in the
+    device selector), not indexes into the active channel list.
+*/
+struct TrackRoute
+{
+    enum Mode
+    {
+        mono,   // sourceA to both sides
+        stereo, // sourceA left, sourceB right
+        midSide // sourceA mid, sourceB side, decoded to left/right
+    };
+
+    Mode mode = stereo;
+    int sourceA = 0;
+    int sourceB = 1;
+};
+
+
+//=============================================================================
+/*  Turns a list of TrackRoutes into a flat table the audio callback can
+    walk without any decisions.
+
+    The routes are made from the active input channels and the chosen
+    layout, and compiled when the audio device is about to start,
+    which is the only time the set of active input channels can change.
+    Each track's left and right channel is described by one or two
+    (input index, gain) terms, so mono, stereo and mid-side tracks all
+    look the same to the callback. Routes that refer to channels that
+    are not active are dropped at compile time, so the callback never
+    needs a bounds check.
+*/
+class ChannelRouter
+{
+public:
+    //=========================================================================
+    /*  One input contributing to one channel of a track. */
+    struct Term
+    {
+        int input;  // Index into the callback's inputChannelData
+        float gain;
+    };
+
+    /*  A compiled track: up to two terms for each of the track's two
+        channels, plus the same terms arranged for the output channels.
+    */
+    struct Route
+    {
+        int trackIndex;
+
+        std::array<std::array<Term, 2>, 2> terms;
+        std::array<int, 2> numTerms;
+
+        std::array<std::array<Term, 4>, 2> outputTerms;
+        std::array<int, 2> numOutputTerms;
+    };
+
+    //=========================================================================
+    /*  Sets how the active inputs are grouped into tracks the next time
+        compile() is called (see makeRoutes).
+    */
+    void setLayout(TrackRoute::Mode newLayout) { layout.store(newLayout); }
+    TrackRoute::Mode getLayout() const { return layout.load(); }
+
+    /*  Builds the routing table for the given device channel layout.
+
+        This must only be called while the audio callback is not running
+        (i.e. from audioDeviceAboutToStart). It returns the number of
+        tracks, which is at least one so that file playback always has
+        a track to use.
+    */
+    int compile(const juce::BigInteger& activeInputChannels, int numOutputChannels)
+    {
+        // Map device channel numbers to indexes into inputChannelData
+        std::vector<int> activeIndexOf((size_t)std::max(activeInputChannels.getHighestBit() + 1, 0), -1);
+        int numActive = 0;
+        for (int ch = 0; ch < (int)activeIndexOf.size(); ++ch)
+        {
+            if (activeInputChannels[ch])
+                activeIndexOf[(size_t)ch] = numActive++;
+        }
+
+        const auto requested = makeRoutes(activeInputChannels, getLayout());
+
+        int numTracks = std::min((int)requested.size(), Constants::maxTracks);
+        numRoutes = 0;
+        numMixedOutputs = juce::jlimit(0, 2, numOutputChannels);
+
+        for (int track = 0; track < numTracks; ++track)
+        {
+            const auto& r = requested[(size_t)track];
+
+            // The routes are made from the active channels, so these exist
+            const int a = activeIndexOf[(size_t)r.sourceA];
+            const int b = (r.mode == TrackRoute::mono) ? a : activeIndexOf[(size_t)r.sourceB];
+            jassert(a >= 0 && b >= 0);
+
+            auto& route = table[(size_t)numRoutes++];
+            route.trackIndex = track;
+
+            switch (r.mode)
+            {
+                case TrackRoute::mono:
+                    route.terms[0] = {{ { a, 1.0f }, { a, 0.0f } }};
+                    route.terms[1] = {{ { a, 1.0f }, { a, 0.0f } }};
+                    route.numTerms = { 1, 1 };
+                    break;
+
+                case TrackRoute::stereo:
+                    route.terms[0] = {{ { a, 1.0f }, { b, 0.0f } }};
+                    route.terms[1] = {{ { b, 1.0f }, { a, 0.0f } }};
+                    route.numTerms = { 1, 1 };
+                    break;
+
+                case TrackRoute::midSide:
+                    // L = M + S, R = M - S
+                    route.terms[0] = {{ { a, 1.0f }, { b,  1.0f } }};
+                    route.terms[1] = {{ { a, 1.0f }, { b, -1.0f } }};
+                    route.numTerms = { 2, 2 };
+                    break;
+            }
+
+            compileOutputTerms(route);
+        }
+
+        return std::max(numTracks, 1);
+    }
+
+    //=========================================================================
+    /*  The compiled table, for the audio callback to walk. */
+    const Route* begin() const { return table.data(); }
+    const Route* end() const { return table.data() + numRoutes; }
+
+    /*  Returns the number of output channels the routes write to. */
+    int getNumMixedOutputs() const { return numMixedOutputs; }
+
+    //=========================================================================
+    /*  Groups the active inputs into tracks. For the stereo and
+        mid-side layouts, consecutive pairs of inputs become tracks of
+        that mode, and an odd channel left over becomes a mono track. For
+        the mono layout, every input is a track of its own.
+
+        There are at most Constants::maxTracks tracks; inputs past the 
+        last one aren't analysed, which is logged.
+    */
+    static std::vector<TrackRoute> makeRoutes(const juce::BigInteger& activeInputChannels,
+                                              TrackRoute::Mode layout)
+    {
+        std::vector<TrackRoute> result;
+        std::vector<int> channels;
+
+        for (int ch = 0; ch <= activeInputChannels.getHighestBit(); ++ch)
+        {
+            if (activeInputChannels[ch])
+                channels.push_back(ch);
+        }
+
+        const size_t step = (layout == TrackRoute::mono) ? 1 : 2;
+
+        for (size_t i = 0; i < channels.size() && (int)result.size() < Constants::maxTracks; i += step)
+        {
+            if (step == 2 && i + 1 < channels.size())
+                result.push_back({ layout, channels[i], channels[i + 1] });
+            else
+                result.push_back({ TrackRoute::mono, channels[i], channels[i] });
+        }
+
+        const int numRouted = std::min((int)channels.size(), 
+                                       (int)result.size() * (layout == TrackRoute::mono ? 1 : 2));
+        if (numRouted < (int)channels.size())
+            juce::Logger::writeToLog("Input routing: only the first " + juce::String(Constants::maxTracks)
+                                     + " tracks are analysed, so " 
+                                     + juce::String((int)channels.size() - numRouted)
+                                     + " of " + juce::String((int)channels.size()) 
+                                     + " active inputs are ignored");
+
+        return result;
+    }
+
+private:
+    //=========================================================================
+    /*  Arranges a route's terms for the device outputs: straight through
+        for stereo outputs, summed at half gain for a single output.
+    */
+    void compileOutputTerms(Route& route)
+    {
+        route.numOutputTerms = { 0, 0 };
+
+        if (numMixedOutputs == 2)
+        {
+            route.outputTerms[0] = { route.terms[0][0], route.terms[0][1] };
+            route.outputTerms[1] = { route.terms[1][0], route.terms[1][1] };
+            route.numOutputTerms = { route.numTerms[0], route.numTerms[1] };
+        }
+        else if (numMixedOutputs == 1)
+        {
+            int n = 0;
+            for (int side = 0; side < 2; ++side)
+            {
+                for (int t = 0; t < route.numTerms[(size_t)side]; ++t)
+                {
+                    auto term = route.terms[(size_t)side][(size_t)t];
+                    term.gain *= 0.5f;
+                    route.outputTerms[0][(size_t)n++] = term;
+                }
+            }
+            route.numOutputTerms = { n, 0 };
+        }
+    }
+
+    //=========================================================================
+    std::atomic<TrackRoute::Mode> layout { TrackRoute::stereo };
+
+    std::array<Route, Constants::maxTracks> table;
+    int numRoutes = 0;
+    int numMixedOutputs = 0;
+};
@@ -0,0 +1,204 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#include "FFmpegPipe.h"
+
+#if ! JUCE_WINDOWS
+ #include <cerrno>
+ #include <fcntl.h>
+ #include <signal.h>
+ #include <spawn.h>
+ #include <sys/wait.h>
+ #include <unistd.h>
+
+ extern char** environ;
+#endif
+
+
+//=============================================================================
+FFmpegPipe::~FFmpegPipe()
+{
+    if (isRunning())
+        kill();
+
+    closeInput();
+}
+
+//=============================================================================
+#if ! JUCE_WINDOWS
+
+bool FFmpegPipe::start(const juce::StringArray& args, const juce::File& logFile)
+{
+    jassert(processID == 0); // Already running
+    jassert(!args.isEmpty());
+
+    // A write to a pipe whose reader has gone raises SIGPIPE, which would
+    // kill the app. Ignore it so write() just fails instead.
+    static const bool sigpipeIgnored = (::signal(SIGPIPE, SIG_IGN), true);
+    juce::ignoreUnused(sigpipeIgnored);
+
+    int fds[2];
+    if (::pipe(fds) != 0)
+        return false;
+
+    // Keep our end out of the child (and any other child started later)
+    ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, 
+                                     logFile.getFullPathName().toRawUTF8(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    std::vector<std::string> argStrings;
+    std::vector<char*> argv;
+    for (const auto& arg : args)
+        argStrings.push_back(arg.toStdString());
+    for (auto& arg : argStrings)
+        argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    pid_t pid = 0;
+    const int result = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    ::close(fds[0]);
+
+    if (result != 0)
+    {
+        DBG("FFmpegPipe: couldn't launch " << args[0] << " (error " << result << ")");
+        ::close(fds[1]);
+        return false;
+    }
+
+    processID = (int)pid;
+    inputFD = fds[1];
+    exitCode = -1;
+    return true;
+}
+
+bool FFmpegPipe::write(const void* data, size_t numBytes)
+{
+    auto* p = static_cast<const char*>(data);
+
+    while (numBytes > 0)
+    {
+        if (inputFD < 0)
+            return false;
+
+        const auto n = ::write(inputFD, p, numBytes);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false; // EPIPE if the process has exited
+        }
+
+        p += n;
+        numBytes -= (size_t)n;
+    }
+
+    return true;
+}
+
+void FFmpegPipe::closeInput()
+{
+    if (inputFD >= 0)
+        ::close(inputFD);
+
+    inputFD = -1;
+}
+
+bool FFmpegPipe::poll()
+{
+    if (processID == 0)
+        return true;
+
+    int status = 0;
+    const auto result = ::waitpid((pid_t)processID, &status, WNOHANG);
+
+    if (result == 0)
+        return false; // Still running
+
+    exitCode = (result > 0 && WIFEXITED(status)) ? WEXITSTATUS(status) : 1;
+    processID = 0;
+    return true;
+}
+
+void FFmpegPipe::kill()
+{
+    closeInput();
+
+    if (processID == 0)
+        return;
+
+    ::kill((pid_t)processID, SIGKILL);
+
+    int status = 0;
+    ::waitpid((pid_t)processID, &status, 0);
+    exitCode = 1;
+    processID = 0;
+}
+
+#else
+
+bool FFmpegPipe::start(const juce::StringArray&, const juce::File&)
+{
+    DBG("FFmpegPipe: not supported on this platform");
+    return false;
+}
+
+bool FFmpegPipe::write(const void*, size_t) { return false; }
+void FFmpegPipe::closeInput() {}
+bool FFmpegPipe::poll() { return true; }
+void FFmpegPipe::kill() {}
+
+#endif
+
+//=============================================================================
+bool FFmpegPipe::finish(int timeoutMs)
+{
+    closeInput();
+
+    const auto endMs = juce::Time::getMillisecondCounter() + (juce::uint32)timeoutMs;
+    while (!poll())
+    {
+        if (juce::Time::getMillisecondCounter() >= endMs)
+        {
+            DBG("FFmpegPipe: process didn't exit in time, killing it");
+            kill();
+            return false;
+        }
+
+        juce::Thread::sleep(pollIntervalMs);
+    }
+
+    return exitCode == 0;
+}
+
+bool FFmpegPipe::isRunning()
+{
+    return !poll();
+}
@@ -0,0 +1,93 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+
+
+//=============================================================================
+/*  Runs a child process (normally FFmpeg) with a pipe to its stdin.
+
+    juce::ChildProcess can only read a child's output, so this launches
+    the process itself to be able to stream data in. The child's stderr
+    goes to a log file rather than a second pipe, so it can never block
+    on output nobody is reading.
+
+    Writes block while the pipe is full, which is how a slow encoder 
+    pushes back on the writer. Only POSIX systems are supported; 
+    elsewhere start() fails and the caller should fall back to another
+    way of getting the data to the process.
+*/
+class FFmpegPipe
+{
+public:
+    //=========================================================================
+    FFmpegPipe() = default;
+    ~FFmpegPipe();
+
+    //=========================================================================
+    /*  Launches the process. args[0] is the executable, which is looked 
+        up on the PATH if it isn't a full path. The process's stderr is 
+        written to logFile. Returns false if it couldn't be started.
+    */
+    bool start(const juce::StringArray& args, const juce::File& logFile);
+
+    /*  Writes all of the data to the process's stdin, waiting for room in
+        the pipe as needed. Returns false if the process has closed its 
+        end (e.g. it exited with an error).
+    */
+    bool write(const void* data, size_t numBytes);
+
+    /*  Closes the process's stdin so it sees the end of its input, then
+        waits up to timeoutMs for it to exit, killing it if it doesn't.
+        Returns true if it exited successfully.
+    */
+    bool finish(int timeoutMs);
+
+    /*  Closes the process's stdin without waiting for it to exit, for
+        callers that want to wait in their own way (e.g. so they can be
+        cancelled).
+    */
+    void closeInput();
+
+    /*  Kills the process without waiting for it to finish its output.
+    */
+    void kill();
+
+    bool isRunning();
+
+    /*  Returns the process's exit code, or -1 if it hasn't exited.
+    */
+    int getExitCode() const { return exitCode; }
+
+private:
+    //=========================================================================
+    bool poll(); // Returns true once the process has exited
+
+    int processID = 0;
+    int inputFD = -1;
+    int exitCode = -1;
+
+    static constexpr int pollIntervalMs = 10;
+
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FFmpegPipe)
+};
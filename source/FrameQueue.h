@@ -21,78 +21,234 @@
 
 #pragma once
 #include <JuceHeader.h>
+#include <shared_mutex>
 #include "Utils.h"
 
 
 //=============================================================================
-/*  A helper for managing a queue of rgb video frames to pass between threads.
+/*  A helper for managing a queue of raw video frames to pass between threads.
+
+    Each frame is tagged with its index in the recording, so the 
+    consumer can tell when frames are missing and keep the video in 
+    sync with the audio.
+
+    The storage is only allocated while recording, since it can be large
+    (queueDepth frames at the capture resolution). Producers and the 
+    consumer hold a shared lock between acquiring a slot and handing it 
+    back, so allocate() and release() wait for any frame in progress.
+
+    The consumer can also keep the newest frame it read in the queue 
+    (see releaseReadSlots()), to refer back to without copying it.
 */
 class FrameQueue
 {
 public:
     //=========================================================================
-    FrameQueue()
+    FrameQueue() = default;
+
+    //=========================================================================
+    /*  Allocates storage for queueDepth frames of the given size, 
+        discarding anything already queued.
+    */
+    void allocate(const CaptureSettings& settings)
     {
-        // Initialize video FIFO storage
-        storage.reserve(bufferSize);
-        for (int i = 0; i < bufferSize; ++i)
-            storage.push_back(std::make_unique<uint8_t[]>(Constants::frameBytes));
+        std::unique_lock<std::shared_mutex> lock(storageLock);
+
+        frameBytes = settings.getFrameBytes();
+
+        // The FIFO keeps one slot empty to tell full from empty, and
+        // one more is for the frame the consumer may be holding
+        const int numSlots = std::max(settings.queueDepth, 1) + 2;
+
+        storage.clear();
+        storage.reserve((size_t)numSlots);
+        for (int i = 0; i < numSlots; ++i)
+            storage.push_back(std::make_unique<uint8_t[]>((size_t)frameBytes));
+
+        frameIndices.assign((size_t)numSlots, 0);
+
+        abstractFifo.setTotalSize(numSlots);
+        abstractFifo.reset();
+        numHeld = 0;
     }
 
+    /*  Frees the storage. Any frames still queued are lost.
+    */
+    void release()
+    {
+        std::unique_lock<std::shared_mutex> lock(storageLock);
+
+        storage.clear();
+        storage.shrink_to_fit();
+        frameIndices.clear();
+        frameBytes = 0;
+        abstractFifo.reset();
+        numHeld = 0;
+    }
+
+    /*  Returns the size of one frame in bytes, or 0 if the queue isn't
+        allocated.
+    */
+    int getFrameBytes() const { return frameBytes; }
+
     //=========================================================================
+    /*  Returns the next free slot for the producer to write a frame into,
+        or nullptr if the queue is full or not allocated.
+
+        The frame isn't visible to the consumer until commitWriteSlot()
+        is called, so the caller can fill the slot directly (e.g. from a 
+        GL readback) instead of going through a separate buffer. If this
+        returns a slot, the caller must pass it back with either 
+        commitWriteSlot() or cancelWriteSlot().
+    */
+    uint8_t* acquireWriteSlot()
+    {
+        // Never block the GL thread on an allocation
+        if (!storageLock.try_lock_shared())
+            return nullptr;
+
+        if (!storage.empty())
+        {
+            int start1, size1, start2, size2;
+            abstractFifo.prepareToWrite(1, start1, size1, start2, size2);
+
+            if (size1 > 0)
+            {
+                writeSlot = start1;
+                return storage[(size_t)start1].get();
+            }
+        }
+
+        storageLock.unlock_shared();
+        return nullptr; // Queue is full
+    }
+
+    /*  Publishes the slot returned by the last acquireWriteSlot(), as
+        the frame with the given index.
+    */
+    void commitWriteSlot(juce::int64 frameIndex)
+    {
+        frameIndices[(size_t)writeSlot] = frameIndex;
+        abstractFifo.finishedWrite(1);
+        storageLock.unlock_shared();
+    }
+
+    /*  Gives back the slot returned by the last acquireWriteSlot() 
+        without publishing it.
+    */
+    void cancelWriteSlot()
+    {
+        storageLock.unlock_shared();
+    }
+
     /*  Adds a frame to the queue.
 
         This function copies numbytes of data to the next available 
         buffer slot. It returns false if there are no slots available.
     */
-    bool enqueueVideoFrame(const uint8_t* rgb, int numBytes)
+    bool enqueueVideoFrame(const uint8_t* rgb, int numBytes, juce::int64 frameIndex)
     {
-        // Get the next write position
-        const auto scope = abstractFifo.write(1);
+        auto* slot = acquireWriteSlot();
+        if (slot == nullptr)
+            return false;
 
-        // Copy the frame data into the FIFO storage
-        if (scope.blockSize1 > 0)
+        if (numBytes != frameBytes)
         {
-            // This does not support dynamic frame sizes at the moment
-            jassert(numBytes == Constants::frameBytes);
-
-            std::memcpy(storage[scope.startIndex1].get(), rgb, (size_t)numBytes);
-            return true;
+            jassertfalse; // The frame doesn't match the recording settings
+            cancelWriteSlot();
+            return false;
         }
 
-        return false;
+        std::memcpy(slot, rgb, (size_t)numBytes);
+        commitWriteSlot(frameIndex);
+        return true;
     }
     
-    /*  Returns a pointer to the start of the next available buffer to read.
+    //=========================================================================
+    /*  Fills slots with pointers to up to maxSlots queued frames, oldest
+        first, and indices with their frame indices. Returns how many 
+        there were. A held frame isn't returned again.
 
-        The caller is reponsible for copying the data out, and must call
-        finishedRead() when they are done with it. The function will
-        return nullptr if there is no available buffer.
+        The frames stay in the queue so they can be written straight 
+        from its storage. If this returns more than zero, the caller must
+        call releaseReadSlots() when it is done with them.
     */
-    uint8_t* readNextBuffer()
+    int acquireReadSlots(const uint8_t** slots, juce::int64* indices, int maxSlots)
     {
-        int start1, size1, start2, size2;
-        abstractFifo.prepareToRead(1, start1, size1, start2, size2);
+        storageLock.lock_shared();
 
-        if (size1 > 0)
-            return storage[start1].get();;
-        
-        return nullptr; // Queue is empty
+        int start1 = 0, size1 = 0, start2 = 0, size2 = 0;
+        if (!storage.empty())
+            abstractFifo.prepareToRead(maxSlots + numHeld, start1, size1, start2, size2);
+
+        // The held frame is the oldest in the FIFO
+        int numSlots = 0;
+        for (int i = 0; i < size1 + size2; ++i)
+        {
+            const int slot = i < size1 ? start1 + i : start2 + i - size1;
+            if (i < numHeld)
+                continue;
+
+            slots[numSlots] = storage[(size_t)slot].get();
+            indices[numSlots] = frameIndices[(size_t)slot];
+            lastReadSlot = slot;
+            ++numSlots;
+        }
+
+        if (numSlots == 0)
+            storageLock.unlock_shared();
+
+        return numSlots;
+    }
+
+    /*  Hands the frames from the last acquireReadSlots() back to the 
+        producer, along with any held frame.
+
+        If keepLast is true, the newest of them stays in the queue and 
+        getHeldSlot() returns it until the next releaseReadSlots() or 
+        releaseHeldSlot(). It takes up a slot the producer could 
+        otherwise use.
+    */
+    void releaseReadSlots(int numSlots, bool keepLast = false)
+    {
+        jassert(numSlots > 0 || !keepLast);
+
+        const int numKept = keepLast ? 1 : 0;
+        abstractFifo.finishedRead(numHeld + numSlots - numKept);
+        heldSlot = lastReadSlot;
+        numHeld = numKept;
+        storageLock.unlock_shared();
     }
 
-    /*  Finalizes a read and advances the internal read pointer.
+    /*  Returns the frame kept by releaseReadSlots(), or nullptr if there
+        isn't one. It is only valid on the consumer's thread, or once the
+        consumer has stopped, and until the queue is allocated or 
+        released.
+    */
+    const uint8_t* getHeldSlot() const
+    {
+        return numHeld > 0 ? storage[(size_t)heldSlot].get() : nullptr;
+    }
 
-        This function must be called after each read is finished.
+    /*  Hands the held frame, if any, back to the producer. Call it from
+        the consumer's thread, or once the consumer has stopped.
     */
-    void finishRead()
+    void releaseHeldSlot()
     {
-        abstractFifo.finishedRead(1);
+        abstractFifo.finishedRead(numHeld);
+        numHeld = 0;
     }
 
 private:
     //=========================================================================
-    static constexpr int bufferSize = 8;
-
-    juce::AbstractFifo abstractFifo { bufferSize };
+    juce::AbstractFifo abstractFifo { 1 };
     std::vector<std::unique_ptr<uint8_t[]>> storage;
+    std::vector<juce::int64> frameIndices; // Of the frame in each slot
+    int writeSlot = 0; // Slot returned by the last acquireWriteSlot()
+    int lastReadSlot = 0; // Slot of the newest frame from acquireReadSlots()
+    int heldSlot = 0; // Slot of the frame kept by releaseReadSlots()
+    int numHeld = 0; // 1 if the consumer is holding a frame
+    std::atomic<int> frameBytes { 0 };
+
+    std::shared_mutex storageLock;
 };
\ No newline at end of file
@@ -0,0 +1,315 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#include "FrameStore.h"
+
+
+//=============================================================================
+namespace FrameStore
+{
+    // Chunk types
+    enum ChunkType : uint8_t
+    {
+        rawFrame = 0,
+        keyFrame = 1,   // Run-length encoded
+        deltaFrame = 2, // XORed with the previous frame, then run-length encoded
+        indexChunk = 3  // Offsets of every frame chunk, then the footer
+    };
+
+    static constexpr int fileMagic = 0x5346504d;   // "MPFS"
+    static constexpr int footerMagic = 0x4946504d; // "MPFI"
+    static constexpr int fileVersion = 2; // 2 added frame indices
+
+    /*  The encoding is a sequence of tokens. A control byte c < 128 is 
+        followed by c + 1 literal bytes. A control byte c >= 128 is 
+        followed by one byte to repeat c - 128 + minRun times.
+    */
+    static constexpr int minRun = 3;
+    static constexpr int maxRun = 127 + minRun;
+    static constexpr int maxLiterals = 128;
+}
+
+//=============================================================================
+int FrameStore::getMaxEncodedSize(int numBytes)
+{
+    // All literals, plus one control byte per maxLiterals
+    return numBytes + (numBytes + maxLiterals - 1) / maxLiterals;
+}
+
+int FrameStore::encode(const uint8_t* src, int numBytes, uint8_t* dest)
+{
+    uint8_t* d = dest;
+    int i = 0;
+    int literalStart = 0;
+
+    auto flushLiterals = [&](int end)
+    {
+        while (literalStart < end)
+        {
+            const int n = std::min(end - literalStart, maxLiterals);
+            *d++ = (uint8_t)(n - 1);
+            std::memcpy(d, src + literalStart, (size_t)n);
+            d += n;
+            literalStart += n;
+        }
+    };
+
+    while (i < numBytes)
+    {
+        // Measure the run starting here
+        const uint8_t value = src[i];
+        int run = 1;
+        while (i + run < numBytes && run < maxRun && src[i + run] == value)
+            ++run;
+
+        if (run >= minRun)
+        {
+            flushLiterals(i);
+            *d++ = (uint8_t)(128 + run - minRun);
+            *d++ = value;
+            i += run;
+            literalStart = i;
+        }
+        else
+        {
+            i += run;
+        }
+    }
+
+    flushLiterals(numBytes);
+    return (int)(d - dest);
+}
+
+bool FrameStore::decode(const uint8_t* src, int srcBytes, uint8_t* dest, int numBytes)
+{
+    const uint8_t* s = src;
+    const uint8_t* const srcEnd = src + srcBytes;
+    int written = 0;
+
+    while (s < srcEnd)
+    {
+        const int control = *s++;
+
+        if (control < 128)
+        {
+            const int n = control + 1;
+            if (srcEnd - s < n || numBytes - written < n)
+                return false;
+
+            std::memcpy(dest + written, s, (size_t)n);
+            s += n;
+            written += n;
+        }
+        else
+        {
+            const int n = control - 128 + minRun;
+            if (s == srcEnd || numBytes - written < n)
+                return false;
+
+            std::memset(dest + written, *s++, (size_t)n);
+            written += n;
+        }
+    }
+
+    return written == numBytes;
+}
+
+//=============================================================================
+FrameStore::Writer::~Writer()
+{
+    close();
+}
+
+bool FrameStore::Writer::open(const juce::File& file, const CaptureSettings& settings)
+{
+    close();
+    file.deleteFile();
+
+    out = std::make_unique<juce::FileOutputStream>(file, 1 << 20);
+    if (!out->openedOk())
+    {
+        out.reset();
+        return false;
+    }
+
+    frameBytes = settings.getFrameBytes();
+    previous.allocate((size_t)frameBytes, true);
+    delta.allocate((size_t)frameBytes, false);
+    encoded.allocate((size_t)getMaxEncodedSize(frameBytes), false);
+    offsets.clear();
+    stats = {};
+
+    out->writeInt(fileMagic);
+    out->writeInt(fileVersion);
+    out->writeInt(settings.width);
+    out->writeInt(settings.height);
+    out->writeInt(settings.fps);
+    out->writeInt((int)settings.pixelFormat);
+    out->writeInt(frameBytes);
+    out->writeInt(keyFrameInterval);
+
+    return !out->getStatus().failed();
+}
+
+bool FrameStore::Writer::write(const uint8_t* frame, juce::int64 frameIndex)
+{
+    if (out == nullptr)
+        return false;
+
+    const auto startTicks = juce::Time::getHighResolutionTicks();
+
+    const bool isKeyFrame = stats.numFrames % keyFrameInterval == 0;
+    const uint8_t* source = frame;
+
+    if (!isKeyFrame)
+    {
+        // Unchanged pixels become zeros, which run-length encode well
+        for (int i = 0; i < frameBytes; ++i)
+            delta[i] = frame[i] ^ previous[i];
+        source = delta;
+    }
+
+    const int encodedBytes = encode(source, frameBytes, encoded);
+
+    uint8_t type = isKeyFrame ? keyFrame : deltaFrame;
+    const uint8_t* payload = encoded;
+    int payloadBytes = encodedBytes;
+
+    if (encodedBytes >= frameBytes)
+    {
+        type = rawFrame;
+        payload = frame;
+        payloadBytes = frameBytes;
+    }
+
+    std::memcpy(previous, frame, (size_t)frameBytes);
+
+    stats.encodeSeconds += juce::Time::highResolutionTicksToSeconds(
+                               juce::Time::getHighResolutionTicks() - startTicks);
+
+    offsets.push_back(out->getPosition());
+    out->writeByte((char)type);
+    out->writeInt(payloadBytes);
+    out->writeInt64(frameIndex);
+    out->write(payload, (size_t)payloadBytes);
+
+    ++stats.numFrames;
+    stats.rawBytes += frameBytes;
+    stats.storedBytes += 13 + payloadBytes;
+
+    return !out->getStatus().failed();
+}
+
+bool FrameStore::Writer::close()
+{
+    if (out == nullptr)
+        return false;
+
+    const auto indexOffset = out->getPosition();
+    out->writeByte((char)indexChunk);
+    out->writeInt((int)(offsets.size() * sizeof(juce::int64)));
+    for (auto offset : offsets)
+        out->writeInt64(offset);
+
+    out->writeInt64(indexOffset);
+    out->writeInt((int)offsets.size());
+    out->writeInt(footerMagic);
+    out->flush();
+
+    const bool ok = !out->getStatus().failed();
+    out.reset();
+    return ok;
+}
+
+//=============================================================================
+bool FrameStore::Reader::open(const juce::File& file)
+{
+    in = std::make_unique<juce::FileInputStream>(file);
+    if (!in->openedOk() || in->readInt() != fileMagic || in->readInt() != fileVersion)
+    {
+        in.reset();
+        return false;
+    }
+
+    settings.width = in->readInt();
+    settings.height = in->readInt();
+    settings.fps = in->readInt();
+    settings.pixelFormat = (in->readInt() == (int)CaptureSettings::yuv420p) ? CaptureSettings::yuv420p
+                                                                             : CaptureSettings::rgb24;
+    frameBytes = in->readInt();
+    in->readInt(); // Key frame interval
+
+    if (frameBytes != settings.getFrameBytes())
+    {
+        in.reset();
+        return false;
+    }
+
+    previous.allocate((size_t)frameBytes, true);
+    encoded.allocate((size_t)getMaxEncodedSize(frameBytes), false);
+    hasPrevious = false;
+    return true;
+}
+
+bool FrameStore::Reader::readNextFrame(uint8_t* dest, juce::int64& frameIndex)
+{
+    if (in == nullptr || in->isExhausted())
+        return false;
+
+    const int type = (uint8_t)in->readByte();
+    const int payloadBytes = in->readInt();
+
+    if (type == indexChunk || payloadBytes < 0 || payloadBytes > getMaxEncodedSize(frameBytes))
+        return false;
+
+    frameIndex = in->readInt64();
+
+    if (in->read(encoded, payloadBytes) != payloadBytes)
+        return false; // Cut off mid-frame
+
+    switch (type)
+    {
+        case rawFrame:
+            if (payloadBytes != frameBytes)
+                return false;
+            std::memcpy(dest, encoded, (size_t)frameBytes);
+            break;
+
+        case keyFrame:
+            if (!decode(encoded, payloadBytes, dest, frameBytes))
+                return false;
+            break;
+
+        case deltaFrame:
+            if (!hasPrevious || !decode(encoded, payloadBytes, dest, frameBytes))
+                return false;
+            for (int i = 0; i < frameBytes; ++i)
+                dest[i] ^= previous[i];
+            break;
+
+        default:
+            return false;
+    }
+
+    std::memcpy(previous, dest, (size_t)frameBytes);
+    hasPrevious = true;
+    return true;
+}
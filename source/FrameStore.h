@@ -0,0 +1,157 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "Utils.h"
+
+
+//=============================================================================
+/*  A compressed file of raw video frames, used to hold a recording on 
+    disk until it is encoded.
+
+    MoPanning frames are mostly background with sparse dots, and change
+    little from one frame to the next, so the codec is very simple: 
+    each frame is XORed with the one before (leaving mostly zeros), then
+    run-length encoded. Every keyFrameInterval frames is stored without
+    the XOR, so a reader can start from there. A frame that wouldn't 
+    shrink is stored raw. Run the app with --benchmark-frame-store to
+    measure it on captured frames.
+
+    Frames can be left out (e.g. when they are unchanged), so each one
+    is stored with its index in the recording. The file is a header, 
+    then one chunk per frame (a type byte, the payload size, the frame
+    index and the payload), then an index chunk with the offset of every
+    frame and a footer pointing to it. The frames can be read
+    in order without the index, so a file that was cut off can still be
+    read up to the last complete frame.
+*/
+namespace FrameStore
+{
+    /*  Compression stats for a recording.
+    */
+    struct Stats
+    {
+        juce::int64 numFrames = 0;
+        juce::int64 rawBytes = 0; // Before compression
+        juce::int64 storedBytes = 0; // Including chunk headers
+        double encodeSeconds = 0.0; // Time spent compressing
+
+        juce::String toString() const
+        {
+            const double ratio = storedBytes > 0 ? (double)rawBytes / (double)storedBytes : 0.0;
+            const double mbPerSecond = encodeSeconds > 0.0 ? rawBytes / encodeSeconds / 1.0e6 : 0.0;
+
+            juce::String s;
+            s << "Frame store: " << numFrames << " frames, "
+              << juce::String(rawBytes / 1.0e6, 1) << " MB -> "
+              << juce::String(storedBytes / 1.0e6, 1) << " MB ("
+              << juce::String(ratio, 1) << ":1), compressed at "
+              << juce::String(mbPerSecond, 0) << " MB/s";
+            return s;
+        }
+    };
+
+    //=========================================================================
+    /*  Writes frames to a frame store file. Use it from one thread.
+    */
+    class Writer
+    {
+    public:
+        Writer() = default;
+        ~Writer();
+
+        /*  Creates the file for frames in the given format, replacing any
+            existing file. Returns false if it couldn't be created.
+        */
+        bool open(const juce::File& file, const CaptureSettings& settings);
+
+        /*  Compresses and writes one frame of settings.getFrameBytes(),
+            with its index in the recording.
+        */
+        bool write(const uint8_t* frame, juce::int64 frameIndex);
+
+        /*  Writes the index and closes the file.
+        */
+        bool close();
+
+        const Stats& getStats() const { return stats; }
+
+        static constexpr int keyFrameInterval = 120;
+
+    private:
+        std::unique_ptr<juce::FileOutputStream> out;
+        int frameBytes = 0;
+        juce::HeapBlock<uint8_t> previous, delta, encoded;
+        std::vector<juce::int64> offsets;
+        Stats stats;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Writer)
+    };
+
+    //=========================================================================
+    /*  Reads the frames back from a frame store file, in order. Use it 
+        from one thread.
+    */
+    class Reader
+    {
+    public:
+        Reader() = default;
+
+        /*  Opens the file and reads its header. Returns false if it isn't
+            a frame store.
+        */
+        bool open(const juce::File& file);
+
+        /*  Returns the format the frames were written in.
+        */
+        const CaptureSettings& getSettings() const { return settings; }
+
+        /*  Decompresses the next frame into dest, which must hold 
+            getSettings().getFrameBytes(), and sets frameIndex to its
+            index. Returns false at the end of the frames, or if the file
+            is damaged.
+        */
+        bool readNextFrame(uint8_t* dest, juce::int64& frameIndex);
+
+    private:
+        std::unique_ptr<juce::FileInputStream> in;
+        CaptureSettings settings;
+        int frameBytes = 0;
+        juce::HeapBlock<uint8_t> previous, encoded;
+        bool hasPrevious = false;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Reader)
+    };
+
+    //=========================================================================
+    /*  Run-length encodes numBytes of src into dest, which must hold 
+        getMaxEncodedSize(numBytes), and returns the encoded size.
+    */
+    int encode(const uint8_t* src, int numBytes, uint8_t* dest);
+
+    /*  Decodes srcBytes of src into exactly numBytes of dest. Returns 
+        false if the data is damaged.
+    */
+    bool decode(const uint8_t* src, int srcBytes, uint8_t* dest, int numBytes);
+
+    int getMaxEncodedSize(int numBytes);
+}
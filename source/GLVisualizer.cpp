@@ -28,17 +28,24 @@ GLVisualizer::GLVisualizer()
     grid = std::make_unique<GridComponent>();
     addChildComponent(grid.get());
 
+    statsOverlay = std::make_unique<StatsOverlay>();
+    addChildComponent(statsOverlay.get());
+
     auto glVersion = juce::OpenGLContext::OpenGLVersion::openGL3_2;
     openGLContext.setOpenGLVersionRequired(glVersion);
     openGLContext.setRenderer(this);
     openGLContext.attachTo(*this);
-    openGLContext.setContinuousRepainting(true);
+    openGLContext.setContinuousRepainting(false);
 
     startTime = (float)juce::Time::getMillisecondCounterHiRes() * 0.001f;
+    setFrameRateCap(defaultFrameRateCap);
+
+    captureCounters = std::make_unique<std::array<CaptureCounters, Constants::maxCaptureTargets>>();
 }
 
 GLVisualizer::~GLVisualizer()
 {
+    stopTimer();
     openGLContext.detach();
 }
 
@@ -53,10 +60,12 @@ void GLVisualizer::newOpenGLContextCreated()
     attributes = std::make_unique<Attributes>(*mainShader);
     uniforms = std::make_unique<Uniforms>(*mainShader);
 
-    captureProj = buildProjectionMatrix(Constants::W, Constants::H);
-    captureProj.mat[5] *= -1.0f; // Becuase OpenGL has bottom-up row order
-    captureFBO.initialise(openGLContext, Constants::W, Constants::H);
-    capturePixels.resize(Constants::W * Constants::H * 3);
+    createDecayShader();
+    createYuvShader();
+    glGenVertexArrays(1, &decayVAO);
+    gpuTimer = std::make_unique<GpuTimer>();
+    gpuTimer->create();
+    screenTrail = std::make_unique<TrailBuffer>();
 
     glEnable(GL_PROGRAM_POINT_SIZE);
 }
@@ -68,22 +77,35 @@ void GLVisualizer::renderOpenGL()
 
 void GLVisualizer::openGLContextClosing() 
 {
+    using namespace juce::gl;
+
     // Clean up GL resources
     mainShader.reset();
     vertexBuffer.reset();
     attributes.reset();
     uniforms.reset();
     colourMapTexture.release();
-    captureFBO.release();
+    releaseCapture(); // Any frames still in flight are lost
+    if (captureDraining.exchange(false))
+        captureDrained.signal();
+    yuvSource.reset();
+    yuvSize.reset();
+    yuvShader.reset();
+
+    decaySubtract.reset();
+    decayShader.reset();
+    screenTrail.reset();
+    glDeleteVertexArrays(1, &decayVAO);
+    decayVAO = 0;
+    gpuTimer.reset();
 }
 
 //=============================================================================
 void GLVisualizer::resized()
 {
     displayProj = buildProjectionMatrix((float)getWidth(), (float)getHeight());
-    captureProj = buildProjectionMatrix(Constants::W, Constants::H); // In case this was called from setDimension()
-    captureProj.mat[5] *= -1.0f; // Becuase OpenGL has bottom-up row order
     grid->setSize(getWidth(), getHeight());
+    statsOverlay->setSize(getWidth(), getHeight());
 }
 
 //=============================================================================
@@ -92,14 +114,21 @@ void GLVisualizer::setResultsPointer(std::array<TrackSlot, Constants::maxTracks>
     results = resultsPtr;
 }
 
-void GLVisualizer::setFrameQueuePointer(FrameQueue* frameQueuePtr)
+void GLVisualizer::setFrameQueuePointer(FrameQueue* frameQueuePtr, int targetIndex)
 {
-    frameQueue = frameQueuePtr;
+    jassert(juce::isPositiveAndBelow(targetIndex, Constants::maxCaptureTargets));
+    frameQueues[(size_t)targetIndex] = frameQueuePtr;
+}
+
+void GLVisualizer::setCaptureClockPointer(const CaptureClock* clockPtr)
+{
+    captureClock = clockPtr;
 }
 
 void GLVisualizer::setDimension(Dimension newDimension)
 {
     dimension = newDimension;
+    trailsNeedReseed.store(true);
     resized(); // Force a resize to update the projection matrix
 }
 
@@ -112,6 +141,7 @@ void GLVisualizer::setTrackColourScheme(ColourScheme newColourScheme, int trackI
     // Update track colour scheme and set flag
     trackColourSchemes[trackIndex].store(newColourScheme);
     textureNeedsRebuild.store(true);
+    trailsNeedReseed.store(true);
 }
 
 void GLVisualizer::setShowGrid(bool shouldShow)
@@ -119,15 +149,52 @@ void GLVisualizer::setShowGrid(bool shouldShow)
     grid->setVisible(shouldShow);
 }
 
+void GLVisualizer::setShowStats(bool shouldShow)
+{
+    statsOverlay->setVisible(shouldShow);
+}
+
+bool GLVisualizer::isShowingStats() const
+{
+    return statsOverlay->isVisible();
+}
+
+void GLVisualizer::setStatsSource(std::function<juce::String()> source)
+{
+    statsOverlay->setTextSource(std::move(source));
+}
+
+void GLVisualizer::setFrameRateCap(int framesPerSecond)
+{
+    frameRateCap.store(juce::jmax(1, framesPerSecond));
+    startTimer(juce::jmax(1, juce::roundToInt(1000.0 / juce::jmax(1, framesPerSecond))));
+}
+
+GLVisualizer::FrameStats GLVisualizer::getFrameStats() const
+{
+    FrameStats stats;
+    for (size_t i = 0; i < stats.buckets.size(); ++i)
+        stats.buckets[i] = frameIntervalBuckets[i].load(std::memory_order_relaxed);
+    stats.numFrames = numFramesRendered.load(std::memory_order_relaxed);
+    stats.numIdleTicks = numIdleTicks.load(std::memory_order_relaxed);
+    stats.totalRenderMs = totalRenderMs.load(std::memory_order_relaxed);
+    stats.gpuMs = gpuFrameMs.load(std::memory_order_relaxed);
+    stats.particleBudget = particleBudget.load(std::memory_order_relaxed);
+    stats.numLiveParticles = numLiveParticles.load(std::memory_order_relaxed);
+    return stats;
+}
+
 void GLVisualizer::setMinFrequency(float newMinFrequency)
 {
     minFrequency = newMinFrequency;
+    trailsNeedReseed.store(true);
     grid->setFrequencyRange(minFrequency, maxFrequency);
 }
 
 void GLVisualizer::setMaxFrequency(float newMaxFrequency)
 {
     maxFrequency = newMaxFrequency;
+    trailsNeedReseed.store(true);
     grid->setFrequencyRange(minFrequency, maxFrequency);
 }
 
@@ -139,22 +206,91 @@ void GLVisualizer::setRecedeSpeed(float newRecedeSpeed)
 void GLVisualizer::setDotSize(float newDotSize)
 {
     dotSize = newDotSize;
+    trailsNeedReseed.store(true);
 }
 
 void GLVisualizer::setFadeEndZ(float newFadeEndZ)
 {
-    fadeEndZ = newFadeEndZ;
+    // Older particles wouldn't fit in the packed birth distance
+    fadeEndZ = juce::jlimit(0.0f, ParticleVertex::maxFadeEndZ, newFadeEndZ);
+    trailsNeedReseed.store(true);
 }
 
 //=============================================================================
-void GLVisualizer::startRecording()
+bool GLVisualizer::startRecording(const std::vector<CaptureSettings>& targets)
 {
+    jassert(!recording);
+    jassert(!targets.empty() && (int)targets.size() <= Constants::maxCaptureTargets);
+
+    // The GL thread may still be using the last recording's settings
+    if (captureDraining.load())
+    {
+        jassertfalse; // Call waitForCaptureDrain() before reusing the queues
+        return false;
+    }
+
+    captureSettings = targets;
+
+    for (auto& counters : *captureCounters)
+        counters.reset();
+
+    trailsNeedReseed.store(true); // The capture trails are stale
     recording = true;
+    return true;
 }
 
-void GLVisualizer::stopRecording()
+bool GLVisualizer::stopRecording()
 {
-    recording = false;
+    // Stop capturing before asking for the drain, so no new targets
+    // are created after it
+    const bool wasRecording = recording.exchange(false);
+    if (wasRecording)
+    {
+        captureDrained.reset();
+        captureDraining.store(true);
+    }
+
+    // Don't wait forever, since the GL thread may be waiting on the message thread
+    const bool drained = waitForCaptureDrain(250);
+    if (!drained)
+        DBG("Timed out waiting for the last capture frames");
+
+    if (wasRecording)
+        for (const auto& stats : getCaptureStats())
+            DBG(stats.toString());
+
+    return drained;
+}
+
+bool GLVisualizer::waitForCaptureDrain(int timeoutMs)
+{
+    if (!captureDraining.load())
+        return true;
+
+    return captureDrained.wait(timeoutMs) || !captureDraining.load();
+}
+
+std::vector<GLVisualizer::CaptureStats> GLVisualizer::getCaptureStats() const
+{
+    std::vector<CaptureStats> result;
+
+    for (size_t i = 0; i < captureSettings.size() && i < captureCounters->size(); ++i)
+    {
+        const auto& counters = (*captureCounters)[i];
+
+        CaptureStats stats;
+        stats.targetIndex = (int)i;
+        stats.width = captureSettings[i].width;
+        stats.height = captureSettings[i].height;
+        stats.fps = captureSettings[i].fps;
+        stats.numRendered = counters.numRendered.load(std::memory_order_relaxed);
+        stats.numDuplicated = counters.numDuplicated.load(std::memory_order_relaxed);
+        stats.numDropped = counters.numDropped.load(std::memory_order_relaxed);
+        stats.numLate = counters.numLate.load(std::memory_order_relaxed);
+        result.push_back(stats);
+    }
+
+    return result;
 }
 
 //=============================================================================
@@ -164,11 +300,12 @@ void GLVisualizer::createShaders()
     R"(
         #version 150
 
-        in float frequency;
-        in float amplitude;
-        in float panIndex;
-        in float birthDistance; // Distance traveled when particle was created
-        in int trackIndex;
+        // Packed attributes (see GLVisualizer::ParticleVertex)
+        in uint frequency; // log2(Hz) over [0, 15] as 16 bits
+        in uint amplitude; // [0,1] as 8 bits
+        in int panIndex; // [-1,1] as signed 8 bits
+        in uint birthDistance; // Quantized distance at birth, modulo 2^16
+        in uint trackIndex; // Track in the low 4 bits
 
         uniform sampler2D uColourMap;
 
@@ -178,7 +315,10 @@ void GLVisualizer::createShaders()
         uniform vec2 uWindowSize;
         uniform float uMinFrequency;
         uniform float uMaxFrequency;
-        uniform float uGlobalDistance; // Distance traveled at current frame
+        uniform int uBirthBase; // Quantized distance at current frame, modulo 2^16
+        uniform float uBirthFraction; // Fractional part of the above
+        uniform float uBirthQuantum; // Size of one distance step (m)
+        uniform int uAgeOffset; // Steps the render distance is behind uBirthBase
         uniform float uFadeEndZ;
         uniform float uDotSize;
 
@@ -186,31 +326,45 @@ void GLVisualizer::createShaders()
 
         void main()
         {
+            // Unpack the attributes
+            float logFrequency = float(frequency) * (15.0 / 65535.0);
+            float amp = float(amplitude) / 255.0;
+            float pan = float(panIndex) / 127.0;
+            int age = ((uBirthBase - int(birthDistance)) & 0xFFFF) - uAgeOffset;
+            int track = int(trackIndex & 15u);
+
             // Calculate world position and size based on attributes
-            float logMin = log(uMinFrequency);
-            float logMax = log(uMaxFrequency);
+            float logMin = log2(uMinFrequency);
+            float logMax = log2(uMaxFrequency);
 
             float aspect = uWindowSize.x / uWindowSize.y;
 
-            float x = panIndex * aspect;
-            float y = (log(frequency) - logMin) / (logMax - logMin) * 2.0 - 1.0;
-            float z = (uGlobalDistance - birthDistance) * -1.0;
+            float x = pan * aspect;
+            float y = (logFrequency - logMin) / (logMax - logMin) * 2.0 - 1.0;
+            float z = (float(age) + uBirthFraction) * uBirthQuantum * -1.0;
             vec4 worldPosition = vec4(x, y, z, 1.0);
 
             gl_Position = uProjectionMatrix * uViewMatrix * worldPosition;
-            gl_PointSize = (0.5 + amplitude) * uDotSize * uWindowSize.y * 0.008;
+            gl_PointSize = (0.5 + amp) * uDotSize * uWindowSize.y * 0.008;
             // gl_PointSize = frequency / 1000.0;
 
             // Calculate colour and alpha
             float depth = -z / uFadeEndZ;
-            float alpha = (0.5 + amplitude * 0.5) * (1.0 - depth);
+            float alpha = (0.5 + amp * 0.5) * (1.0 - depth);
             
             // Look up color from the texture
-            float u = amplitude;
-            float v = 1.0 - (float(trackIndex) + 0.5) / 8.0;
+            float u = amp;
+            float v = 1.0 - (float(track) + 0.5) / 8.0;
             vec3 rgb = texture(uColourMap, vec2(u, v)).rgb;
 
             colour = vec4(rgb, alpha);
+
+            // Hide particles born after the render distance (see setDistanceUniforms)
+            if (age < 0)
+            {
+                gl_Position = vec4(0.0, 0.0, 2.0, 1.0); // Outside the clip volume
+                gl_PointSize = 0.0;
+            }
         }
     )";
     
@@ -253,6 +407,124 @@ void GLVisualizer::createShaders()
     }
 }
 
+void GLVisualizer::createDecayShader()
+{
+    // A single triangle that covers the whole viewport, made from the
+    // vertex ID so no vertex buffer is needed
+    juce::String vertexShaderCode =
+    R"(
+        #version 150
+
+        void main()
+        {
+            vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+            gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+        }
+    )";
+
+    juce::String fragmentShaderCode =
+    R"(
+        #version 150
+
+        uniform float uSubtract;
+        out vec4 frag;
+
+        void main()
+        {
+            frag = vec4(uSubtract);
+        }
+    )";
+
+    decayShader = std::make_unique<OpenGLShaderProgram>(openGLContext);
+
+    if (decayShader->addVertexShader(vertexShaderCode) == false
+     || decayShader->addFragmentShader(fragmentShaderCode) == false
+     || decayShader->link() == false)
+    {
+        DBG("Decay shader compilation/linking failed: " + decayShader->getLastError());
+        decayShader.reset();
+        return;
+    }
+
+    decaySubtract = std::make_unique<OpenGLShaderProgram::Uniform>(*decayShader, "uSubtract");
+}
+
+void GLVisualizer::createYuvShader()
+{
+    // The same full-viewport triangle as the decay pass
+    juce::String vertexShaderCode =
+    R"(
+        #version 150
+
+        void main()
+        {
+            vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+            gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+        }
+    )";
+
+    // Each output texel is one byte of the I420 frame
+    juce::String fragmentShaderCode =
+    R"(
+        #version 150
+
+        uniform sampler2D uSource; // RGB capture frame
+        uniform vec2 uSize; // Of the capture frame
+        out vec4 frag;
+
+        vec3 rgbAt(ivec2 p)
+        {
+            return texelFetch(uSource, p, 0).rgb;
+        }
+
+        void main()
+        {
+            ivec2 size = ivec2(uSize);
+            ivec2 p = ivec2(gl_FragCoord.xy);
+            float value;
+
+            if (p.y < size.y)
+            {
+                value = 16.0 / 255.0 + dot(rgbAt(p), vec3(0.257, 0.504, 0.098));
+            }
+            else
+            {
+                // Chroma planes are half size in each direction, end to end
+                int chromaWidth = size.x / 2;
+                int planeSize = chromaWidth * (size.y / 2);
+                int i = (p.y - size.y) * size.x + p.x;
+                bool isV = i >= planeSize;
+                if (isV)
+                    i -= planeSize;
+
+                // Average the 2x2 block of pixels the sample covers
+                ivec2 q = ivec2(i % chromaWidth, i / chromaWidth) * 2;
+                vec3 c = 0.25 * (rgbAt(q) + rgbAt(q + ivec2(1, 0)) 
+                               + rgbAt(q + ivec2(0, 1)) + rgbAt(q + ivec2(1, 1)));
+
+                value = 128.0 / 255.0 + (isV ? dot(c, vec3( 0.439, -0.368, -0.071))
+                                             : dot(c, vec3(-0.148, -0.291,  0.439)));
+            }
+
+            frag = vec4(value, 0.0, 0.0, 1.0);
+        }
+    )";
+
+    yuvShader = std::make_unique<OpenGLShaderProgram>(openGLContext);
+
+    if (yuvShader->addVertexShader(vertexShaderCode) == false
+     || yuvShader->addFragmentShader(fragmentShaderCode) == false
+     || yuvShader->link() == false)
+    {
+        DBG("YUV shader compilation/linking failed: " + yuvShader->getLastError());
+        yuvShader.reset();
+        return;
+    }
+
+    yuvSource = std::make_unique<OpenGLShaderProgram::Uniform>(*yuvShader, "uSource");
+    yuvSize = std::make_unique<OpenGLShaderProgram::Uniform>(*yuvShader, "uSize");
+}
+
 void GLVisualizer::updateUniforms()
 {
     jassert(uniforms != nullptr 
@@ -262,7 +534,10 @@ void GLVisualizer::updateUniforms()
          && uniforms->windowSize != nullptr
          && uniforms->minFrequency != nullptr
          && uniforms->maxFrequency != nullptr
-         && uniforms->globalDistance != nullptr
+         && uniforms->birthBase != nullptr
+         && uniforms->birthFraction != nullptr
+         && uniforms->birthQuantum != nullptr
+         && uniforms->ageOffset != nullptr
          && uniforms->fadeEndZ != nullptr
          && uniforms->dotSize != nullptr
     );
@@ -273,11 +548,30 @@ void GLVisualizer::updateUniforms()
     uniforms->windowSize->set((float)getWidth(), (float)getHeight());
     uniforms->minFrequency->set(minFrequency);
     uniforms->maxFrequency->set(maxFrequency);
-    uniforms->globalDistance->set(globalDistance);
+    setDistanceUniforms(globalDistance);
     uniforms->fadeEndZ->set(fadeEndZ);
     uniforms->dotSize->set(dotSize);
 }
 
+int GLVisualizer::setDistanceUniforms(double distance)
+{
+    // Split the distance into the quantized base the vertices are stored
+    // relative to and the remaining fraction of a step. The base is 
+    // always the current distance, so that particles born after an 
+    // earlier render distance come out with a negative age.
+    const double baseSteps = std::floor(globalDistance / ParticleVertex::birthQuantum);
+    const double steps = distance / ParticleVertex::birthQuantum;
+    const double wholeSteps = std::floor(steps);
+    const int ageOffset = std::max(0, (int)(baseSteps - wholeSteps));
+
+    uniforms->birthBase->set((GLint)((juce::int64)baseSteps & 0xFFFF));
+    uniforms->birthFraction->set((GLfloat)(steps - wholeSteps));
+    uniforms->birthQuantum->set((GLfloat)ParticleVertex::birthQuantum);
+    uniforms->ageOffset->set((GLint)ageOffset);
+
+    return ageOffset;
+}
+
 void GLVisualizer::buildTexture()
 {
     juce::Image colourMapImage(juce::Image::RGB, 256, Constants::maxTracks, true);
@@ -304,12 +598,14 @@ void GLVisualizer::renderFrame()
 {
     using namespace juce::gl;
 
+    const auto startTicks = juce::Time::getHighResolutionTicks();
+
     mainShader->use();
 
     // Update the global distance/time counters
     float t = (float)(juce::Time::getMillisecondCounterHiRes() * 0.001 - startTime);
     float dt = t - lastFrameTime; // Time since last frame in seconds
-    float dz = dt * recedeSpeed; // Distance receded since last frame (m)
+    double dz = dt * recedeSpeed; // Distance receded since last frame (m)
 
     globalDistance += dz;
     lastFrameTime = t;
@@ -317,25 +613,160 @@ void GLVisualizer::renderFrame()
     // Rebuild the colourmap if needed
     if (textureNeedsRebuild.load())
         buildTexture();
+
+    // Redraw the 2D trails from scratch if the layout has changed
+    if (trailsNeedReseed.exchange(false))
+    {
+        screenTrail->needsReseed = true;
+        for (auto& target : captureTargets)
+            target->trail.needsReseed = true;
+    }
     
-    // Add the new particles to the VBO
-    vertexBuffer->updateParticles(results, globalDistance, fadeEndZ);
+    // Add the new particles to the ring and upload them to the VBO
+    // Insert about as many particles per frame as the budget allows to
+    // be alive at once, given how long they live
+    const double lifetimeFrames = std::max((double)fadeEndZ, 0.001) / std::max(dz, 1.0e-6);
+    const int budget = particleBudget.load(std::memory_order_relaxed);
+    const int maxNew = juce::jlimit(minParticlesPerFrame, maxParticles,
+                                    (int)(2.0 * budget / std::max(lifetimeFrames, 1.0)));
+
+    // Add the new particles to the ring and upload them to the VBO
+    vertexBuffer->updateParticles(results, globalDistance, fadeEndZ, budget, maxNew);
+    vertexBuffer->upload();
+
+    gpuTimer->begin();
 
     glActiveTexture(GL_TEXTURE0);
     colourMapTexture.bind();
 
     renderToScreen();
 
+    // Capture can wait on readback fences and full queues, which says
+    // nothing about what the display can afford, so it is timed apart
+    const auto captureStartTicks = juce::Time::getHighResolutionTicks();
+
+    if (captureDraining.load())
+    {
+        // Recording has stopped, so hand over the frames still in flight
+        for (auto& target : captureTargets)
+            target->counters->numDropped.fetch_add(target->readback.finishAll(*target->frameQueue));
+
+        releaseCapture();
+
+        // Only now may the next recording reuse the queues and settings
+        captureDraining.store(false);
+        captureDrained.signal();
+    }
+
     if (recording)
-        renderToCapture(); 
+        captureDueFrames(); 
+
+    const auto captureTicks = juce::Time::getHighResolutionTicks() - captureStartTicks;
 
     colourMapTexture.unbind();
 
+    gpuTimer->end();
+
+    // Keep the timer rendering until every particle has faded out
+    hasLiveParticles.store(vertexBuffer->numSlabs > 0);
+    numLiveParticles.store(vertexBuffer->numActiveVertices, std::memory_order_relaxed);
+
+    const double renderSeconds = juce::Time::highResolutionTicksToSeconds(
+                                     juce::Time::getHighResolutionTicks() - startTicks);
+    recordFrameTime(dt, renderSeconds);
+    const double gpuMs = gpuTimer->getLastMs();
+    gpuFrameMs.store(gpuMs, std::memory_order_relaxed);
+    const double captureSeconds = juce::Time::highResolutionTicksToSeconds(captureTicks);
+    updateParticleBudget((renderSeconds - captureSeconds) * 1000.0, gpuMs);
+
     ++frameCount;
     // if (frameCount % 60 == 0)
     //     printFrameInfo();
 }
 
+void GLVisualizer::recordFrameTime(double intervalSeconds, double renderSeconds)
+{
+    const double intervalMs = intervalSeconds * 1000.0;
+    const auto& edges = FrameStats::bucketEdgesMs;
+    const auto bucket = (size_t)(std::upper_bound(edges.begin(), edges.end(), intervalMs) - edges.begin());
+
+    frameIntervalBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    numFramesRendered.fetch_add(1, std::memory_order_relaxed);
+
+    // Single writer, so plain load/store is enough here
+    totalRenderMs.store(totalRenderMs.load(std::memory_order_relaxed) + renderSeconds * 1000.0,
+                        std::memory_order_relaxed);
+}
+
+/*  A simple controller: if the frame cost (the larger of the CPU and GPU
+    times) stays near the frame period, cut the budget quickly; if it
+    stays well under, let it grow back slowly.
+*/
+void GLVisualizer::updateParticleBudget(double cpuMs, double gpuMs)
+{
+    const double costMs = std::max(cpuMs, gpuMs);
+    const double targetMs = 1000.0 / frameRateCap.load(std::memory_order_relaxed);
+    int budget = particleBudget.load(std::memory_order_relaxed);
+
+    if (costMs > 0.9 * targetMs)
+    {
+        underBudgetFrames = 0;
+        if (++overBudgetFrames >= 3)
+        {
+            budget = std::max(minParticleBudget, (int)(budget * 0.8));
+            overBudgetFrames = 0;
+        }
+    }
+    else if (costMs < 0.5 * targetMs)
+    {
+        overBudgetFrames = 0;
+        if (++underBudgetFrames >= 30)
+        {
+            budget = std::min(maxParticles, (int)(budget * 1.1) + 1);
+            underBudgetFrames = 0;
+        }
+    }
+    else
+    {
+        overBudgetFrames = 0;
+        underBudgetFrames = 0;
+    }
+
+    particleBudget.store(budget, std::memory_order_relaxed);
+}
+
+//=============================================================================
+void GLVisualizer::hiResTimerCallback()
+{
+    const bool needsRender = recording.load()
+                          || captureDraining.load() // Frames still to hand over
+                          || hasLiveParticles.load()
+                          || trailsNeedReseed.load() // A display setting has changed
+                          || textureNeedsRebuild.load();
+
+    // Check for new results even if rendering anyway, to stay up to date
+    if (hasNewResults() || needsRender)
+        openGLContext.triggerRepaint();
+    else
+        numIdleTicks.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool GLVisualizer::hasNewResults()
+{
+    if (results == nullptr)
+        return false;
+
+    bool anyNew = false;
+    for (size_t i = 0; i < results->size(); ++i)
+    {
+        const auto generation = (*results)[i].generation.load(std::memory_order_relaxed);
+        anyNew = anyNew || generation != lastSeenGenerations[i];
+        lastSeenGenerations[i] = generation;
+    }
+
+    return anyNew;
+}
+
 void GLVisualizer::renderToScreen()
 {
     using namespace juce::gl;
@@ -350,36 +781,276 @@ void GLVisualizer::renderToScreen()
     // Update dynamic uniforms
     updateUniforms();
 
+    if (dimension == twoD && decayShader != nullptr)
+    {
+        renderTrails(*screenTrail, (int)(getWidth() * scale), (int)(getHeight() * scale), 0,
+                     globalDistance, 0);
+        return;
+    }
+
     // Clear and draw
     juce::OpenGLHelpers::clear(juce::Colours::black);
     vertexBuffer->draw(*attributes);
 }
 
-void GLVisualizer::renderToCapture()
+/*  Capture frames are timed by the audio written to the recording, not
+    by the display: frame n is due once n / fps seconds of audio have
+    been recorded, so the video stays locked to the audio whatever the
+    display rate. Each capture frame moves the scene on by a fixed step
+    (recedeSpeed / fps), clamped so it never gets ahead of the display.
+    If too many frames are due at once, the last one rendered is read 
+    back again instead, so the frame count still matches the audio.
+
+    Each target keeps its own frame count at its own rate, but they all
+    draw the particles uploaded for this frame, so the videos show the
+    same performance.
+*/
+void GLVisualizer::captureDueFrames()
+{
+    if (captureClock == nullptr)
+        return;
+
+    createCaptureTargets();
+
+    for (auto& target : captureTargets)
+        captureDueFrames(*target);
+}
+
+void GLVisualizer::captureDueFrames(CaptureTarget& target)
+{
+    const double fps = (double)target.settings.fps;
+    const auto framesDue = (juce::int64)std::floor(captureClock->getSeconds() * fps) + 1
+                           - target.frameIndex;
+
+    // Every frame but the last was already overdue
+    if (framesDue > 1)
+        target.counters->numLate.fetch_add((juce::uint64)(framesDue - 1), std::memory_order_relaxed);
+
+    for (juce::int64 i = 0; i < framesDue; ++i)
+    {
+        if (target.frameIndex == 0)
+            target.distance = globalDistance;
+        else
+            target.distance = std::min(target.distance + recedeSpeed / fps, globalDistance);
+
+        if (i < maxCaptureRendersPerFrame)
+        {
+            renderToCapture(target, target.distance, target.frameIndex);
+            target.counters->numRendered.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            using namespace juce::gl;
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, target.getReadFrameBuffer());
+            if (!target.readback.read(*target.frameQueue, target.frameIndex))
+                target.counters->numDropped.fetch_add(1, std::memory_order_relaxed);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            target.counters->numDuplicated.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ++target.frameIndex;
+    }
+}
+
+void GLVisualizer::createCaptureTargets()
+{
+    if (!captureTargets.empty())
+        return;
+
+    const auto numTargets = std::min(captureSettings.size(), frameQueues.size());
+
+    for (size_t i = 0; i < numTargets; ++i)
+    {
+        if (frameQueues[i] == nullptr)
+        {
+            jassertfalse; // Set with setFrameQueuePointer()
+            break;
+        }
+
+        auto target = std::make_unique<CaptureTarget>();
+        target->settings = captureSettings[i];
+        target->frameQueue = frameQueues[i];
+        target->counters = &(*captureCounters)[i];
+        captureTargets.push_back(std::move(target));
+    }
+}
+
+void GLVisualizer::renderToCapture(CaptureTarget& target, double distance, juce::int64 frameIndex)
 {
     using namespace juce::gl;
 
+    const int width = target.settings.width;
+    const int height = target.settings.height;
+    prepareCapture(target);
+
     // Bind the capture FBO
-    captureFBO.makeCurrentAndClear();
-    glViewport(0, 0, Constants::W, Constants::H);
+    target.frameBuffer.makeCurrentAndClear();
+    glViewport(0, 0, width, height);
 
     // Set the uniforms that should be different from the main render
-    uniforms->projectionMatrix->setMatrix4(captureProj.mat, 1, false);
-    uniforms->windowSize->set((float)Constants::W, (float)Constants::H);
+    target.projection = buildProjectionMatrix((float)width, (float)height);
+    target.projection.mat[5] *= -1.0f; // Becuase OpenGL has bottom-up row order
+    uniforms->projectionMatrix->setMatrix4(target.projection.mat, 1, false);
+    uniforms->windowSize->set((float)width, (float)height);
+    const int ageOffset = setDistanceUniforms(distance);
 
     // Render to the capture VBO
-    vertexBuffer->draw(*attributes);
+    if (dimension == twoD && decayShader != nullptr)
+        renderTrails(target.trail, width, height, target.frameBuffer.getFrameBufferID(), 
+                     distance, ageOffset);
+    else
+        vertexBuffer->draw(*attributes);
 
-    // Read pixels from the FBO to CPU memory
-    glReadPixels(0, 0, Constants::W, Constants::H, GL_RGB, GL_UNSIGNED_BYTE, capturePixels.data());
+    if (target.settings.pixelFormat == CaptureSettings::yuv420p)
+        convertCaptureToYuv(target);
 
-    // Enqueue the frame for the video writer
-    frameQueue->enqueueVideoFrame(capturePixels.data(), (int)capturePixels.size());
+    // Start reading the frame back, and enqueue the one from two frames ago
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.getReadFrameBuffer());
+    if (!target.readback.read(*target.frameQueue, frameIndex))
+        target.counters->numDropped.fetch_add(1, std::memory_order_relaxed);
 
     // Unbind the capture VBO
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 }
 
+void GLVisualizer::prepareCapture(CaptureTarget& target)
+{
+    using namespace juce::gl;
+
+    const auto& settings = target.settings;
+    const int width = settings.width;
+    const int height = settings.height;
+    auto& fbo = target.frameBuffer;
+
+    if (fbo.isValid() && fbo.getWidth() == width && fbo.getHeight() == height)
+        return;
+
+    fbo.initialise(openGLContext, width, height);
+    target.readback.prepare(settings);
+
+    if (settings.pixelFormat != CaptureSettings::yuv420p)
+        return;
+
+    jassert(width % 2 == 0 && height % 2 == 0);
+    jassert(yuvShader != nullptr); // Frames will be dropped
+
+    if (target.yuvTextureID != 0)
+        glDeleteTextures(1, &target.yuvTextureID);
+    if (target.yuvFrameBufferID != 0)
+        glDeleteFramebuffers(1, &target.yuvFrameBufferID);
+
+    glGenTextures(1, &target.yuvTextureID);
+    glBindTexture(GL_TEXTURE_2D, target.yuvTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height * 3 / 2, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &target.yuvFrameBufferID);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.yuvFrameBufferID);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.yuvTextureID, 0);
+    jassert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GLVisualizer::releaseCapture()
+{
+    // Each target frees its own buffers
+    captureTargets.clear();
+}
+
+void GLVisualizer::convertCaptureToYuv(CaptureTarget& target)
+{
+    using namespace juce::gl;
+
+    if (yuvShader == nullptr || target.yuvFrameBufferID == 0)
+        return;
+
+    const int width = target.settings.width;
+    const int height = target.settings.height;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target.yuvFrameBufferID);
+    glViewport(0, 0, width, height * 3 / 2);
+
+    // The colour map stays on unit 0 for the particle shader
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, target.frameBuffer.getTextureID());
+
+    glDisable(GL_BLEND); // Every byte is written, not mixed
+    yuvShader->use();
+    yuvSource->set(1);
+    yuvSize->set((float)width, (float)height);
+
+    glBindVertexArray(decayVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    mainShader->use();
+}
+
+void GLVisualizer::renderTrails(TrailBuffer& trail, int width, int height, GLuint targetFBO,
+                                double distance, int ageOffset)
+{
+    using namespace juce::gl;
+
+    if (trail.prepare(width, height))
+        trail.needsReseed = true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, trail.frameBufferID);
+    glViewport(0, 0, width, height);
+
+    if (trail.needsReseed)
+    {
+        // Start again from every live particle
+        juce::OpenGLHelpers::clear(juce::Colours::black);
+        vertexBuffer->draw(*attributes);
+        trail.needsReseed = false;
+    }
+    else
+    {
+        /*  Fade what is already there: dst * k - e. The multiply halves
+            the trail every half fade distance and the subtraction makes
+            sure it reaches zero by the fade distance, approximating the 
+            linear fade the particles would have had. */
+        const float fraction = (float)std::max(distance - trail.lastDistance, 0.0) 
+                               / std::max(fadeEndZ, 0.001f);
+        const float k = std::exp2(-2.0f * fraction);
+        const float e = 0.25f * fraction;
+
+        decayShader->use();
+        decaySubtract->set(e);
+
+        glEnable(GL_BLEND);
+        glBlendEquation(GL_FUNC_REVERSE_SUBTRACT);
+        glBlendFunc(GL_ONE, GL_CONSTANT_COLOR);
+        glBlendColor(k, k, k, k);
+
+        glBindVertexArray(decayVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+
+        glBlendEquation(GL_FUNC_ADD);
+        glDisable(GL_BLEND);
+
+        // Then draw only the particles born since the last render on top
+        mainShader->use();
+        vertexBuffer->drawFrom(*attributes, trail.nextSlab);
+    }
+
+    // Anything born after the render distance was hidden, so draw it next time
+    trail.nextSlab = vertexBuffer->getNumSlabsBornBy(ParticleVertex::quantizeDistance(globalDistance),
+                                                     ageOffset);
+    trail.lastDistance = distance;
+
+    // Copy the trails to the target
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, trail.frameBufferID);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFBO);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+}
+
 juce::Colour GLVisualizer::getColourForSchemeAndAmp(ColourScheme colourScheme, float amp)
 {
     float hue;
@@ -512,6 +1183,118 @@ void GLVisualizer::printFrameInfo()
 }
 
 
+//=============================================================================
+uint16_t GLVisualizer::ParticleVertex::quantizeDistance(double distance)
+{
+    return (uint16_t)((juce::int64)std::floor(distance / birthQuantum) & 0xFFFF);
+}
+
+bool GLVisualizer::ParticleVertex::isDisplayable(const FrequencyBand& band)
+{
+    return std::isfinite(band.panIndex) && std::isfinite(band.amplitude)
+        && band.frequency > 0.0f;
+}
+
+bool GLVisualizer::ParticleVertex::pack(const FrequencyBand& band, uint16_t birth, 
+                                        ParticleVertex& out)
+{
+    if (!isDisplayable(band))
+        return false;
+
+    const float logFrequency = juce::jlimit(0.0f, maxLog2Frequency, std::log2(band.frequency));
+    const float amplitude = juce::jlimit(0.0f, 1.0f, band.amplitude);
+    const float pan = juce::jlimit(-1.0f, 1.0f, band.panIndex);
+
+    out.frequency = (uint16_t)juce::roundToInt(logFrequency / maxLog2Frequency * 65535.0f);
+    out.amplitude = (uint8_t)juce::roundToInt(amplitude * 255.0f);
+    out.panIndex = (int8_t)juce::roundToInt(pan * 127.0f);
+    out.birthDistance = birth;
+    out.trackIndex = (uint16_t)(band.trackIndex & 0xF);
+    return true;
+}
+
+bool GLVisualizer::checkVertexPacking()
+{
+    return ParticleVertex::checkPacking();
+}
+
+bool GLVisualizer::ParticleVertex::checkPacking()
+{
+    static_assert(Constants::maxTracks <= 16, "Track index is packed in 4 bits");
+
+    int numFailed = 0;
+    auto check = [&numFailed](bool ok, const juce::String& what)
+    {
+        if (!ok && ++numFailed <= 10)
+            juce::Logger::writeToLog("Vertex packing: " + what + " doesn't round trip");
+    };
+
+    // Attributes, decoded as in the vertex shader
+    const FrequencyBand bands[] = { { 20.0f, 0.0f, -1.0f, 0 },
+                                    { 440.0f, 0.5f, 0.0f, 3 },
+                                    { 1234.5f, 0.123f, 0.37f, 5 },
+                                    { 20000.0f, 1.0f, 1.0f, Constants::maxTracks - 1 } };
+
+    for (const auto& band : bands)
+    {
+        ParticleVertex v;
+        if (!pack(band, 0, v))
+        {
+            check(false, juce::String(band.frequency) + " Hz");
+            continue;
+        }
+
+        const float logFrequency = (float)v.frequency * (maxLog2Frequency / 65535.0f);
+        const float amp = (float)v.amplitude / 255.0f;
+        const float pan = (float)v.panIndex / 127.0f;
+
+        check(std::abs(logFrequency - std::log2(band.frequency)) <= 0.5f * maxLog2Frequency / 65535.0f + 1.0e-5f,
+              "frequency " + juce::String(band.frequency));
+        check(std::abs(amp - band.amplitude) <= 0.5f / 255.0f + 1.0e-6f, 
+              "amplitude " + juce::String(band.amplitude));
+        check(std::abs(pan - band.panIndex) <= 0.5f / 127.0f + 1.0e-6f, 
+              "pan " + juce::String(band.panIndex));
+        check((int)(v.trackIndex & 15u) == band.trackIndex, 
+              "track " + juce::String(band.trackIndex));
+    }
+
+    // Ages, decoded as in the vertex shader and setDistanceUniforms(),
+    // for a render distance up to a second behind the current one and
+    // births either side of where the field wraps
+    for (const double wrap : { 1.0, 2.0, 1000.0 })
+    {
+        for (const double born : { wrap * maxBirthAge - 0.01, wrap * maxBirthAge + 0.01 })
+        {
+            for (const double age : { 0.0, 0.5, (double)maxFadeEndZ, 2.0 * maxFadeEndZ - 0.01 })
+            {
+                for (const double lag : { 0.0, 0.25, 1.0 })
+                {
+                    const double current = born + age + lag;
+                    const double render = born + age;
+
+                    const double baseSteps = std::floor(current / birthQuantum);
+                    const double steps = render / birthQuantum;
+                    const double wholeSteps = std::floor(steps);
+                    const int ageOffset = std::max(0, (int)(baseSteps - wholeSteps));
+                    const int base = (int)((juce::int64)baseSteps & 0xFFFF);
+
+                    const int decodedSteps = ((base - (int)quantizeDistance(born)) & 0xFFFF) - ageOffset;
+                    const double decoded = (decodedSteps + (steps - wholeSteps)) * birthQuantum;
+
+                    check(std::abs(decoded - age) <= birthQuantum + 1.0e-9,
+                          "age " + juce::String(age) + " m born at " + juce::String(born) 
+                          + " m, " + juce::String(lag) + " m behind");
+                }
+            }
+        }
+    }
+
+    juce::Logger::writeToLog(numFailed == 0 ? juce::String("Vertex packing: all values round trip")
+                                            : "Vertex packing: " + juce::String(numFailed) + " values failed");
+    return numFailed == 0;
+}
+
+
 //=============================================================================
 GLVisualizer::VertexBuffer::VertexBuffer()
 {
@@ -519,6 +1302,13 @@ GLVisualizer::VertexBuffer::VertexBuffer()
 
     glGenVertexArrays(1, &vaoID);
     glGenBuffers(1, &vboID);
+
+    // Allocate the VBO once; after this it is only updated in place
+    glBindBuffer(GL_ARRAY_BUFFER, vboID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(ParticleVertex) * maxParticles, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    candidates.reserve(maxParticles);
 }
 
 GLVisualizer::VertexBuffer::~VertexBuffer()
@@ -532,72 +1322,269 @@ GLVisualizer::VertexBuffer::~VertexBuffer()
 //=============================================================================
 void GLVisualizer::VertexBuffer::updateParticles(
             std::array<TrackSlot, Constants::maxTracks>* results, 
-            float globalDistance, 
-            float fadeEndZ)
+            double globalDistance, 
+            float fadeEndZ,
+            int maxLive,
+            int maxNew)
 {
-    // Remove particles that have faded out
-    while (numActiveVertices > 0)
+    const uint16_t birth = ParticleVertex::quantizeDistance(globalDistance);
+
+    // Ages are only known modulo maxBirthAge, so if we have moved so far
+    // since the last update that live particles could wrap, drop them all
+    if (globalDistance - lastUpdateDistance + fadeEndZ >= ParticleVertex::maxBirthAge)
     {
-        ParticleVertex& oldestParticle = particles[oldestIndex];
-        float distanceTravelled = (globalDistance - oldestParticle.birthDistance);
+        while (numSlabs > 0)
+            popOldestSlab();
+    }
+    lastUpdateDistance = globalDistance;
 
-        if (distanceTravelled < fadeEndZ)
-            break; // Oldest particle is still alive
+    // Remove slabs that have faded out
+    const auto fadeEndSteps = (int)std::ceil(fadeEndZ / ParticleVertex::birthQuantum);
+
+    while (numSlabs > 0)
+    {
+        int stepsTravelled = (uint16_t)(birth - getSlab(0).birth);
+
+        if (stepsTravelled < fadeEndSteps)
+            break; // Oldest slab is still alive
         
         // Otherwise, discard it
-        oldestIndex = (oldestIndex + 1) % maxParticles;
-        --numActiveVertices;
+        popOldestSlab();
     }
 
-    // Add new particles from the latest analysis results
-    for (int i = 0; i < results->size(); ++i)
+    // Only take results published since the last update, and count the
+    // new bands so they can be stored as one contiguous slab
+    std::array<const std::vector<FrequencyBand>*, Constants::maxTracks> newResults {};
+    int numNewBands = 0;
+
+    for (size_t i = 0; i < results->size(); ++i)
     {
         const auto& slot = (*results)[i];
-        int activeIndex = slot.activeIndex.load(std::memory_order_acquire);
-        const auto& result = slot.buffers[activeIndex];
+        const auto generation = slot.generation.load(std::memory_order_acquire);
+        if (generation == lastGenerations[i])
+            continue;
 
-        if (result.empty()) continue;
+        lastGenerations[i] = generation;
+        newResults[i] = &slot.buffers[(size_t)slot.activeIndex.load(std::memory_order_acquire)];
+        numNewBands += (int)newResults[i]->size();
+    }
 
-        for (const FrequencyBand& band : result)
+    // Over the insertion limit, keep only the loudest bands
+    const bool isLimited = numNewBands > maxNew;
+    if (isLimited)
+    {
+        // A NaN amplitude would break the ordering nth_element needs,
+        // so bands that can't be shown are left out here
+        candidates.clear();
+        for (const auto* bands : newResults)
+            if (bands != nullptr)
+                for (const FrequencyBand& band : *bands)
+                    if (ParticleVertex::isDisplayable(band))
+                        candidates.push_back(&band);
+
+        if ((int)candidates.size() > maxNew)
         {
-            int index = (oldestIndex + numActiveVertices) % maxParticles;
-            ParticleVertex& newParticle = particles[index];
-            newParticle.frequency = band.frequency;
-            newParticle.amplitude = band.amplitude;
-            newParticle.panIndex = band.panIndex;
-            newParticle.birthDistance = globalDistance;
-            newParticle.trackIndex = band.trackIndex;
-
-            ++numActiveVertices;
-        }
+            std::nth_element(candidates.begin(), candidates.begin() + maxNew, candidates.end(),
+                             [](const FrequencyBand* a, const FrequencyBand* b)
+                             {
+                                 return a->amplitude > b->amplitude;
+                             });
 
-        if (numActiveVertices > maxParticles)
-        {
-            // We have overwritten some vertices
-            int difference = numActiveVertices - maxParticles;
-            oldestIndex = (oldestIndex + difference) % maxParticles;
-            numActiveVertices = maxParticles;
+            candidates.resize((size_t)maxNew);
         }
+
+        numNewBands = (int)candidates.size();
+    }
+
+    numNewBands = std::min(numNewBands, maxParticles);
+    if (numNewBands == 0)
+        return;
+
+    // Stay within the live particle limit by expiring the oldest slabs early
+    while (numSlabs > 0 && numActiveVertices + numNewBands > maxLive)
+        popOldestSlab();
+
+    Slab slab { allocate(numNewBands), 0, birth };
+    ParticleVertex* dest = particles.data() + slab.start;
+
+    auto add = [&](const FrequencyBand& band)
+    {
+        if (slab.count < numNewBands && ParticleVertex::pack(band, birth, dest[slab.count]))
+            ++slab.count;
+    };
+
+    // Add new particles from the latest analysis results
+    if (isLimited)
+    {
+        for (const auto* band : candidates)
+            add(*band);
+    }
+    else
+    {
+        for (const auto* bands : newResults)
+            if (bands != nullptr)
+                for (const FrequencyBand& band : *bands)
+                    add(band);
+    }
+
+    if (slab.count > 0)
+        pushSlab(slab);
+}
+
+int GLVisualizer::VertexBuffer::allocate(int count)
+{
+    jassert(count <= maxParticles);
+
+    int start = writePosition;
+
+    if (start + count > maxParticles)
+    {
+        // Doesn't fit before the end; wrap around, and drop the slabs 
+        // left in the tail since the new data skips over them
+        while (numSlabs > 0 && getSlab(0).start >= writePosition)
+            popOldestSlab();
+
+        ringEnd = writePosition;
+        start = 0;
+    }
+
+    // Drop the oldest slabs that the new one would overwrite
+    while (numSlabs > 0)
+    {
+        const auto& oldest = getSlab(0);
+        if (oldest.start >= start + count || oldest.start + oldest.count <= start)
+            break;
+
+        popOldestSlab();
+    }
+
+    return start;
+}
+
+void GLVisualizer::VertexBuffer::pushSlab(const Slab& slab)
+{
+    if (numSlabs == maxSlabs)
+        popOldestSlab();
+
+    slabs[(size_t)((oldestSlab + numSlabs) % maxSlabs)] = slab;
+    ++numSlabs;
+    ++numSlabsPushed;
+
+    writePosition = slab.start + slab.count;
+    numActiveVertices += slab.count;
+    numPendingSlabs = std::min(numPendingSlabs + 1, numSlabs);
+}
+
+void GLVisualizer::VertexBuffer::popOldestSlab()
+{
+    jassert(numSlabs > 0);
+
+    numActiveVertices -= slabs[(size_t)oldestSlab].count;
+    oldestSlab = (oldestSlab + 1) % maxSlabs;
+    --numSlabs;
+    numPendingSlabs = std::min(numPendingSlabs, numSlabs);
+}
+
+const GLVisualizer::VertexBuffer::Slab& GLVisualizer::VertexBuffer::getSlab(int age) const
+{
+    return slabs[(size_t)((oldestSlab + age) % maxSlabs)];
+}
+
+juce::uint64 GLVisualizer::VertexBuffer::getNumSlabsBornBy(uint16_t base, int ageOffset) const
+{
+    // Births only increase, so walk back from the newest slab
+    int count = numSlabs;
+    while (count > 0 && (int)(uint16_t)(base - getSlab(count - 1).birth) < ageOffset)
+        --count;
+
+    return numSlabsPushed - (juce::uint64)(numSlabs - count);
+}
+
+int GLVisualizer::VertexBuffer::getDrawRanges(std::array<std::pair<int, int>, 2>& ranges) const
+{
+    if (numSlabs == 0)
+        return 0;
+
+    const int first = getSlab(0).start;
+
+    if (first < writePosition)
+    {
+        ranges[0] = { first, writePosition - first };
+        return 1;
     }
+
+    // The live slabs wrap around the end of the ring
+    ranges[0] = { first, ringEnd - first };
+    ranges[1] = { 0, writePosition };
+    return 2;
+}
+
+void GLVisualizer::VertexBuffer::upload()
+{
+    using namespace juce::gl;
+
+    if (numPendingSlabs == 0)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, vboID);
+
+    // Each slab is contiguous, so it is a single upload
+    for (int i = numSlabs - numPendingSlabs; i < numSlabs; ++i)
+    {
+        const auto& slab = getSlab(i);
+        glBufferSubData(GL_ARRAY_BUFFER, 
+                        (GLintptr)(sizeof(ParticleVertex) * (size_t)slab.start),
+                        (GLsizeiptr)(sizeof(ParticleVertex) * (size_t)slab.count),
+                        particles.data() + slab.start);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    numPendingSlabs = 0;
 }
 
 void GLVisualizer::VertexBuffer::draw(Attributes& glAttributes)
 {
     using namespace juce::gl;
 
+    std::array<std::pair<int, int>, 2> ranges;
+    const int numRanges = getDrawRanges(ranges);
+    if (numRanges == 0)
+        return;
+
     // Bind vao and vbo and enable the attributes
     glBindVertexArray(vaoID);
     glBindBuffer(GL_ARRAY_BUFFER, vboID);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(ParticleVertex) * maxParticles, nullptr, GL_DYNAMIC_DRAW);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(ParticleVertex) * maxParticles, particles.data(), GL_DYNAMIC_DRAW);
     
     glAttributes.enable();
 
-    // Draw the particles from the oldest to the end of the buffer
-    glDrawArrays(GL_POINTS, oldestIndex, std::min(numActiveVertices, maxParticles - oldestIndex));
+    // Draw from the oldest slab to the newest, in two parts if the ring
+    // has wrapped around
+    for (int i = 0; i < numRanges; ++i)
+        glDrawArrays(GL_POINTS, ranges[(size_t)i].first, ranges[(size_t)i].second);
+
+    glAttributes.disable();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void GLVisualizer::VertexBuffer::drawFrom(Attributes& glAttributes, juce::uint64 firstSlab)
+{
+    using namespace juce::gl;
+
+    const auto oldestNumber = numSlabsPushed - (juce::uint64)numSlabs;
+    if (firstSlab >= numSlabsPushed)
+        return;
 
-    // If the buffer has wrapped around, draw the remaining particles 
-    glDrawArrays(GL_POINTS, 0, std::max(0, numActiveVertices - (maxParticles - oldestIndex)));
+    glBindVertexArray(vaoID);
+    glBindBuffer(GL_ARRAY_BUFFER, vboID);
+    glAttributes.enable();
+
+    // Slabs that have already expired are skipped
+    for (auto i = std::max(firstSlab, oldestNumber); i < numSlabsPushed; ++i)
+    {
+        const auto& slab = getSlab((int)(i - oldestNumber));
+        glDrawArrays(GL_POINTS, slab.start, slab.count);
+    }
 
     glAttributes.disable();
     glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -605,6 +1592,239 @@ void GLVisualizer::VertexBuffer::draw(Attributes& glAttributes)
 }
 
 
+//=============================================================================
+GLVisualizer::TrailBuffer::~TrailBuffer()
+{
+    release();
+}
+
+bool GLVisualizer::TrailBuffer::prepare(int newWidth, int newHeight)
+{
+    using namespace juce::gl;
+
+    if (frameBufferID != 0 && newWidth == width && newHeight == height)
+        return false;
+
+    release();
+    width = newWidth;
+    height = newHeight;
+
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &frameBufferID);
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBufferID);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureID, 0);
+    jassert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return true;
+}
+
+void GLVisualizer::TrailBuffer::release()
+{
+    using namespace juce::gl;
+
+    if (frameBufferID != 0)
+        glDeleteFramebuffers(1, &frameBufferID);
+    if (textureID != 0)
+        glDeleteTextures(1, &textureID);
+
+    frameBufferID = 0;
+    textureID = 0;
+}
+
+
+//=============================================================================
+GLVisualizer::CaptureReadback::~CaptureReadback()
+{
+    release();
+}
+
+void GLVisualizer::CaptureReadback::prepare(const CaptureSettings& settings)
+{
+    using namespace juce::gl;
+
+    release();
+    width = settings.width;
+
+    if (settings.pixelFormat == CaptureSettings::yuv420p)
+    {
+        height = settings.height * 3 / 2; // All three planes, one byte per texel
+        format = GL_RED;
+    }
+    else
+    {
+        height = settings.height;
+        format = GL_RGB;
+    }
+
+    numBytes = settings.getFrameBytes();
+    blockTimeoutMs = settings.gapPolicy == CaptureSettings::blockWithTimeout ? settings.blockTimeoutMs : 0;
+    jassert(numBytes == width * height * (format == GL_RGB ? 3 : 1));
+
+    glGenBuffers(numBuffers, bufferIDs.data());
+    for (auto id : bufferIDs)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, id);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)numBytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void GLVisualizer::CaptureReadback::release()
+{
+    using namespace juce::gl;
+
+    for (auto& fence : fences)
+    {
+        if (fence != nullptr)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    if (bufferIDs[0] != 0)
+        glDeleteBuffers(numBuffers, bufferIDs.data());
+
+    bufferIDs.fill(0);
+    oldest = 0;
+    numInFlight = 0;
+}
+
+bool GLVisualizer::CaptureReadback::read(FrameQueue& queue, juce::int64 frameIndex)
+{
+    using namespace juce::gl;
+
+    jassert(numInFlight < numBuffers);
+    const int index = (oldest + numInFlight) % numBuffers;
+
+    // Rows of RGB or YUV pixels aren't necessarily 4-byte aligned
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    // With a pack buffer bound this only queues the copy
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, bufferIDs[(size_t)index]);
+    glReadPixels(0, 0, width, height, format, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    fences[(size_t)index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frameIndices[(size_t)index] = frameIndex;
+    ++numInFlight;
+
+    if (numInFlight == numBuffers)
+        return finishOldest(queue);
+
+    return true;
+}
+
+bool GLVisualizer::CaptureReadback::finishOldest(FrameQueue& queue)
+{
+    using namespace juce::gl;
+
+    if (numInFlight == 0)
+        return true;
+
+    bool queued = false;
+
+    auto& fence = fences[(size_t)oldest];
+    const GLuint64 timeoutNs = 1000000000; // 1 s
+    const auto status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNs);
+    glDeleteSync(fence);
+    fence = nullptr;
+
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+    {
+        // Copy the mapped pixels straight into the queue's storage
+        auto* slot = queue.acquireWriteSlot();
+
+        if (slot == nullptr && blockTimeoutMs > 0)
+        {
+            // Wait for the writer to make room, as the gap policy asks
+            const auto endMs = juce::Time::getMillisecondCounter() + (juce::uint32)blockTimeoutMs;
+            while (slot == nullptr && juce::Time::getMillisecondCounter() < endMs)
+            {
+                juce::Thread::sleep(1);
+                slot = queue.acquireWriteSlot();
+            }
+        }
+
+        if (slot != nullptr)
+        {
+            jassert(numBytes == queue.getFrameBytes());
+            void* data = nullptr;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, bufferIDs[(size_t)oldest]);
+            if (numBytes == queue.getFrameBytes())
+                data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, numBytes, GL_MAP_READ_BIT);
+
+            if (data != nullptr)
+            {
+                std::memcpy(slot, data, (size_t)numBytes);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                queue.commitWriteSlot(frameIndices[(size_t)oldest]);
+                queued = true;
+            }
+            else
+            {
+                queue.cancelWriteSlot();
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        else
+        {
+            RT_LOG("Frame queue full, dropping capture frame {}", frameIndices[(size_t)oldest]);
+        }
+    }
+    else
+    {
+        DBG("Capture readback failed, dropping a frame");
+    }
+
+    oldest = (oldest + 1) % numBuffers;
+    --numInFlight;
+    return queued;
+}
+
+int GLVisualizer::CaptureReadback::finishAll(FrameQueue& queue)
+{
+    int numDropped = 0;
+    while (numInFlight > 0)
+        numDropped += finishOldest(queue) ? 0 : 1;
+
+    return numDropped;
+}
+
+
+//=============================================================================
+void GLVisualizer::CaptureTarget::release()
+{
+    using namespace juce::gl;
+
+    frameBuffer.release();
+    readback.release();
+    trail.release();
+
+    if (yuvFrameBufferID != 0)
+        glDeleteFramebuffers(1, &yuvFrameBufferID);
+    if (yuvTextureID != 0)
+        glDeleteTextures(1, &yuvTextureID);
+
+    yuvFrameBufferID = 0;
+    yuvTextureID = 0;
+}
+
+GLuint GLVisualizer::CaptureTarget::getReadFrameBuffer() const
+{
+    if (settings.pixelFormat == CaptureSettings::yuv420p)
+        return yuvFrameBufferID;
+
+    return frameBuffer.getFrameBufferID();
+}
+
+
 //=============================================================================
 GLVisualizer::Attributes::Attributes(OpenGLShaderProgram& shaderProgram)
 {
@@ -619,33 +1839,39 @@ void GLVisualizer::Attributes::enable()
 {
     using namespace ::juce::gl;
 
+    // All the attributes are integers, unpacked by the vertex shader
     if (frequency.get() != nullptr)
     {
-        glVertexAttribPointer(frequency->attributeID, 1, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), nullptr);
+        glVertexAttribIPointer(frequency->attributeID, 1, GL_UNSIGNED_SHORT, sizeof(ParticleVertex), 
+                               (GLvoid*)offsetof(ParticleVertex, frequency));
         glEnableVertexAttribArray(frequency->attributeID);
     }
 
     if (amplitude.get() != nullptr)
     {
-        glVertexAttribPointer(amplitude->attributeID, 1, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (GLvoid*)(sizeof(float)));
+        glVertexAttribIPointer(amplitude->attributeID, 1, GL_UNSIGNED_BYTE, sizeof(ParticleVertex), 
+                               (GLvoid*)offsetof(ParticleVertex, amplitude));
         glEnableVertexAttribArray(amplitude->attributeID);
     }
 
     if (panIndex.get() != nullptr)
     {
-        glVertexAttribPointer(panIndex->attributeID, 1, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (GLvoid*)(sizeof(float) * 2));
+        glVertexAttribIPointer(panIndex->attributeID, 1, GL_BYTE, sizeof(ParticleVertex), 
+                               (GLvoid*)offsetof(ParticleVertex, panIndex));
         glEnableVertexAttribArray(panIndex->attributeID);
     }
 
     if (birthDistance.get() != nullptr)
     {
-        glVertexAttribPointer(birthDistance->attributeID, 1, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (GLvoid*)(sizeof(float) * 3));
+        glVertexAttribIPointer(birthDistance->attributeID, 1, GL_UNSIGNED_SHORT, sizeof(ParticleVertex), 
+                               (GLvoid*)offsetof(ParticleVertex, birthDistance));
         glEnableVertexAttribArray(birthDistance->attributeID);
     }
 
     if (trackIndex.get() != nullptr)
     {
-        glVertexAttribIPointer(trackIndex->attributeID, 1, GL_INT, sizeof(ParticleVertex), (GLvoid*)(sizeof(float) * 4));
+        glVertexAttribIPointer(trackIndex->attributeID, 1, GL_UNSIGNED_SHORT, sizeof(ParticleVertex), 
+                               (GLvoid*)offsetof(ParticleVertex, trackIndex));
         glEnableVertexAttribArray(trackIndex->attributeID);
     }
 }
@@ -691,7 +1917,10 @@ GLVisualizer::Uniforms::Uniforms(OpenGLShaderProgram& shaderProgram)
     windowSize.reset(createUniform(shaderProgram, "uWindowSize"));
     minFrequency.reset(createUniform(shaderProgram, "uMinFrequency"));
     maxFrequency.reset(createUniform(shaderProgram, "uMaxFrequency"));
-    globalDistance.reset(createUniform(shaderProgram, "uGlobalDistance"));
+    birthBase.reset(createUniform(shaderProgram, "uBirthBase"));
+    birthFraction.reset(createUniform(shaderProgram, "uBirthFraction"));
+    birthQuantum.reset(createUniform(shaderProgram, "uBirthQuantum"));
+    ageOffset.reset(createUniform(shaderProgram, "uAgeOffset"));
     fadeEndZ.reset(createUniform(shaderProgram, "uFadeEndZ"));
     dotSize.reset(createUniform(shaderProgram, "uDotSize"));
 }
@@ -705,4 +1934,78 @@ OpenGLShaderProgram::Uniform* GLVisualizer::Uniforms::createUniform(
         return nullptr;
 
     return new OpenGLShaderProgram::Uniform(shader, uniformName);
+}
+
+
+//=============================================================================
+void GLVisualizer::GpuTimer::create()
+{
+    using namespace juce::gl;
+
+    release();
+
+    const auto version = juce::OpenGLHelpers::getOpenGLVersion();
+    isSupported = version.major > 3 || (version.major == 3 && version.minor >= 3)
+               || juce::OpenGLHelpers::isExtensionSupported("GL_ARB_timer_query");
+
+    if (isSupported)
+        glGenQueries(numQueries, queryIDs.data());
+}
+
+void GLVisualizer::GpuTimer::release()
+{
+    using namespace juce::gl;
+
+    if (queryIDs[0] != 0)
+        glDeleteQueries(numQueries, queryIDs.data());
+
+    queryIDs.fill(0);
+    isPending.fill(false);
+    nextQuery = 0;
+    isTiming = false;
+    lastMs = -1.0;
+}
+
+void GLVisualizer::GpuTimer::begin()
+{
+    using namespace juce::gl;
+
+    if (!isSupported)
+        return;
+
+    // Collect any results that have come in, oldest first
+    for (int i = 0; i < numQueries; ++i)
+    {
+        const int index = (nextQuery + i) % numQueries;
+        if (!isPending[(size_t)index])
+            continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(queryIDs[(size_t)index], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == 0)
+            break;
+
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(queryIDs[(size_t)index], GL_QUERY_RESULT, &elapsedNs);
+        lastMs = (double)elapsedNs * 1.0e-6;
+        isPending[(size_t)index] = false;
+    }
+
+    // Skip this frame rather than wait if the GPU is that far behind
+    isTiming = !isPending[(size_t)nextQuery];
+    if (isTiming)
+        glBeginQuery(GL_TIME_ELAPSED, queryIDs[(size_t)nextQuery]);
+}
+
+void GLVisualizer::GpuTimer::end()
+{
+    using namespace juce::gl;
+
+    if (!isTiming)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    isPending[(size_t)nextQuery] = true;
+    nextQuery = (nextQuery + 1) % numQueries;
+    isTiming = false;
 }
\ No newline at end of file
@@ -22,15 +22,23 @@
 #pragma once
 #include <JuceHeader.h>
 #include "GridComponent.h"
+#include "StatsOverlay.h"
 #include "Utils.h"
 #include "FrameQueue.h"
+#include "RTLogger.h"
 
 
 //=============================================================================
 /*  The component that handles rendering the main MoPanning visulization.
+
+    Frames are rendered on demand rather than continuously: a timer
+    running at the frame rate cap triggers a repaint only if there are
+    new analysis results, particles still on screen, a recording in
+    progress or a change to the display. Otherwise nothing is rendered.
 */
 class GLVisualizer : public juce::OpenGLRenderer,
-                     public juce::Component
+                     public juce::Component,
+                     private juce::HighResolutionTimer
 {
 public:
     //=========================================================================
@@ -62,9 +70,14 @@ public:
     */
     void setResultsPointer(std::array<TrackSlot, Constants::maxTracks>* resultsPtr);
 
-    /*  Sets the pointer to the shared queue for video writing output.
+    /*  Sets the pointer to the shared queue for video writing output
+        from the given capture target (see startRecording()).
+    */
+    void setFrameQueuePointer(FrameQueue* frameQueuePtr, int targetIndex = 0);
+
+    /*  Sets the pointer to the clock that times capture frames.
     */
-    void setFrameQueuePointer(FrameQueue* frameQueuePtr);
+    void setCaptureClockPointer(const CaptureClock* clockPtr);
 
     /*  Sets the dimension of the visualization (2D or 3D).
     */
@@ -78,6 +91,60 @@ public:
     */
     void setShowGrid(bool shouldShow);
 
+    /*  Sets the performance stats overlay as visible or not.
+    */
+    void setShowStats(bool shouldShow);
+
+    /*  Returns true if the performance stats overlay is visible.
+    */
+    bool isShowingStats() const;
+
+    /*  Sets the function that supplies the text for the stats overlay.
+    */
+    void setStatsSource(std::function<juce::String()> source);
+
+    /*  Sets the maximum number of frames rendered per second.
+    */
+    void setFrameRateCap(int framesPerSecond);
+
+    /*  Render timing since the component was created. The histogram is
+        of the time between rendered frames, so long gaps while idle
+        land in the last bucket.
+    */
+    struct FrameStats
+    {
+        static constexpr int numBuckets = 8;
+        static constexpr std::array<double, numBuckets - 1> bucketEdgesMs
+            { 8.0, 12.0, 17.0, 25.0, 34.0, 50.0, 100.0 };
+
+        std::array<juce::uint64, numBuckets> buckets {};
+        juce::uint64 numFrames = 0;
+        juce::uint64 numIdleTicks = 0; // Frame slots skipped with nothing to draw
+        double totalRenderMs = 0.0; // CPU time spent in renderFrame()
+        double gpuMs = -1.0; // GPU time of a recent frame, or -1 if unknown
+        int particleBudget = 0; // Current limit on live particles
+        int numLiveParticles = 0;
+
+        juce::String toString() const
+        {
+            juce::String s;
+            s << "Render: " << (juce::int64)numFrames << " frames, "
+              << (juce::int64)numIdleTicks << " idle, mean "
+              << juce::String(numFrames > 0 ? totalRenderMs / (double)numFrames : 0.0, 2)
+              << " ms CPU, "
+              << (gpuMs >= 0.0 ? juce::String(gpuMs, 2) + " ms GPU\n" : juce::String("GPU time n/a\n"))
+              << "Particles: " << numLiveParticles << " live, budget " << particleBudget << "\n"
+              << "Frame interval histogram (<8/12/17/25/34/50/100 ms, more):";
+
+            for (auto count : buckets)
+                s << " " << (juce::int64)count;
+
+            return s;
+        }
+    };
+
+    FrameStats getFrameStats() const;
+
     /*  Sets the minimum frequency, corresponding to the bottom of the screen.
     */
     void setMinFrequency(float newMinFrequency);
@@ -94,45 +161,162 @@ public:
     */
     void setDotSize(float newDotSize);
 
-    /*  Sets the distance at which particles disappear ("m")
+    /*  Sets the distance at which particles disappear ("m"), at most
+        ParticleVertex::maxFadeEndZ.
     */
     void setFadeEndZ(float newFadeEndZ);
 
     //=========================================================================
-    /*  Tells the component to start recording. Not yet implemented.
+    /*  Tells the component to start rendering frames for the video 
+        writers, one target for each of the given formats (at most
+        Constants::maxCaptureTargets). Target i's frames go to the queue
+        set for index i. The capture buffers are created on the GL 
+        thread with the first frame.
+
+        Every target is rendered from the same particles, uploaded once
+        per frame, at its own size and frame rate, so several videos 
+        can be made from one performance.
+
+        Returns false, and starts nothing, if the frames of the last
+        recording haven't been drained yet (see waitForCaptureDrain()).
     */
-    void startRecording();
+    bool startRecording(const std::vector<CaptureSettings>& targets);
+
+    /*  Tells the component to stop recording.
 
-    /*  Tells the component to stop recording. Not yet implemented.
+        The last few frames are still being read back from the GPU, so
+        this waits briefly for the GL thread to hand them to the frame
+        queue before returning. Returns false if it gave up waiting; the
+        GL thread still drains them with its next frame.
     */
-    void stopRecording();
+    bool stopRecording();
+
+    /*  Waits up to timeoutMs for the GL thread to drain the last
+        recording. Returns true once it has, after which its frame 
+        queues won't be written to again, so they can be reused for the
+        next recording.
+    */
+    bool waitForCaptureDrain(int timeoutMs);
+
+    /*  Counts of the frames sent to one video writer in the current or
+        last recording. Every frame due is either rendered, duplicated 
+        (when too many are due at once) or dropped (when the writer 
+        can't keep up), so the three add up to the video's total length.
+    */
+    struct CaptureStats
+    {
+        int targetIndex = 0;
+        int width = 0;
+        int height = 0;
+        int fps = 0;
+
+        juce::uint64 numRendered = 0;
+        juce::uint64 numDuplicated = 0;
+        juce::uint64 numDropped = 0; // Queue full or readback failed
+        juce::uint64 numLate = 0; // Captured after the next frame was due
+
+        juce::String toString() const
+        {
+            juce::String s;
+            s << "Capture " << (targetIndex + 1) << " (" << width << "x" << height
+              << " @ " << fps << " fps): "
+              << (juce::int64)numRendered << " frames rendered, "
+              << (juce::int64)numDuplicated << " duplicated, "
+              << (juce::int64)numDropped << " dropped, "
+              << (juce::int64)numLate << " late";
+            return s;
+        }
+    };
+
+    /*  Returns the stats of each video in the current or last recording.
+    */
+    std::vector<CaptureStats> getCaptureStats() const;
+
+    //=========================================================================
+    /*  Packs some bands and distances into vertices on the CPU and decodes
+        them the way the vertex shader does, checking that each comes back
+        within a quantization step. Logs any that don't, and returns false.
+        Run with --check-vertex-packing.
+    */
+    static bool checkVertexPacking();
 
 
 private:
     //=========================================================================
     /*  This struct defines the layout of a single vertex in the VBO.
+
+        Everything is quantized to keep a vertex in 8 bytes; the vertex
+        shader decodes it. The birth distance is stored in units of 
+        birthQuantum modulo 2^16, so only the age (current distance 
+        minus birth distance) is meaningful, and it must stay below 
+        2^16 quanta (see maxBirthAge).
+
+        A live particle is never older than the fade distance plus the
+        distance moved in one frame, and if a frame moves further than
+        the fade distance every particle has faded anyway. So an age up
+        to twice maxFadeEndZ always decodes correctly, and the ring is
+        only cleared for wrapping once nothing in it is visible.
     */
     struct ParticleVertex
     {
-        float frequency; // Band frequency in Hertz
-        float amplitude; // 'Percieved' amplitude in range [0,1]
-        float panIndex; // 'Percieved' lateralization in range [-1,1]
-        float birthDistance; // Distance from camera when particle was created
-        int trackIndex;  // Which track this particle belongs to
+        uint16_t frequency; // log2 of the band frequency in Hertz, over [0, 15]
+        uint8_t amplitude; // 'Percieved' amplitude in range [0,1]
+        int8_t panIndex; // 'Percieved' lateralization in range [-1,1]
+        uint16_t birthDistance; // Distance travelled when particle was created
+        uint16_t trackIndex;  // Which track this particle belongs to (low 4 bits)
+
+        static constexpr float maxLog2Frequency = 15.0f; // 32768 Hz
+        static constexpr double birthQuantum = 1.0 / 1024.0; // m
+        static constexpr double maxBirthAge = 65536.0 * birthQuantum; // 64 m
+        static constexpr float maxFadeEndZ = 10.0f; // m, see setFadeEndZ()
+
+        /*  Quantizes a distance for the birthDistance field.
+        */
+        static uint16_t quantizeDistance(double distance);
+
+        /*  Returns false if the band can't be displayed (e.g. a NaN pan
+            from a silent input).
+        */
+        static bool isDisplayable(const FrequencyBand& band);
+
+        /*  Packs a band into a vertex. Returns false if the band can't
+            be displayed.
+        */
+        static bool pack(const FrequencyBand& band, uint16_t birth, ParticleVertex& out);
+
+        /*  See checkVertexPacking(). */
+        static bool checkPacking();
     };
 
+    static_assert(sizeof(ParticleVertex) == 8, "ParticleVertex should be 8 bytes");
+    static_assert(ParticleVertex::maxBirthAge > 2.0 * ParticleVertex::maxFadeEndZ,
+                  "Live particle ages must fit in the birth distance field");
+
     //========================================================================
     /*  Forward declarations of nested classes (see below).
     */
     struct VertexBuffer;
     struct Attributes;
     struct Uniforms;
+    struct TrailBuffer;
+    struct CaptureReadback;
+    struct CaptureTarget;
+    struct CaptureCounters;
+    struct GpuTimer;
 
     //=========================================================================
     /*  Compliles and links the shaders, and sets them active.
     */
     void createShaders();
 
+    /*  Compiles the full-screen pass that fades the 2D trail buffers.
+    */
+    void createDecayShader();
+
+    /*  Compiles the pass that converts capture frames to planar YUV.
+    */
+    void createYuvShader();
+
     /*  Updates all uniform values on the GPU.
     
         This function should only be called from the GL thread!
@@ -146,7 +330,52 @@ private:
     //=========================================================================
     void renderFrame();
     void renderToScreen();
-    void renderToCapture();
+    void captureDueFrames();
+    void captureDueFrames(CaptureTarget& target);
+    void renderToCapture(CaptureTarget& target, double distance, juce::int64 frameIndex);
+
+    /*  Creates a capture target for each format being recorded, if the
+        recording doesn't have them yet. They last until it is drained.
+    */
+    void createCaptureTargets();
+
+    /*  Creates the target's framebuffer and readback buffers, or 
+        recreates them if its capture size has changed.
+    */
+    void prepareCapture(CaptureTarget& target);
+
+    /*  Converts the target's framebuffer to YUV 4:2:0 in its 
+        yuvFrameBufferID.
+
+        The target is a single-channel image W wide and H * 3 / 2 high:
+        the Y plane, followed by the U and V planes packed end to end 
+        (I420). Reading it back row by row gives the planes exactly as
+        FFmpeg's yuv420p expects them. Uses BT.601 limited range, which 
+        is what FFmpeg assumed when it converted the RGB frames.
+    */
+    void convertCaptureToYuv(CaptureTarget& target);
+
+    /*  Frees the capture targets when a recording has finished.
+    */
+    void releaseCapture();
+
+    /*  Renders the 2D view through a persistent trail buffer and copies
+        it to targetFBO.
+
+        In 2D a particle never moves on screen as it ages, so instead of
+        redrawing every live particle, the trail buffer is faded by the
+        distance travelled this frame and only the new particles are 
+        drawn on top. The buffer is rebuilt from all live particles when
+        it is created or anything that changes the layout is changed.
+    */
+    void renderTrails(TrailBuffer& trail, int width, int height, GLuint targetFBO,
+                      double distance, int ageOffset);
+
+    /*  Sets the uniforms that place particles in depth for a render at
+        the given distance, which can be behind globalDistance. Returns
+        the age offset, in birth quanta, of that distance.
+    */
+    int setDistanceUniforms(double distance);
 
     //=========================================================================
     /*  Returns the colour corresponding to a colour scheme and amplitude value.
@@ -159,6 +388,28 @@ private:
 
     void printFrameInfo();
 
+    //=========================================================================
+    /*  Triggers a repaint if there is anything to draw. Called on the
+        timer thread at the frame rate cap.
+    */
+    void hiResTimerCallback() override;
+
+    /*  Returns true if any track has published results since the last 
+        call. Only called from the timer thread.
+    */
+    bool hasNewResults();
+
+    /*  Adds a frame to the render timing stats.
+    */
+    void recordFrameTime(double intervalSeconds, double renderSeconds);
+
+    /*  Adjusts the particle budget from the last frame's cost, so the
+        frame rate cap can be met. cpuMs leaves out the time spent on
+        capture, which is mostly waiting on readback and the writers.
+        Pass a negative gpuMs if unknown.
+    */
+    void updateParticleBudget(double cpuMs, double gpuMs);
+
     //=========================================================================
     juce::OpenGLContext openGLContext;
 
@@ -167,28 +418,66 @@ private:
     std::unique_ptr<Attributes> attributes;
     std::unique_ptr<Uniforms> uniforms;
 
-    std::array<TrackSlot, Constants::maxTracks>* results;
-    FrameQueue* frameQueue;
+    std::unique_ptr<OpenGLShaderProgram> decayShader;
+    std::unique_ptr<OpenGLShaderProgram::Uniform> decaySubtract;
+    GLuint decayVAO = 0;
+    std::unique_ptr<TrailBuffer> screenTrail;
+    std::atomic<bool> trailsNeedReseed { true };
+
+    std::array<TrackSlot, Constants::maxTracks>* results = nullptr;
+    std::array<FrameQueue*, Constants::maxCaptureTargets> frameQueues {};
+
+    std::array<uint32_t, Constants::maxTracks> lastSeenGenerations {}; // Timer thread only
+    std::atomic<bool> hasLiveParticles { false };
+    static constexpr int defaultFrameRateCap = 60;
+
+    std::array<std::atomic<juce::uint64>, FrameStats::numBuckets> frameIntervalBuckets {};
+    std::atomic<juce::uint64> numFramesRendered { 0 };
+    std::atomic<juce::uint64> numIdleTicks { 0 };
+    std::atomic<double> totalRenderMs { 0.0 };
+
+    std::atomic<int> frameRateCap { defaultFrameRateCap };
+    std::unique_ptr<GpuTimer> gpuTimer;
+    std::atomic<double> gpuFrameMs { -1.0 };
+    std::atomic<int> particleBudget { maxParticles };
+    std::atomic<int> numLiveParticles { 0 };
+    int overBudgetFrames = 0;
+    int underBudgetFrames = 0;
 
     float startTime;
     float lastFrameTime = 0.0f;
     int frameCount = 0;
 
-    float globalDistance = 0.0f; // Total (positive) distance traveled
+    double globalDistance = 0.0; // Total (positive) distance traveled
 
     juce::Vector3D<float> cameraPosition { 0.0f, 0.0f, -2.0f };
     juce::Matrix3D<float> view = juce::Matrix3D<float>::fromTranslation(cameraPosition);
     juce::Matrix3D<float> displayProj; // Projection matrix for the display window
-    juce::Matrix3D<float> captureProj; // Projection matrix for the video capture
 
     juce::OpenGLTexture colourMapTexture;
     std::atomic<bool> textureNeedsRebuild { true };
 
-    juce::OpenGLFrameBuffer captureFBO;
-    bool recording;
-    std::vector<uint8_t> capturePixels;
+    std::unique_ptr<OpenGLShaderProgram> yuvShader;
+    std::unique_ptr<OpenGLShaderProgram::Uniform> yuvSource;
+    std::unique_ptr<OpenGLShaderProgram::Uniform> yuvSize;
+    std::vector<std::unique_ptr<CaptureTarget>> captureTargets; // GL thread only
+    std::vector<CaptureSettings> captureSettings; // Only written while not recording or draining
+    std::atomic<bool> recording { false };
+
+    const CaptureClock* captureClock = nullptr;
+    static constexpr int maxCaptureRendersPerFrame = 2; // For each target
+
+    // Outlive the targets, so the stats can still be read once drained
+    std::unique_ptr<std::array<CaptureCounters, Constants::maxCaptureTargets>> captureCounters;
+
+    // Set from stopRecording() until the GL thread has drained the
+    // targets. The next recording can't start before then, since its
+    // queues and settings are the ones being drained.
+    std::atomic<bool> captureDraining { false };
+    juce::WaitableEvent captureDrained;
 
     std::unique_ptr<GridComponent> grid;
+    std::unique_ptr<StatsOverlay> statsOverlay;
 
     //=========================================================================
     /* Parameters */
@@ -207,6 +496,8 @@ private:
     static constexpr float farZ = 100.f; // Distance to the end of clip space (m)
     static constexpr float fov = 45.f; // Vertical field of view (degrees)
     static constexpr int maxParticles = 200000;
+    static constexpr int minParticleBudget = 5000;
+    static constexpr int minParticlesPerFrame = 256;
 
     //=========================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(GLVisualizer)
@@ -224,23 +515,85 @@ struct GLVisualizer::VertexBuffer
 
     //=========================================================================
     /*  Updates the particle array with new data from the results buffer.
+        Only results published since the last update are added.
+
+        All the bands added in one update share a birth distance, so they
+        are stored together as one slab. Slabs expire whole, oldest first.
+
+        At most maxNew bands are added, keeping the loudest, and the oldest
+        slabs are dropped early to keep the total within maxLive.
     */
     void updateParticles(std::array<TrackSlot, Constants::maxTracks>* results, 
-                         float globalDistance, 
-                         float fadeEndZ);
+                         double globalDistance, 
+                         float fadeEndZ,
+                         int maxLive,
+                         int maxNew);
+
+    /*  Copies the slabs added since the last upload to the VBO. The VBO
+        mirrors the particle ring, so only the new ranges are sent. Call 
+        this once per frame, before any draws.
+    */
+    void upload();
 
     /*  Draws all active particles.
     */
     void draw(Attributes& glAttributes);
 
+    /*  Draws the slabs numbered firstSlab onwards (slabs are numbered in
+        the order they were added, from zero).
+    */
+    void drawFrom(Attributes& glAttributes, juce::uint64 firstSlab);
+
+    /*  Returns the number of slabs added so far that were born at least
+        ageOffset birth quanta before base (see setDistanceUniforms()).
+    */
+    juce::uint64 getNumSlabsBornBy(uint16_t base, int ageOffset) const;
+
+    //=========================================================================
+    /*  A group of particles born in the same update. A slab's particles
+        are always contiguous in the ring.
+    */
+    struct Slab
+    {
+        int start;
+        int count;
+        uint16_t birth; // Quantized birth distance (see ParticleVertex)
+    };
+
+    /*  Finds room for count contiguous particles after the newest slab,
+        dropping the oldest slabs in the way, and returns the start index.
+    */
+    int allocate(int count);
+
+    void pushSlab(const Slab& slab);
+    void popOldestSlab();
+    const Slab& getSlab(int age) const; // 0 = oldest
+
+    /*  Returns the live part of the ring as up to two ranges of
+        (start, count), and the number of ranges.
+    */
+    int getDrawRanges(std::array<std::pair<int, int>, 2>& ranges) const;
+
+    //=========================================================================
     GLuint vaoID;
     GLuint vboID;
 
     std::array<ParticleVertex, maxParticles> particles;
 
-    int oldestIndex = 0;
+    static constexpr int maxSlabs = 16384;
+    std::array<Slab, maxSlabs> slabs;
+    int oldestSlab = 0;
+    int numSlabs = 0;
+
+    int writePosition = 0; // Where the next slab goes
+    int ringEnd = maxParticles; // End of the used part, before the last wrap
     int numActiveVertices = 0;
-    float lastUpdateTime = 0.0f;
+
+    int numPendingSlabs = 0; // Newest slabs not yet uploaded
+    juce::uint64 numSlabsPushed = 0; // Number of the next slab to be added
+    std::array<uint32_t, Constants::maxTracks> lastGenerations {}; // Of each TrackSlot
+    std::vector<const FrequencyBand*> candidates; // Scratch space for limiting insertions
+    double lastUpdateDistance = 0.0;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VertexBuffer)
 };
@@ -288,7 +641,10 @@ struct GLVisualizer::Uniforms
     std::unique_ptr<OpenGLShaderProgram::Uniform> windowSize; 
     std::unique_ptr<OpenGLShaderProgram::Uniform> minFrequency;
     std::unique_ptr<OpenGLShaderProgram::Uniform> maxFrequency;
-    std::unique_ptr<OpenGLShaderProgram::Uniform> globalDistance;
+    std::unique_ptr<OpenGLShaderProgram::Uniform> birthBase;
+    std::unique_ptr<OpenGLShaderProgram::Uniform> birthFraction;
+    std::unique_ptr<OpenGLShaderProgram::Uniform> birthQuantum;
+    std::unique_ptr<OpenGLShaderProgram::Uniform> ageOffset;
     std::unique_ptr<OpenGLShaderProgram::Uniform> fadeEndZ; 
     std::unique_ptr<OpenGLShaderProgram::Uniform> dotSize;
 
@@ -297,4 +653,182 @@ private:
     */
     static OpenGLShaderProgram::Uniform* createUniform(OpenGLShaderProgram& shader,
                                                         const char* uniformName);
+};
+
+
+//=============================================================================
+/*  An offscreen colour buffer that keeps the 2D trails between frames.
+
+    It uses a half-float texture so that the small per-frame fade isn't
+    lost to 8-bit rounding.
+*/
+struct GLVisualizer::TrailBuffer
+{
+    TrailBuffer() = default;
+    ~TrailBuffer();
+
+    /*  Creates the buffer, or recreates it if the size has changed.
+        Returns true if it was (re)created, in which case it needs to be
+        reseeded.
+    */
+    bool prepare(int newWidth, int newHeight);
+    void release();
+
+    GLuint frameBufferID = 0;
+    GLuint textureID = 0;
+    int width = 0;
+    int height = 0;
+    bool needsReseed = true;
+
+    double lastDistance = 0.0; // Distance at the last render
+    juce::uint64 nextSlab = 0; // First slab not yet drawn
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TrailBuffer)
+};
+
+
+//=============================================================================
+/*  A ring of pixel buffer objects for reading capture frames back
+    without stalling the GL thread.
+
+    glReadPixels into a PBO returns as soon as the copy is queued, and a
+    fence marks when the GPU has finished it. A frame is only mapped 
+    once numBuffers - 1 newer reads have been queued behind it, by which 
+    time the copy has normally long finished.
+*/
+struct GLVisualizer::CaptureReadback
+{
+    static constexpr int numBuffers = 3;
+
+    CaptureReadback() = default;
+    ~CaptureReadback();
+
+    /*  Creates the buffers for frames of the given size and format. 
+        YUV frames are read from a single-channel framebuffer holding 
+        all three planes (see convertCaptureToYuv()).
+    */
+    void prepare(const CaptureSettings& settings);
+    void release();
+
+    /*  Starts reading the bound read framebuffer into the next buffer,
+        as the frame with the given index, then passes the oldest frame
+        to the queue if every buffer is now in flight. Returns false if
+        that frame had to be dropped.
+    */
+    bool read(FrameQueue& queue, juce::int64 frameIndex);
+
+    /*  Waits for the oldest read to finish and passes its frame to the
+        queue. If the queue is full it waits up to blockTimeoutMs for 
+        room. Returns false if the frame had to be dropped.
+    */
+    bool finishOldest(FrameQueue& queue);
+
+    /*  Passes every frame still in flight to the queue, and returns the
+        number that had to be dropped.
+    */
+    int finishAll(FrameQueue& queue);
+
+    std::array<GLuint, numBuffers> bufferIDs {};
+    std::array<GLsync, numBuffers> fences {};
+    std::array<juce::int64, numBuffers> frameIndices {};
+    int width = 0; // Of the framebuffer read
+    int height = 0;
+    GLenum format = 0; // GL_RGB or GL_RED
+    int numBytes = 0; // In one frame
+    int blockTimeoutMs = 0; // How long to wait for room in the queue
+    int oldest = 0; // Index of the oldest buffer in flight
+    int numInFlight = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CaptureReadback)
+};
+
+
+//=============================================================================
+/*  One video being recorded: its format, where its frames go, and the
+    buffers it is rendered and read back through. Created and destroyed
+    on the GL thread.
+*/
+struct GLVisualizer::CaptureTarget
+{
+    CaptureTarget() = default;
+    ~CaptureTarget() { release(); }
+
+    /*  Frees the buffers. Any frames still in flight are lost.
+    */
+    void release();
+
+    /*  Returns the framebuffer that frames are read back from.
+    */
+    GLuint getReadFrameBuffer() const;
+
+    CaptureSettings settings;
+    FrameQueue* frameQueue = nullptr;
+    CaptureCounters* counters = nullptr; // This target's stats
+
+    juce::OpenGLFrameBuffer frameBuffer;
+    GLuint yuvFrameBufferID = 0; // Frames converted to YUV
+    GLuint yuvTextureID = 0;
+    CaptureReadback readback;
+    TrailBuffer trail;
+    juce::Matrix3D<float> projection;
+
+    juce::int64 frameIndex = 0; // Next frame due
+    double distance = 0.0; // Distance at the last frame
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CaptureTarget)
+};
+
+
+//=============================================================================
+/*  Frame counts for one capture target, shown with the stats. Written by
+    the GL thread and read by the message thread.
+*/
+struct GLVisualizer::CaptureCounters
+{
+    std::atomic<juce::uint64> numRendered { 0 };
+    std::atomic<juce::uint64> numDuplicated { 0 };
+    std::atomic<juce::uint64> numDropped { 0 };
+    std::atomic<juce::uint64> numLate { 0 };
+
+    void reset()
+    {
+        numRendered.store(0);
+        numDuplicated.store(0);
+        numDropped.store(0);
+        numLate.store(0);
+    }
+};
+
+
+//=============================================================================
+/*  Measures how long the GPU takes to render a frame, using a small ring
+    of GL_TIME_ELAPSED queries so that reading a result never stalls.
+    The result is a few frames old. Does nothing where timer queries
+    aren't supported.
+*/
+struct GLVisualizer::GpuTimer
+{
+    static constexpr int numQueries = 4;
+
+    GpuTimer() = default;
+    ~GpuTimer() { release(); }
+
+    void create();
+    void release();
+
+    void begin();
+    void end();
+
+    /*  Returns the most recent GPU frame time, or -1 if there isn't one.
+    */
+    double getLastMs() const { return lastMs; }
+
+    std::array<GLuint, numQueries> queryIDs {};
+    std::array<bool, numQueries> isPending {};
+    int nextQuery = 0;
+    bool isSupported = false;
+    bool isTiming = false;
+    double lastMs = -1.0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(GpuTimer)
 };
\ No newline at end of file
@@ -28,8 +28,10 @@
 
 #include <JuceHeader.h>
 #include "EpicLookAndFeel.h"
+#include "FrameStore.h"
 #include "MainController.h"
 #include "MainComponent.h"
+#include "RTLogger.h"
 #include "WelcomeWindow.h"
 
 //=============================================================================
@@ -68,7 +70,8 @@ public:
     void initialise(const juce::String& commandLine) override
     {
         // DBG("MoPanning Starting up!");
-        juce::ignoreUnused(commandLine);
+        juce::ArgumentList args(getApplicationName(), commandLine);
+        headless = args.containsOption("--headless");
 
         juce::PropertiesFile::Options options;
         options.applicationName = getApplicationName();
@@ -80,20 +83,55 @@ public:
 
         LookAndFeel::setDefaultLookAndFeel(&epicLookAndFeel);
 
+        // Start the logger before any audio or worker threads exist
+        RTLogger::getInstance().start();
+
+        // Checks that don't need the app, for debugging
+        if (args.containsOption("--check-vertex-packing"))
+        {
+            setApplicationReturnValue(GLVisualizer::checkVertexPacking() ? 0 : 1);
+            quit();
+            return;
+        }
+
+        if (args.containsOption("--benchmark-frame-store"))
+        {
+            setApplicationReturnValue(benchmarkFrameStore(args) ? 0 : 1);
+            quit();
+            return;
+        }
+
         commandManager = std::make_unique<juce::ApplicationCommandManager>();
         controller = std::make_unique<MainController>();
-        mainComponent = std::make_unique<MainComponent>(*controller, 
-                                                        *commandManager);
 
-        mainWindow = std::make_unique<MainWindow>(getApplicationName(),
-                                                  std::move(mainComponent),
-                                                  *commandManager);
+        if (args.containsOption("--virtual-device"))
+            controller->useVirtualDevice(parseVirtualDeviceSettings(args));
 
-        // mainWindow->getContentComponent()->grabKeyboardFocus();
+        if (headless)
+        {
+            // No window or visualizer, just the audio and analysis path
+            controller->setDefaultParameters();
+        }
+        else
+        {
+            mainComponent = std::make_unique<MainComponent>(*controller, 
+                                                            *commandManager);
+
+            mainWindow = std::make_unique<MainWindow>(getApplicationName(),
+                                                      std::move(mainComponent),
+                                                      *commandManager);
+
+            // mainWindow->getContentComponent()->grabKeyboardFocus();
 
-        ShowWelcomeWindow();
+            ShowWelcomeWindow();
+        }
 
         controller->startAudio();
+
+        // Quit after a fixed time, for benchmark runs
+        auto duration = args.getValueForOption("--duration").getDoubleValue();
+        if (duration > 0.0)
+            juce::Timer::callAfterDelay((int)(duration * 1000.0), [] { quit(); });
     }
 
     /*  This is called to shut down the application. */
@@ -103,17 +141,73 @@ public:
         juce::MenuBarModel::setMacMainMenu(nullptr);
        #endif
 
+        // Leave the final timing stats in the log of benchmark runs
+        if (headless && controller != nullptr)
+            juce::Logger::writeToLog(controller->getCallbackStats().toString());
+
         mainWindow = nullptr; // Deletes the window
         controller = nullptr; // Controller should be destroyed after window
         commandManager = nullptr;
+
+        RTLogger::getInstance().stop();
     }
 
     //=========================================================================
     /*  This is called when the app is being asked to quit. */
     void systemRequestedQuit() override
     {
+        if (isConfirmingQuit)
+            return;
+
+        isConfirmingQuit = true;
         controller->stopRecording();
-        quit();
+        confirmQuit();
+    }
+
+    /*  Quits once the recording has stopped and the user has chosen
+        where to save it, asking first if recordings are still being
+        saved.
+    */
+    void confirmQuit()
+    {
+        // The save location is asked for before anything else
+        if (controller->isRecording() || controller->isChoosingDestination())
+        {
+            juce::Timer::callAfterDelay(quitPollMs, [this] 
+            { 
+                if (controller != nullptr) 
+                    confirmQuit(); 
+            });
+            return;
+        }
+
+        if (controller->getNumPendingExports() == 0)
+        {
+            quit();
+            return;
+        }
+
+        // Quitting would lose the recordings still being saved
+        auto options = juce::MessageBoxOptions()
+                           .withIconType(juce::MessageBoxIconType::QuestionIcon)
+                           .withTitle("Videos are still being saved")
+                           .withMessage("Quitting now will cancel saving "
+                                        + juce::String(controller->getNumPendingExports())
+                                        + " recording(s).")
+                           .withButton("Quit Anyway")
+                           .withButton("Keep Saving");
+
+        juce::NativeMessageBox::showAsync(options, [this](int result)
+        {
+            if (result == 0 && controller != nullptr)
+            {
+                controller->cancelExports();
+                quit();
+                return;
+            }
+
+            isConfirmingQuit = false;
+        });
     }
 
     /*  When another instance of the app is launched while this one is 
@@ -187,6 +281,138 @@ public:
 
 private:
     //=========================================================================
+    /*  Reads the virtual device options from the command line:
+
+            --virtual-device          Use the virtual device
+            --channels=N              Number of input channels (default 2)
+            --sample-rate=HZ          Sample rate, 8000 to 384000 (default 48000)
+            --block-size=N            Block size in samples (default 512)
+            --source=sines|noise|PATH Input signal (default sines)
+            --tone=FREQ:AMP:PAN:ITDMS Replaces the default tones; repeatable
+            --free-run                Run callbacks as fast as possible
+    */
+    static VirtualDeviceSettings parseVirtualDeviceSettings(const juce::ArgumentList& args)
+    {
+        VirtualDeviceSettings settings;
+
+        if (args.containsOption("--channels"))
+            settings.numInputChannels = juce::jlimit(1, 64, args.getValueForOption("--channels").getIntValue());
+        if (args.containsOption("--sample-rate"))
+            settings.sampleRate = juce::jlimit(8000.0, 384000.0, args.getValueForOption("--sample-rate").getDoubleValue());
+        if (args.containsOption("--block-size"))
+            settings.blockSize = juce::jlimit(16, 8192, args.getValueForOption("--block-size").getIntValue());
+
+        settings.freeRunning = args.containsOption("--free-run");
+
+        auto source = args.getValueForOption("--source");
+        if (source == "noise")
+        {
+            settings.source = VirtualDeviceSettings::noise;
+        }
+        else if (source.isNotEmpty() && source != "sines")
+        {
+            settings.source = VirtualDeviceSettings::audioFile;
+            settings.file = juce::File::getCurrentWorkingDirectory().getChildFile(source);
+        }
+
+        std::vector<VirtualDeviceSettings::Tone> tones;
+        for (const auto& arg : args.arguments)
+        {
+            if (!arg.text.startsWith("--tone="))
+                continue;
+
+            auto fields = juce::StringArray::fromTokens(arg.text.fromFirstOccurrenceOf("=", false, false), ":", "");
+            tones.push_back({ fields[0].getFloatValue(),
+                              fields.size() > 1 ? fields[1].getFloatValue() : 0.2f,
+                              fields.size() > 2 ? fields[2].getFloatValue() : 0.0f,
+                              fields.size() > 3 ? fields[3].getFloatValue() : 0.0f });
+        }
+        if (!tones.empty())
+            settings.tones = std::move(tones);
+
+        return settings;
+    }
+
+    /*  Runs the frame store over a dump of raw frames, such as one made
+        with "ffmpeg -i video.mp4 -f rawvideo -pix_fmt yuv420p frames.yuv",
+        then reads it back and checks every frame. Logs the compression
+        stats and the decode rate.
+
+            --benchmark-frame-store=PATH  The raw frames
+            --width=N, --height=N         Frame size (default 1920x1080)
+            --pixel-format=yuv420p|rgb24  Frame format (default yuv420p)
+    */
+    static bool benchmarkFrameStore(const juce::ArgumentList& args)
+    {
+        const auto source = args.getFileForOption("--benchmark-frame-store");
+
+        CaptureSettings settings;
+        if (args.containsOption("--width"))
+            settings.width = juce::jlimit(2, 8192, args.getValueForOption("--width").getIntValue());
+        if (args.containsOption("--height"))
+            settings.height = juce::jlimit(2, 8192, args.getValueForOption("--height").getIntValue());
+        if (args.getValueForOption("--pixel-format") == "rgb24")
+            settings.pixelFormat = CaptureSettings::rgb24;
+
+        const int frameBytes = settings.getFrameBytes();
+        juce::HeapBlock<uint8_t> frame((size_t)frameBytes), decoded((size_t)frameBytes);
+
+        juce::FileInputStream in(source);
+        if (in.failedToOpen())
+        {
+            juce::Logger::writeToLog("Couldn't open " + source.getFullPathName());
+            return false;
+        }
+
+        juce::TemporaryFile stored(".mpfs");
+        FrameStore::Writer writer;
+        if (!writer.open(stored.getFile(), settings))
+            return false;
+
+        juce::int64 numFrames = 0;
+        while (in.read(frame, frameBytes) == frameBytes)
+            if (!writer.write(frame, numFrames++))
+                return false;
+
+        if (numFrames == 0 || !writer.close())
+        {
+            juce::Logger::writeToLog("No frames of " + juce::String(frameBytes) + " bytes in " 
+                                     + source.getFullPathName());
+            return false;
+        }
+
+        juce::Logger::writeToLog(writer.getStats().toString());
+
+        // Read it back, checking against the original
+        FrameStore::Reader reader;
+        if (!reader.open(stored.getFile()))
+            return false;
+
+        in.setPosition(0);
+        double decodeSeconds = 0.0;
+        juce::int64 frameIndex = 0;
+
+        for (juce::int64 i = 0; i < numFrames; ++i)
+        {
+            const auto startTicks = juce::Time::getHighResolutionTicks();
+            const bool ok = reader.readNextFrame(decoded, frameIndex);
+            decodeSeconds += juce::Time::highResolutionTicksToSeconds(
+                                 juce::Time::getHighResolutionTicks() - startTicks);
+
+            in.read(frame, frameBytes);
+            if (!ok || frameIndex != i || std::memcmp(frame, decoded, (size_t)frameBytes) != 0)
+            {
+                juce::Logger::writeToLog("Frame " + juce::String(i) + " didn't read back");
+                return false;
+            }
+        }
+
+        const double mbPerSecond = decodeSeconds > 0.0 
+                                 ? (double)numFrames * frameBytes / decodeSeconds / 1.0e6 : 0.0;
+        juce::Logger::writeToLog("Frame store: read back at " + juce::String(mbPerSecond, 0) + " MB/s");
+        return true;
+    }
+
     void ShowWelcomeWindow()
     {
         auto* settings = getSettings();
@@ -216,6 +442,11 @@ private:
     std::unique_ptr<MainController> controller;
     std::unique_ptr<MainComponent> mainComponent;
     std::unique_ptr<MainWindow> mainWindow;
+
+    bool headless = false;
+    bool isConfirmingQuit = false;
+
+    static constexpr int quitPollMs = 100;
 };
 
 //=============================================================================
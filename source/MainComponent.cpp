@@ -36,12 +36,47 @@ MainComponent::MainComponent(MainController& mc,
 
     controller.registerVisualizer(visualizer.get());
 
+    visualizer->setStatsSource([this] 
+    { 
+        juce::String captureStats; // One line for each video
+        for (const auto& stats : visualizer->getCaptureStats())
+            captureStats << stats.toString() << "\n";
+
+        return controller.getCallbackStats().toString() + "\n"
+             + visualizer->getFrameStats().toString() + "\n"
+             + captureStats
+             + controller.getRecordingStats().toString() + "\n"
+             + controller.getReplayStats().toString(); 
+    });
+
+    exportStatus.setJustificationType(juce::Justification::centredRight);
+    exportStatus.setColour(juce::Label::backgroundColourId, juce::Colours::black.withAlpha(0.6f));
+    exportStatus.setColour(juce::Label::textColourId, juce::Colours::white);
+    exportStatus.setInterceptsMouseClicks(false, false);
+    addChildComponent(exportStatus);
+
+    controller.setExportProgressCallback([this](const VideoWriter::ExportProgress& p)
+    {
+        showExportProgress(p);
+    });
+
+    controller.onReplaySaved = [this](const juce::File& file, bool ok)
+    {
+        showReplaySaved(file, ok);
+    };
+
     controller.setDefaultParameters();
 
     // setLookAndFeel(&epicLookAndFeel);
     setSize(1200, 750);
 }
 
+MainComponent::~MainComponent()
+{
+    controller.setExportProgressCallback(nullptr);
+    controller.onReplaySaved = nullptr;
+}
+
 //=============================================================================
 /*  This is called every time the window is resized, and is where we set
     the bounds of the subcomponents (visualizer and settings panel).
@@ -60,6 +95,7 @@ void MainComponent::resized()
     }
 
     visualizer->setBounds(bounds);
+    exportStatus.setBounds(bounds.removeFromBottom(24).removeFromRight(420));
 }
 
 void MainComponent::paint(juce::Graphics& g)
@@ -121,12 +157,76 @@ void MainComponent::launchOpenDialog()
         });
 }
 
+/*  This shows the state of the video export queue in the corner of the
+    window, and hides it once every recording has been saved.
+*/
+void MainComponent::showExportProgress(const VideoWriter::ExportProgress& progress)
+{
+    // The progress only counts its own writer's exports, and the other
+    // videos of a recording are saved by other writers
+    const int numPending = controller.getNumPendingExports();
+
+    if (numPending == 0)
+    {
+        exportStatus.setVisible(false);
+        commandManager.commandStatusChanged();
+        return;
+    }
+
+    juce::String text;
+    if (progress.name.isNotEmpty())
+        text << progress.name << ": " << progress.status 
+             << " (" << juce::roundToInt(progress.progress * 100.0) << "%)";
+    if (numPending > 1)
+        text << "  +" << (numPending - 1) << " more";
+
+    exportStatus.setText(text, juce::dontSendNotification);
+
+    if (!exportStatus.isVisible())
+    {
+        exportStatus.setVisible(true);
+        exportStatus.toFront(false);
+        commandManager.commandStatusChanged();
+    }
+}
+
+/*  Briefly shows where a replay was saved, unless recordings are being
+    exported, in which case only a failure is worth interrupting them.
+*/
+void MainComponent::showReplaySaved(const juce::File& file, bool ok)
+{
+    if (!ok)
+    {
+        juce::AlertWindow::showMessageBoxAsync(juce::MessageBoxIconType::WarningIcon,
+                                               "Replay not saved",
+                                               "Couldn't save the replay to " + file.getFullPathName()
+                                               + ". See the log for details.");
+        return;
+    }
+
+    if (controller.getNumPendingExports() > 0)
+        return;
+
+    exportStatus.setText("Replay saved to " + file.getFileName(), juce::dontSendNotification);
+    exportStatus.setVisible(true);
+    exportStatus.toFront(false);
+
+    juce::Timer::callAfterDelay(replayMessageMs, [safeThis = juce::Component::SafePointer<MainComponent>(this)]
+    {
+        if (safeThis != nullptr && safeThis->controller.getNumPendingExports() == 0)
+            safeThis->exportStatus.setVisible(false);
+    });
+}
+
 //=============================================================================
 void MainComponent::getAllCommands(juce::Array<juce::CommandID>& commands) 
 { 
     commands.add(cmdToggleSettings);
     commands.add(cmdOpenFile);
     commands.add(cmdPlayPause);
+    commands.add(cmdToggleStats);
+    commands.add(cmdCancelExports);
+    commands.add(cmdSaveReplay);
 }
 
 /*  This returns info about the command asscociated with id, including
@@ -163,6 +263,30 @@ void MainComponent::getCommandInfo(juce::CommandID id,
         key = ' ';
         modifiers = juce::ModifierKeys::noModifiers;
     }
+    else if (id == cmdToggleStats)
+    {
+        shortName = "Show Stats";
+        description = "Show or hide the performance stats overlay";
+        category = "MoPanning";
+        key = 'I';
+        modifiers = juce::ModifierKeys::commandModifier;
+    }
+    else if (id == cmdCancelExports)
+    {
+        shortName = "Cancel Video Exports";
+        description = "Stop saving the recordings still being exported";
+        category = "File";
+        key = 'E';
+        modifiers = juce::ModifierKeys::commandModifier | juce::ModifierKeys::shiftModifier;
+    }
+    else if (id == cmdSaveReplay)
+    {
+        shortName = "Save Replay";
+        description = "Save the last few seconds held by the replay buffer";
+        category = "File";
+        key = 'R';
+        modifiers = juce::ModifierKeys::commandModifier;
+    }
     else
     {
         jassertfalse; // Unknown command ID!
@@ -171,6 +295,11 @@ void MainComponent::getCommandInfo(juce::CommandID id,
 
     info.setInfo(shortName, description, category, 0);
     info.addDefaultKeypress(key, modifiers);
+
+    if (id == cmdCancelExports)
+        info.setActive(controller.getNumPendingExports() > 0);
+    else if (id == cmdSaveReplay)
+        info.setActive(controller.isReplayBufferRunning());
 }
 
 /*  This is called whenever a command is executed, and is where we set 
@@ -193,6 +322,21 @@ bool MainComponent::perform(const InvocationInfo& info)
         controller.togglePlayback();
         return true;
     }
+    if (info.commandID == cmdToggleStats)
+    {
+        visualizer->setShowStats(!visualizer->isShowingStats());
+        return true;
+    }
+    if (info.commandID == cmdCancelExports)
+    {
+        controller.cancelExports();
+        return true;
+    }
+    if (info.commandID == cmdSaveReplay)
+    {
+        controller.saveReplay();
+        return true;
+    }
     return false;
 }
 
@@ -230,6 +374,9 @@ juce::PopupMenu MainComponent::getMenuForIndex(int topLevelIndex,
     {
         m.addCommandItem(&commandManager, cmdOpenFile);
         m.addCommandItem(&commandManager, cmdPlayPause);
+        m.addCommandItem(&commandManager, cmdToggleStats);
+        m.addCommandItem(&commandManager, cmdSaveReplay);
+        m.addCommandItem(&commandManager, cmdCancelExports);
     }
    #else
     // Add commands to Windows / Linux menu bars here. 
@@ -237,11 +384,14 @@ juce::PopupMenu MainComponent::getMenuForIndex(int topLevelIndex,
     if (topLevelIndex == 0)
     {
         m.addCommandItem(&commandManager, cmdToggleSettings);
+        m.addCommandItem(&commandManager, cmdToggleStats);
     }
     else if (topLevelIndex == 1)
     {
         m.addCommandItem(&commandManager, cmdOpenFile);
         m.addCommandItem(&commandManager, cmdPlayPause);
+        m.addCommandItem(&commandManager, cmdSaveReplay);
+        m.addCommandItem(&commandManager, cmdCancelExports);
     }
    #endif
 
@@ -45,11 +45,15 @@ public:
         cmdToggleSettings   = 0x2000,
         cmdOpenFile         = 0x2001,
         cmdPlayPause        = 0x2002,
+        cmdToggleStats      = 0x2003,
+        cmdCancelExports    = 0x2004,
+        cmdSaveReplay       = 0x2005,
     };
     enum class ViewMode { Focus, Settings };
 
     //=========================================================================
     explicit MainComponent(MainController&, juce::ApplicationCommandManager&);
+    ~MainComponent() override;
 
     //=========================================================================
     void resized() override;
@@ -59,6 +63,8 @@ private:
     //=========================================================================
     void toggleSettings();
     void launchOpenDialog();
+    void showExportProgress(const VideoWriter::ExportProgress& progress);
+    void showReplaySaved(const juce::File& file, bool ok);
 
     //=========================================================================
     void getAllCommands(juce::Array<juce::CommandID>& commands) override;
@@ -81,8 +87,11 @@ private:
     juce::ApplicationCommandManager& commandManager;
     std::unique_ptr<GLVisualizer> visualizer;
     std::unique_ptr<SettingsWindow> settingsWindow;
+    juce::Label exportStatus; // Shown while recordings and replays are being saved
     ViewMode viewMode { ViewMode::Focus };
 
+    static constexpr int replayMessageMs = 4000;
+
     //=========================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MainComponent)
 };
\ No newline at end of file
@@ -30,7 +30,14 @@ MainController::MainController()
     engine = std::make_unique<AudioEngine>();
 
     trackGains.resize(Constants::maxTracks, 1.0f);
-    videoWriter = std::make_unique<VideoWriter>();
+    getVideoWriter(0);
+
+    replayBuffer = std::make_unique<ReplayBuffer>();
+    replayBuffer->onReplaySaved = [this](const juce::File& file, bool ok)
+    {
+        if (onReplaySaved)
+            onReplaySaved(file, ok);
+    };
 
     // Set up parameter descriptors - all parameters should be listed here
     parameterDescriptors =
@@ -42,24 +49,297 @@ MainController::MainController()
             {"Off", "On"}, "",
             [this](float value) 
             {
+                if (visualizer == nullptr)
+                    return; // Nothing to record when running headless
+
                 if (value == true)
                 {
-                    videoWriter->start();
-                    visualizer->startRecording();
+                    stopReplayBuffer();
+                    startRecordingTargets();
                 }
                     
                 else
                 {
                     visualizer->stopRecording();
-                    videoWriter->stop();
+                    stopRecordingTargets();
+
+                    if (apvts != nullptr && *apvts->getRawParameterValue("replayBuffer") > 0.5f)
+                        startReplayBuffer();
+                }
+            },
+           #if JUCE_WINDOWS
+            false // Recording not supported on Windows :(
+           #else
+            true
+           #endif
+        },
+        // captureResolution
+        {
+            "captureResolution", "Recording Resolution",
+            "Video resolution for the next recording.",
+            "general", ParameterDescriptor::Type::Choice, 1, {},
+            {"1280x720", "1920x1080", "2560x1440", "3840x2160"}, "",
+            [this](float value) 
+            {
+                switch ((int)value)
+                {
+                    case 0: captureSettings.width = 1280; captureSettings.height = 720; break;
+                    case 1: captureSettings.width = 1920; captureSettings.height = 1080; break;
+                    case 2: captureSettings.width = 2560; captureSettings.height = 1440; break;
+                    case 3: captureSettings.width = 3840; captureSettings.height = 2160; break;
+                    default: jassertfalse;
+                }
+            },
+           #if JUCE_WINDOWS
+            false
+           #else
+            true
+           #endif
+        },
+        // captureFrameRate
+        {
+            "captureFrameRate", "Recording Frame Rate",
+            "Video frame rate for the next recording.",
+            "general", ParameterDescriptor::Type::Choice, 4, {},
+            {"24", "25", "30", "50", "60"}, "fps",
+            [this](float value) 
+            {
+                switch ((int)value)
+                {
+                    case 0: captureSettings.fps = 24; break;
+                    case 1: captureSettings.fps = 25; break;
+                    case 2: captureSettings.fps = 30; break;
+                    case 3: captureSettings.fps = 50; break;
+                    case 4: captureSettings.fps = 60; break;
+                    default: jassertfalse;
+                }
+            },
+           #if JUCE_WINDOWS
+            false
+           #else
+            true
+           #endif
+        },
+        // captureCodec
+        {
+            "captureCodec", "Recording Codec",
+            "Video codec for the next recording. H.265 files are about half the size, but slower to encode.",
+            "general", ParameterDescriptor::Type::Choice, 0, {},
+            {"H.264", "H.265"}, "",
+            [this](float value) 
+            {
+                captureSettings.codec = ((int)value == 1) ? CaptureSettings::hevc
+                                                          : CaptureSettings::h264;
+            },
+            false
+        },
+        // captureQueueDepth
+        {
+            "captureQueueDepth", "Recording Queue Depth",
+            "Number of frames buffered between rendering and writing.",
+            "general", ParameterDescriptor::Type::Choice, 1, {},
+            {"4", "8", "16", "32"}, "",
+            [this](float value) 
+            {
+                captureSettings.queueDepth = 4 << juce::jlimit(0, 3, (int)value);
+            },
+            false
+        },
+        // captureLiveEncode
+        {
+            "captureLiveEncode", "Encode While Recording",
+            "Encode video as it is recorded instead of saving raw frames to encode afterwards.",
+            "general", ParameterDescriptor::Type::Bool, true, {},
+            {"Off", "On"}, "",
+            [this](float value) 
+            {
+                captureSettings.liveEncode = (value != 0.0f);
+            },
+            false
+        },
+        // captureCompressFrames
+        {
+            "captureCompressFrames", "Compress Recorded Frames",
+            "Compress frames saved to disk when not encoding while recording.",
+            "general", ParameterDescriptor::Type::Bool, true, {},
+            {"Off", "On"}, "",
+            [this](float value) 
+            {
+                captureSettings.compressFrames = (value != 0.0f);
+            },
+            false
+        },
+        // captureElideFrames
+        {
+            "captureElideFrames", "Skip Unchanged Frames",
+            "Leave out recorded frames that are the same as the one before, and hold that one for longer.",
+            "general", ParameterDescriptor::Type::Bool, true, {},
+            {"Off", "On"}, "",
+            [this](float value) 
+            {
+                captureSettings.elideUnchangedFrames = (value != 0.0f);
+            },
+            false
+        },
+        // captureAudioFormat
+        {
+            "captureAudioFormat", "Recorded Audio Format",
+            "Sample format of the audio saved with a recording.",
+            "general", ParameterDescriptor::Type::Choice, 0, {},
+            {"24-bit", "32-bit Float"}, "",
+            [this](float value)
+            {
+                captureSettings.floatAudio = ((int)value == 1);
+            },
+            false
+        },
+        // captureGapPolicy
+        {
+            "captureGapPolicy", "Dropped Frame Policy",
+            "What to do when recorded frames can't be written fast enough.",
+            "general", ParameterDescriptor::Type::Choice, 0, {},
+            {"Repeat Last Frame", "Wait, Then Repeat", "Log Only"}, "",
+            [this](float value) 
+            {
+                switch ((int)value)
+                {
+                    case 0: captureSettings.gapPolicy = CaptureSettings::duplicateLast; break;
+                    case 1: captureSettings.gapPolicy = CaptureSettings::blockWithTimeout; break;
+                    case 2: captureSettings.gapPolicy = CaptureSettings::logGap; break;
+                    default: jassertfalse;
                 }
             },
+            false
+        },
+        // capturePixelFormat
+        {
+            "capturePixelFormat", "Recording Pixel Format",
+            "Format frames are read back from the GPU in. YUV 4:2:0 is converted on the GPU and is half the size.",
+            "general", ParameterDescriptor::Type::Choice, 1, {},
+            {"RGB", "YUV 4:2:0"}, "",
+            [this](float value) 
+            {
+                captureSettings.pixelFormat = ((int)value == 0) ? CaptureSettings::rgb24
+                                                                : CaptureSettings::yuv420p;
+            },
+            false
+        },
+        // captureSegmentLength
+        {
+            "captureSegmentLength", "Recording Segment Length",
+            "Recordings are written in pieces of this length, so a crash or full disk loses at most one.",
+            "general", ParameterDescriptor::Type::Choice, 1, {},
+            {"30 s", "1 min", "5 min", "10 min"}, "",
+            [this](float value) 
+            {
+                static constexpr int lengths[] = { 30, 60, 300, 600 };
+                captureSettings.segmentSeconds = lengths[juce::jlimit(0, 3, (int)value)];
+            },
+            false
+        },
+        // captureSecondOutput
+        {
+            "captureSecondOutput", "Second Video",
+            "Also record a second video of the same performance at this resolution, e.g. a smaller copy to share.",
+            "general", ParameterDescriptor::Type::Choice, 0, {},
+            {"Off", "1280x720", "1920x1080", "2560x1440", "3840x2160"}, "",
+            [this](float value) 
+            {
+                recordSecondCapture = ((int)value != 0);
+
+                switch ((int)value)
+                {
+                    case 0: break;
+                    case 1: secondCaptureSettings.width = 1280; secondCaptureSettings.height = 720; break;
+                    case 2: secondCaptureSettings.width = 1920; secondCaptureSettings.height = 1080; break;
+                    case 3: secondCaptureSettings.width = 2560; secondCaptureSettings.height = 1440; break;
+                    case 4: secondCaptureSettings.width = 3840; secondCaptureSettings.height = 2160; break;
+                    default: jassertfalse;
+                }
+            },
+           #if JUCE_WINDOWS
+            false
+           #else
+            true
+           #endif
+        },
+        // captureSecondFrameRate
+        {
+            "captureSecondFrameRate", "Second Video Frame Rate",
+            "Frame rate of the second video.",
+            "general", ParameterDescriptor::Type::Choice, 2, {},
+            {"24", "25", "30", "50", "60"}, "fps",
+            [this](float value) 
+            {
+                static constexpr int rates[] = { 24, 25, 30, 50, 60 };
+                secondCaptureSettings.fps = rates[juce::jlimit(0, 4, (int)value)];
+            },
+           #if JUCE_WINDOWS
+            false
+           #else
+            true
+           #endif
+        },
+        // captureSecondCodec
+        {
+            "captureSecondCodec", "Second Video Codec",
+            "Video codec of the second video.",
+            "general", ParameterDescriptor::Type::Choice, 0, {},
+            {"H.264", "H.265"}, "",
+            [this](float value) 
+            {
+                secondCaptureSettings.codec = ((int)value == 1) ? CaptureSettings::hevc
+                                                                : CaptureSettings::h264;
+            },
+            false
+        },
+        // replayBuffer
+        {
+            "replayBuffer", "Replay Buffer",
+            "Keep the last few seconds in memory so they can be saved after the fact.",
+            "general", ParameterDescriptor::Type::Bool, false, {},
+            {"Off", "On"}, "",
+            [this](float value) 
+            {
+                if (isRecording())
+                    return; // Started again when recording stops
+
+                if (value == true)
+                    startReplayBuffer();
+                else
+                    stopReplayBuffer();
+            },
            #if JUCE_WINDOWS
             false // Recording not supported on Windows :(
            #else
             true
            #endif
         },
+        // replayLength
+        {
+            "replayLength", "Replay Length",
+            "How much the replay buffer keeps. It takes effect the next time the buffer starts.",
+            "general", ParameterDescriptor::Type::Choice, 1, {},
+            {"15 s", "30 s", "1 min", "2 min"}, "",
+            [this](float value) 
+            {
+                static constexpr int lengths[] = { 15, 30, 60, 120 };
+                replaySeconds = lengths[juce::jlimit(0, 3, (int)value)];
+            },
+            false
+        },
+        // replayMemory
+        {
+            "replayMemory", "Replay Memory Limit",
+            "The most memory the replay buffer may use. Older frames are dropped to stay under it.",
+            "general", ParameterDescriptor::Type::Choice, 1, {},
+            {"256 MB", "512 MB", "1 GB", "2 GB"}, "",
+            [this](float value) 
+            {
+                replayMaxBytes = (size_t)256 << (20 + juce::jlimit(0, 3, (int)value));
+            },
+            false
+        },
         // inputType
         { 
             "inputType", "Input Type:", "Where to receive audio input from.", 
@@ -73,6 +353,24 @@ MainController::MainController()
                     onInputTypeChanged(static_cast<int>(value));
             }
         },
+        // inputRouting
+        {
+            "inputRouting", "Input Routing",
+            "How the input channels are grouped into tracks, in order. Pairs of channels make stereo or mid/side "
+            "tracks. At most " + juce::String(Constants::maxTracks) + " tracks are analysed; later inputs are ignored.",
+            "io", ParameterDescriptor::Type::Choice, 0, {},
+            {"Stereo Pairs", "Mono Channels", "Mid/Side Pairs"}, "",
+            [this](float value)
+            {
+                switch ((int)value)
+                {
+                    case 0: setInputRouting(TrackRoute::stereo); break;
+                    case 1: setInputRouting(TrackRoute::mono); break;
+                    case 2: setInputRouting(TrackRoute::midSide); break;
+                    default: jassertfalse;
+                }
+            }
+        },
         // windowSize
         {
             "windowSize", "Window Size", 
@@ -185,7 +483,8 @@ MainController::MainController()
                     case 4: newMaxFrequency = 24000.0f; break;
                     default: jassertfalse;
                 }
-                visualizer->setMaxFrequency(newMaxFrequency);
+                if (visualizer != nullptr)
+                    visualizer->setMaxFrequency(newMaxFrequency);
                 analyzer->setMaxFrequency(newMaxFrequency);
             },
             true
@@ -212,7 +511,8 @@ MainController::MainController()
                     default: newMinFreq = 20.0f; break;
                 }
 
-                visualizer->setMinFrequency(newMinFreq);
+                if (visualizer != nullptr)
+                    visualizer->setMinFrequency(newMinFreq);
                 analyzer->setMinFrequency(newMinFreq);
             }
 
@@ -518,6 +818,18 @@ MainController::MainController()
                     onDimChanged(static_cast<int>(value));
             }
         },
+        // frameRateCap
+        {
+            "frameRateCap", "Frame Rate Limit",
+            "Maximum display frame rate. Nothing is rendered while there is nothing to show.",
+            "visual", ParameterDescriptor::Type::Choice, 1, {},
+            {"30", "60", "120", "240"}, "fps",
+            [this](float value) 
+            {
+                if (visualizer != nullptr)
+                    visualizer->setFrameRateCap(30 << juce::jlimit(0, 3, (int)value));
+            }
+        },
         // showGrid
         {
             "showGrid", "Show Grid", 
@@ -541,13 +853,19 @@ MainController::MainController()
 
     apvts = &processor->getValueTreeState();
     apvts->state.addListener(this);
+
+    startTimer(statsLogIntervalMs);
 }
 
 MainController::~MainController()
 {
+    stopTimer();
     apvts->state.removeListener(this);
     auto& dm = engine->getDeviceManager();
     dm.removeAudioCallback(this);
+
+    // Its worker reads the frame queue, which goes first
+    replayBuffer->stop();
 }
 
 //=============================================================================
@@ -556,27 +874,51 @@ void MainController::startAudio()
 {
     // Set up the audio device manager
     auto& dm = engine->getDeviceManager();
-    dm.initialise(2, 2, nullptr, true);
+    auto bufferSize = 512; // Default buffer size
+
+    if (virtualDeviceSettings.has_value())
+    {
+        const auto& v = *virtualDeviceSettings;
+
+        // Adding a type before initialise() stops the device manager from
+        // creating the real device types, so the virtual device is used
+        dm.addAudioDeviceType(std::make_unique<VirtualAudioDeviceType>(v));
+        dm.initialise(v.numInputChannels, v.numOutputChannels, nullptr, true);
+        bufferSize = v.blockSize;
+    }
+    else
+    {
+        dm.initialise(2, 2, nullptr, true);
+    }
 
-    // Set buffer size to 512 samples as a default
     auto setup = dm.getAudioDeviceSetup();
-    setup.bufferSize = 512;
+    setup.bufferSize = bufferSize;
+    if (virtualDeviceSettings.has_value())
+        setup.sampleRate = virtualDeviceSettings->sampleRate;
     dm.setAudioDeviceSetup(setup, true);
 
     // Register this as an audio callback - audio starts now
     dm.addAudioCallback(this);
 
     // Prepare internal buffers
-    buffers.resize(2);
+    buffers.resize(1);
     for (auto& buf : buffers)
-        buf.setSize(2, 512);
+        buf.setSize(2, bufferSize);
+}
+
+void MainController::useVirtualDevice(const VirtualDeviceSettings& settings)
+{
+    virtualDeviceSettings = settings;
 }
 
 /*  The function that is called every time there is a new audio block to
     process. The AudioEngine will handle the audio data according to the 
     current input type (file or streaming). Output to the audio device 
-    goes through outputChannelData and the AudioAnalyzer receives a copy 
-    of the audio in 'buffer' for analysis.
+    goes through outputChannelData. In streaming mode each track is 
+    taken from the inputs by walking the compiled routing table, and the
+    AudioAnalyzer receives the samples directly in its ring buffers; in 
+    file mode the transport is a single stereo track rendered into 
+    buffers[0].
 */
 void MainController::audioDeviceIOCallbackWithContext(
     const float *const *inputChannelData, int numInputChannels,
@@ -588,48 +930,69 @@ void MainController::audioDeviceIOCallbackWithContext(
     somehow, this doesn't seem to cause any issues. */ 
     // jassert(numSamples == samplesPerBlock);
 
-    for (int track = 0; track < numTracks; track++)
+    // Time the whole callback against its deadline
+    CallbackMonitor::ScopedTimer callbackTimer(callbackMonitor, numSamples);
+
+    for (int ch = 0; ch < numOutputChannels; ++ch)
+        juce::FloatVectorOperations::clear(outputChannelData[ch], numSamples);
+
+    if (engine->getInputType() == streaming)
     {
-        const float* selectedChannels[2] = {
-            inputChannelData[2*track],
-            inputChannelData[2*track + 1]
-        };
+        for (const auto& route : router)
+        {
+            const float gain = trackGains[(size_t)route.trackIndex];
 
-        bool isFirstTrack = (track == 0);
+            // Mix the inputs straight to the output...
+            engine->mixRouteToOutput(inputChannelData, route, outputChannelData,
+                                     numSamples, gain);
 
+            // ...and into the analyzer's ring buffer
+            analyzer->enqueueRouted(inputChannelData, route, numSamples, gain);
+        }
+    }
+    else
+    {
         // Delegate to the audio engine
-        engine->fillAudioBuffers(selectedChannels, std::min(numInputChannels, 2),
-                                outputChannelData, numOutputChannels,
-                                numSamples, buffers[track], isFirstTrack, trackGains[track]);
+        engine->fillAudioBuffers(outputChannelData, numOutputChannels,
+                                 numSamples, buffers[0], true, trackGains[0]);
 
         // Pass the buffer to the analyzer
-        analyzer->enqueueBlock(&buffers[track], track);
+        analyzer->enqueueBlock(&buffers[0], numSamples, 0);
     }
 
-    // Give the audio output to the videoWriter
-    if (videoWriter->isRecording())
-        videoWriter->enqueueAudioBlock(outputChannelData, numSamples);
+    // Give the audio output to the recording
+    if (recordingActive.load())
+    {
+        recordingAudio.push(outputChannelData, numOutputChannels, numSamples);
+        captureClock.advance(numSamples); // Capture frames are timed by this
+    }
+    else if (replayBuffer->isRunning())
+    {
+        replayBuffer->enqueueAudioBlock(outputChannelData, numOutputChannels, numSamples);
+        captureClock.advance(numSamples);
+    }
     
-    juce::ignoreUnused(context);
+    juce::ignoreUnused(numInputChannels);
 }
 
 void MainController::audioDeviceAboutToStart(juce::AudioIODevice* device) 
 {
     sampleRate = device->getCurrentSampleRate();
     samplesPerBlock = device->getCurrentBufferSizeSamples();
+
+    callbackMonitor.prepare(sampleRate);
     
-    int numInputChannels = device->getActiveInputChannels().countNumberOfSetBits();
-    numTracks = std::max(numInputChannels / 2, 1); 
+    // Build the routing table for the current channel layout
+    auto activeInputs = device->getActiveInputChannels();
+    int numOutputChannels = device->getActiveOutputChannels().countNumberOfSetBits();
+    numTracks = router.compile(activeInputs, numOutputChannels);
 
     if (onNumTracksChanged)
         onNumTracksChanged(numTracks);
 
-    // Ensure buffers vector matches number of stereo tracks
-    buffers.resize(numTracks);
-
-    // Prepare each buffer
-    for (int i = 0; i < numTracks; ++i)
-        buffers[i].setSize(2, samplesPerBlock, false, false, true);
+    // Prepare the file playback buffer
+    buffers.resize(1);
+    buffers[0].setSize(2, samplesPerBlock, false, false, true);
     
     engine->prepareToPlay(samplesPerBlock, sampleRate);
 
@@ -637,11 +1000,22 @@ void MainController::audioDeviceAboutToStart(juce::AudioIODevice* device)
     analyzer->setResultsPointer(&analysisResults);
     analyzer->prepare(sampleRate, numTracks);
 
-    videoWriter->prepare(sampleRate, samplesPerBlock, 2);
-    videoWriter->setFrameQueuePointer(&videoWritingFrameQueue);
+    recordingAudio.prepare(sampleRate, 2);
+    for (auto& writer : videoWriters)
+        writer->prepare(sampleRate, samplesPerBlock, 2);
+
+    // The replay buffer keeps the main video
+    replayBuffer->prepare(sampleRate, 2);
+    replayBuffer->setFrameQueuePointer(&videoWritingFrameQueues[0]);
+
+    if (visualizer != nullptr)
+    {
+        visualizer->setResultsPointer(&analysisResults);
+        visualizer->setCaptureClockPointer(&captureClock);
 
-    visualizer->setResultsPointer(&analysisResults);
-    visualizer->setFrameQueuePointer(&videoWritingFrameQueue);
+        for (int i = 0; i < Constants::maxCaptureTargets; ++i)
+            visualizer->setFrameQueuePointer(&videoWritingFrameQueues[(size_t)i], i);
+    }
 }
 
 void MainController::audioDeviceStopped() 
@@ -707,6 +1081,31 @@ void MainController::setDefaultParameters()
     }
 }
 
+void MainController::setInputRouting(TrackRoute::Mode layout)
+{
+    if (router.getLayout() == layout)
+        return;
+
+    router.setLayout(layout);
+
+    if (engine == nullptr)
+        return; // Compiled when the device starts
+
+    // Re-register the callback so the routes are recompiled while the 
+    // audio callback is not running
+    auto& dm = engine->getDeviceManager();
+    if (dm.getCurrentAudioDevice() != nullptr)
+    {
+        dm.removeAudioCallback(this);
+        dm.addAudioCallback(this);
+    }
+}
+
+CallbackMonitor::Snapshot MainController::getCallbackStats() const
+{
+    return callbackMonitor.getSnapshot();
+}
+
 bool MainController::loadFile(const juce::File& f)
 {
     return engine->loadFile(f);
@@ -717,10 +1116,254 @@ void MainController::togglePlayback()
     engine->togglePlayback();
 }
 
+void MainController::setCaptureSettings(const CaptureSettings& newSettings)
+{
+    jassert(newSettings.width > 1 && newSettings.height > 1 && newSettings.fps > 0);
+    captureSettings = newSettings;
+
+    // 4:2:0 chroma needs an even size, in the capture and in the encoded video
+    captureSettings.width &= ~1;
+    captureSettings.height &= ~1;
+}
+
+std::vector<CaptureSettings> MainController::getCaptureTargets() const
+{
+    std::vector<CaptureSettings> targets { captureSettings };
+
+    if (recordSecondCapture)
+    {
+        auto second = captureSettings;
+        second.width = secondCaptureSettings.width;
+        second.height = secondCaptureSettings.height;
+        second.fps = secondCaptureSettings.fps;
+        second.codec = secondCaptureSettings.codec;
+        targets.push_back(second);
+    }
+
+    return targets;
+}
+
+VideoWriter::Stats MainController::getRecordingStats() const
+{
+    VideoWriter::Stats total;
+
+    for (int i = 0; i < numRecordingTargets && i < (int)videoWriters.size(); ++i)
+    {
+        const auto stats = videoWriters[(size_t)i]->getStats();
+        total.numWritten += stats.numWritten;
+        total.numMissing += stats.numMissing;
+        total.numFilled += stats.numFilled;
+        total.numElided += stats.numElided;
+    }
+
+    total.numAudioDropped = recordingAudio.getNumDropped();
+    return total;
+}
+
+void MainController::setExportProgressCallback(
+    std::function<void(const VideoWriter::ExportProgress&)> callback)
+{
+    exportProgressCallback = std::move(callback);
+
+    for (auto& writer : videoWriters)
+        writer->setExportProgressCallback(exportProgressCallback);
+}
+
+int MainController::getNumPendingExports() const
+{
+    int numPending = 0;
+    for (auto& writer : videoWriters)
+        numPending += writer->getNumPendingExports();
+
+    return numPending;
+}
+
+void MainController::cancelExports()
+{
+    for (auto& writer : videoWriters)
+        writer->cancelExports();
+}
+
+void MainController::saveReplay()
+{
+    const auto name = "replay_" + juce::Time::getCurrentTime().formatted("%Y%m%d_%H%M%S") + ".mp4";
+    replayBuffer->saveReplay(juce::File::getSpecialLocation(juce::File::userMoviesDirectory)
+                                 .getChildFile("MoPanning Replays")
+                                 .getChildFile(name));
+}
+
+bool MainController::isReplayBufferRunning() const
+{
+    return replayBuffer->isRunning();
+}
+
+ReplayBuffer::Stats MainController::getReplayStats() const
+{
+    return replayBuffer->getStats();
+}
+
+void MainController::startReplayBuffer()
+{
+    if (visualizer == nullptr)
+        return; // Nothing to capture when running headless
+
+    // The queue may still be drained into from the last recording
+    if (!visualizer->waitForCaptureDrain(captureDrainTimeoutMs))
+    {
+        DBG("Replay buffer not started, the last capture hasn't been drained");
+        return;
+    }
+
+    // The capture clock only runs while the replay buffer does, so the
+    // audio and frames it keeps line up the same way a recording's do
+    videoWritingFrameQueues[0].allocate(captureSettings);
+    captureClock.reset(sampleRate);
+    replayBuffer->start(captureSettings, replaySeconds, replayMaxBytes);
+
+    const bool started = visualizer->startRecording({ captureSettings });
+    jassert(started); // Drained above
+    juce::ignoreUnused(started);
+}
+
+void MainController::stopReplayBuffer()
+{
+    if (!replayBuffer->isRunning())
+        return;
+
+    if (visualizer != nullptr)
+        visualizer->stopRecording();
+
+    replayBuffer->stop();
+    videoWritingFrameQueues[0].release();
+}
+
+void MainController::startRecordingTargets()
+{
+    // The GL thread hands the last recording's frames to the queues
+    // until it has drained, so they can't be reused before then
+    if (!visualizer->waitForCaptureDrain(captureDrainTimeoutMs))
+    {
+        numRecordingTargets = 0;
+        abortRecordingStart("The last recording is still being read back from the graphics card. "
+                            "Please try again in a moment.");
+        return;
+    }
+
+    const auto targets = getCaptureTargets();
+
+    // Every video shares the one recording of the audio. It is started
+    // first, since a video can't be saved without it
+    auto take = std::make_shared<VideoWriter::Take>();
+    if (!recordingAudio.start(take->wavAudio, take->timeline, captureSettings))
+    {
+        numRecordingTargets = 0;
+        abortRecordingStart("Couldn't create the audio file " + take->wavAudio.getFullPathName()
+                            + ". Check that there is space on the disk.");
+        return;
+    }
+
+    numRecordingTargets = (int)targets.size();
+    captureClock.reset(sampleRate);
+
+    for (int i = 0; i < numRecordingTargets; ++i)
+    {
+        // The frame queues only hold memory while recording
+        videoWritingFrameQueues[(size_t)i].allocate(targets[(size_t)i]);
+        getVideoWriter(i).start(targets[(size_t)i], take);
+    }
+
+    recordingActive.store(true);
+
+    const bool started = visualizer->startRecording(targets);
+    jassert(started); // Drained above
+    juce::ignoreUnused(started);
+}
+
+void MainController::stopRecordingTargets()
+{
+    // Finish the audio first, so it is all there when the videos are saved
+    recordingActive.store(false);
+    recordingAudio.stop();
+
+    // The main video is stopped first, so it gets the name the user picks
+    for (int i = 0; i < numRecordingTargets; ++i)
+    {
+        getVideoWriter(i).stop();
+        videoWritingFrameQueues[(size_t)i].release();
+    }
+
+    // So a second stop doesn't release a queue the replay buffer has 
+    // taken over
+    numRecordingTargets = 0;
+}
+
+void MainController::abortRecordingStart(const juce::String& reason)
+{
+    // Not from inside the parameter's own change callback
+    juce::MessageManager::callAsync([self = juce::WeakReference<MainController>(this), reason]
+    {
+        if (self == nullptr)
+            return;
+
+        if (auto* param = self->apvts != nullptr ? self->apvts->getParameter("recording") : nullptr)
+            param->setValueNotifyingHost(0.0f);
+
+        juce::AlertWindow::showMessageBoxAsync(juce::MessageBoxIconType::WarningIcon,
+                                               "Couldn't start recording", reason);
+    });
+}
+
+VideoWriter& MainController::getVideoWriter(int targetIndex)
+{
+    jassert(juce::isPositiveAndBelow(targetIndex, Constants::maxCaptureTargets));
+
+    while ((int)videoWriters.size() <= targetIndex)
+    {
+        auto writer = std::make_unique<VideoWriter>();
+        writer->onStopRequested = [this](const juce::String& reason)
+        {
+            // Stop through the parameter so everything that follows it updates
+            if (auto* param = apvts != nullptr ? apvts->getParameter("recording") : nullptr)
+                param->setValueNotifyingHost(0.0f);
+
+            juce::AlertWindow::showMessageBoxAsync(juce::MessageBoxIconType::WarningIcon,
+                                                   "Recording stopped", reason);
+        };
+
+        if (sampleRate > 0.0)
+            writer->prepare(sampleRate, samplesPerBlock, 2);
+
+        writer->setFrameQueuePointer(&videoWritingFrameQueues[videoWriters.size()]);
+
+        if (exportProgressCallback != nullptr)
+            writer->setExportProgressCallback(exportProgressCallback);
+
+        videoWriters.push_back(std::move(writer));
+    }
+
+    return *videoWriters[(size_t)targetIndex];
+}
+
 void MainController::stopRecording()
 {
-    // Stop the video writer and finalize the recording
-    videoWriter->stop();
+    if (!isRecording())
+        return;
+
+    // Stop through the parameter, so the visualizer and the replay 
+    // buffer follow it. The writers then queue the recordings to be saved.
+    if (auto* param = apvts != nullptr ? apvts->getParameter("recording") : nullptr)
+        param->setValueNotifyingHost(0.0f);
+    else
+        stopRecordingTargets();
+}
+
+bool MainController::isChoosingDestination() const
+{
+    for (auto& writer : videoWriters)
+        if (writer->isChoosingDestination())
+            return true;
+
+    return false;
 }
 
 //=============================================================================
@@ -739,6 +1382,17 @@ juce::AudioDeviceManager& MainController::getDeviceManager()
     return engine->getDeviceManager();
 }
 
+//=============================================================================
+void MainController::timerCallback()
+{
+    auto stats = callbackMonitor.getSnapshot();
+    auto interval = stats.since(lastLoggedStats);
+    lastLoggedStats = stats;
+
+    if (interval.numCallbacks > 0)
+        juce::Logger::writeToLog(interval.toString());
+}
+
 //=============================================================================
 void MainController::valueTreePropertyChanged(juce::ValueTree& tree, 
                                               const juce::Identifier& id)
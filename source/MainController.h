@@ -31,10 +31,15 @@ communication between parts of the program must run through here.
 #include <JuceHeader.h>
 
 #include "AudioAnalyzer.h"
+#include "AudioCapture.h"
 #include "AudioEngine.h"
+#include "CallbackMonitor.h"
+#include "ChannelRouter.h"
 #include "GLVisualizer.h"
 #include "MiniAudioProcessor.h"
+#include "ReplayBuffer.h"
 #include "VideoWriter.h"
+#include "VirtualAudioDevice.h"
 
 #include "FrameQueue.h"
 #include "Utils.h"
@@ -60,7 +65,8 @@ struct ParameterDescriptor
 
 //=============================================================================
 class MainController : private juce::AudioIODeviceCallback,
-                       private juce::ValueTree::Listener
+                       private juce::ValueTree::Listener,
+                       private juce::Timer
 {
 public:
     //=========================================================================
@@ -76,6 +82,12 @@ public:
 
     void startAudio();
 
+    /*  Makes startAudio() open a virtual device with the given settings
+        instead of the system's default device. Must be called before
+        startAudio().
+    */
+    void useVirtualDevice(const VirtualDeviceSettings& settings);
+
     static ParamLayout makeParameterLayout(
         const std::vector<ParameterDescriptor>& descriptors);
 
@@ -84,7 +96,23 @@ public:
     bool loadFile(const juce::File& f);
     void togglePlayback();
 
+    /*  Stops recording, if it is, through the "recording" parameter. The
+        parameter's change is applied asynchronously.
+    */
     void stopRecording();
+    bool isRecording() const { return recordingActive.load(); }
+
+    /*  Sets the video format for recordings. It takes effect the next 
+        time recording starts, and allows sizes the parameters don't 
+        offer.
+    */
+    void setCaptureSettings(const CaptureSettings& newSettings);
+
+    /*  Returns the format of each video the next recording makes: the
+        main one, then the second output if it is turned on. They share
+        everything but their size, frame rate and codec.
+    */
+    std::vector<CaptureSettings> getCaptureTargets() const;
 
     std::vector<ParameterDescriptor> getParameterDescriptors() const;
     juce::AudioProcessorValueTreeState& getAPVTS() noexcept;
@@ -93,11 +121,44 @@ public:
 
     int getNumTracks() const { return numTracks; }
 
+    /*  Sets how the input channels are grouped into tracks (see
+        ChannelRouter::makeRoutes). The new routing takes effect 
+        immediately.
+    */
+    void setInputRouting(TrackRoute::Mode layout);
+
+    /*  Returns the audio callback timing stats since the device started.
+    */
+    CallbackMonitor::Snapshot getCallbackStats() const;
+
+    /*  Returns the video writers' frame counts for the current or last
+        recording, added up over its videos.
+    */
+    VideoWriter::Stats getRecordingStats() const;
+
+    /*  Stopped recordings are saved in the background. These pass 
+        through to the video writers' export queues.
+    */
+    void setExportProgressCallback(std::function<void(const VideoWriter::ExportProgress&)> callback);
+    int getNumPendingExports() const;
+    bool isChoosingDestination() const;
+    void cancelExports();
+
+    /*  Saves the last few seconds held by the replay buffer to the
+        "MoPanning Replays" folder in the user's Movies folder, in the
+        background. onReplaySaved is called when it is done.
+    */
+    void saveReplay();
+    bool isReplayBufferRunning() const;
+    ReplayBuffer::Stats getReplayStats() const;
+
+    std::function<void(const juce::File&, bool)> onReplaySaved;
+
     void valueTreePropertyChanged(juce::ValueTree&, 
                                   const juce::Identifier& id) override;
 
     juce::AudioBuffer<float> buffer;
-    std::vector<juce::AudioBuffer<float>> buffers;
+    std::vector<juce::AudioBuffer<float>> buffers; // Only [0] is used, for file playback
     std::vector<float> trackGains;
 
     std::function<void(int)> onNumTracksChanged;
@@ -106,24 +167,71 @@ public:
 
 private:
     //=========================================================================
-    double sampleRate;
-    int samplesPerBlock;
+    /*  Logs the callback stats for the last logging interval. */
+    void timerCallback() override;
+
+    /*  The replay buffer shares the frame queue and capture clock with 
+        recording, so it is suspended while recording.
+    */
+    void startReplayBuffer();
+    void stopReplayBuffer();
+
+    /*  Starts recording a video for each capture target, with their 
+        audio, or stops and saves them.
+    */
+    void startRecordingTargets();
+    void stopRecordingTargets();
+
+    /*  Turns the recording parameter back off and tells the user why,
+        when a recording couldn't be started.
+    */
+    void abortRecordingStart(const juce::String& reason);
+
+    /*  Returns the writer for the capture target with the given index, 
+        creating it the first time. Writers are kept once created, since
+        they carry on saving their last recording in the background.
+    */
+    VideoWriter& getVideoWriter(int targetIndex);
+
+    //=========================================================================
+    double sampleRate = 0.0; // Of the device, once it has started
+    int samplesPerBlock = 0;
 
     std::unique_ptr<AudioAnalyzer> analyzer;
     std::unique_ptr<MiniAudioProcessor> processor;
     std::unique_ptr<AudioEngine> engine;
-    std::unique_ptr<VideoWriter> videoWriter;
+    std::vector<std::unique_ptr<VideoWriter>> videoWriters; // One for each capture target
+    AudioCapture recordingAudio; // Shared by every video of a recording
+    std::function<void(const VideoWriter::ExportProgress&)> exportProgressCallback;
+    int numRecordingTargets = 1; // In the current or last recording
+    std::atomic<bool> recordingActive { false }; // Read by the audio thread
+    std::unique_ptr<ReplayBuffer> replayBuffer;
     GLVisualizer* visualizer = nullptr;
 
-    juce::AudioProcessorValueTreeState* apvts;
+    ChannelRouter router;
+    std::optional<VirtualDeviceSettings> virtualDeviceSettings;
+
+    CallbackMonitor callbackMonitor;
+    CallbackMonitor::Snapshot lastLoggedStats;
+    static constexpr int statsLogIntervalMs = 10000;
+    static constexpr int captureDrainTimeoutMs = 500;
+
+    juce::AudioProcessorValueTreeState* apvts = nullptr;
     std::vector<ParameterDescriptor> parameterDescriptors;
 
     std::array<TrackSlot, Constants::maxTracks> analysisResults;
-    FrameQueue videoWritingFrameQueue;
+    std::array<FrameQueue, Constants::maxCaptureTargets> videoWritingFrameQueues;
+    CaptureSettings captureSettings;
+    CaptureSettings secondCaptureSettings; // Only the size, rate and codec are used
+    bool recordSecondCapture = false;
+    CaptureClock captureClock;
+    int replaySeconds = 30;
+    size_t replayMaxBytes = (size_t)512 << 20;
 
     int numTracks = 1;
     bool threeDim = 1;
 
     //=========================================================================
+    JUCE_DECLARE_WEAK_REFERENCEABLE(MainController)
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MainController)
 };
\ No newline at end of file
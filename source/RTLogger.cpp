@@ -0,0 +1,202 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#include "RTLogger.h"
+
+
+//=============================================================================
+RTLogger& RTLogger::getInstance()
+{
+    static RTLogger instance;
+    return instance;
+}
+
+RTLogger::RTLogger()
+    : startTicks(juce::Time::getHighResolutionTicks())
+{
+    static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+    for (size_t i = 0; i < cells.size(); ++i)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+RTLogger::~RTLogger()
+{
+    stop();
+}
+
+//=============================================================================
+void RTLogger::start()
+{
+    if (thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shouldExit = false;
+    }
+
+    thread = std::thread([this] { run(); });
+}
+
+void RTLogger::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shouldExit = true;
+    }
+    cv.notify_one(); // Wake up the thread
+
+    if (thread.joinable())
+        thread.join();
+
+    flush(); // Anything logged while the thread was exiting
+}
+
+//=============================================================================
+/*  Applies the call site's rate limit. Only one thread can win the
+    compare-exchange for a given interval; everyone else counts as
+    suppressed and is reported with the next message that gets through.
+*/
+bool RTLogger::claimCallSite(CallSite& site, juce::int64 now)
+{
+    const auto minTicks = (juce::int64)(juce::Time::getHighResolutionTicksPerSecond()
+                                        * site.minIntervalMs / 1000);
+
+    auto last = site.lastTicks.load(std::memory_order_relaxed);
+
+    if ((last == 0 || now - last >= minTicks)
+        && site.lastTicks.compare_exchange_strong(last, now, std::memory_order_relaxed))
+        return true;
+
+    site.numSuppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool RTLogger::push(const Record& record)
+{
+    auto pos = enqueuePosition.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        auto& cell = cells[pos & (capacity - 1)];
+        const auto seq = cell.sequence.load(std::memory_order_acquire);
+        const auto diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+
+        if (diff == 0)
+        {
+            // The cell is free; try to claim it
+            if (enqueuePosition.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.record = record;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            // The queue is full
+            numDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            // Another producer got here first
+            pos = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool RTLogger::pop(Record& record)
+{
+    auto& cell = cells[dequeuePosition & (capacity - 1)];
+
+    if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+        return false; // Empty, or the producer hasn't finished writing yet
+
+    record = cell.record;
+    cell.sequence.store(dequeuePosition + capacity, std::memory_order_release);
+    ++dequeuePosition;
+    return true;
+}
+
+//=============================================================================
+void RTLogger::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!shouldExit)
+    {
+        lock.unlock();
+        flush();
+        lock.lock();
+
+        // Producers never notify, so just poll at a relaxed rate
+        cv.wait_for(lock, std::chrono::milliseconds(flushIntervalMs),
+                    [this] { return shouldExit; });
+    }
+}
+
+void RTLogger::flush()
+{
+    Record record;
+    while (pop(record))
+        juce::Logger::writeToLog(format(record));
+
+    const auto dropped = numDropped.load(std::memory_order_relaxed);
+    if (dropped != numDroppedReported)
+    {
+        juce::Logger::writeToLog("RTLogger: " + juce::String(dropped - numDroppedReported)
+                                 + " messages dropped (queue full)");
+        numDroppedReported = dropped;
+    }
+}
+
+juce::String RTLogger::format(const Record& record) const
+{
+    const double seconds = juce::Time::highResolutionTicksToSeconds(record.ticks - startTicks);
+
+    juce::String s;
+    s << "[" << juce::String(seconds, 3) << "] ";
+
+    int argIndex = 0;
+    for (auto p = record.site->format; *p != 0; ++p)
+    {
+        if (p[0] == '{' && p[1] == '}' && argIndex < record.numArgs)
+        {
+            const auto& arg = record.args[(size_t)argIndex++];
+            if (arg.type == Arg::real)
+                s << juce::String(arg.d, 3);
+            else
+                s << arg.i;
+            ++p;
+        }
+        else
+        {
+            s << *p;
+        }
+    }
+
+    if (record.numSuppressed > 0)
+        s << " (" << (int)record.numSuppressed << " similar messages suppressed)";
+
+    return s;
+}
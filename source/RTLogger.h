@@ -0,0 +1,221 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+
+
+//=============================================================================
+/*  A logger that is safe to call from the audio thread.
+
+    Logging a message copies a fixed-size record (a pointer to a static
+    format string and a few numeric arguments) into a lock-free bounded
+    queue, which any number of threads can push to. A background thread
+    pops the records, formats them and writes them to juce::Logger.
+    Nothing on the logging side allocates, locks or makes a system call,
+    so messages can stay enabled in release builds.
+
+    Use it through the RT_LOG macro, which gives each call site its own
+    rate limit so a message repeated every callback is printed at most
+    once per interval, with a count of the ones that were suppressed:
+
+        RT_LOG("Track {} overloaded, skipped {} samples", track, n);
+
+    Each {} in the format is replaced by the next argument. Arguments
+    must be integers or floating point numbers, and the format must be
+    a string literal since only its pointer is stored.
+*/
+class RTLogger
+{
+public:
+    //=========================================================================
+    static constexpr int maxArgs = 6;
+    static constexpr int capacity = 1024; // Must be a power of two
+    static constexpr int defaultIntervalMs = 1000;
+
+    /*  Per call site state, normally created by the RT_LOG macro. It can
+        be constant-initialized, so a function-local static is safe to
+        use from the audio thread.
+    */
+    struct CallSite
+    {
+        constexpr CallSite(const char* f, int intervalMs) noexcept
+            : format(f), minIntervalMs(intervalMs) {}
+
+        const char* const format;
+        const int minIntervalMs;
+        std::atomic<juce::int64> lastTicks { 0 };
+        std::atomic<juce::uint32> numSuppressed { 0 };
+    };
+
+    //=========================================================================
+    static RTLogger& getInstance();
+
+    /*  Starts the background thread that writes messages out. Messages
+        logged before this are kept until the queue fills up.
+    */
+    void start();
+
+    /*  Writes out anything still queued and stops the background thread.
+    */
+    void stop();
+
+    /*  Queues a message. Returns false if it was rate limited or the
+        queue was full. Safe to call from any thread.
+    */
+    template <typename... Args>
+    bool log(CallSite& site, Args... args)
+    {
+        static_assert(sizeof...(Args) <= maxArgs, "Too many arguments to RT_LOG");
+
+        const auto now = juce::Time::getHighResolutionTicks();
+        if (!claimCallSite(site, now))
+            return false;
+
+        Record record;
+        record.site = &site;
+        record.ticks = now;
+        record.numSuppressed = site.numSuppressed.exchange(0, std::memory_order_relaxed);
+        record.numArgs = 0;
+        (record.addArg(args), ...);
+
+        return push(record);
+    }
+
+    /*  Same as log(), with the call site's format passed along first. Used
+        by the RT_LOG macros so that a message with no arguments doesn't
+        need an empty __VA_ARGS__.
+    */
+    template <typename... Args>
+    bool logWithFormat(CallSite& site, const char* /*format*/, Args... args)
+    {
+        return log(site, args...);
+    }
+
+    /*  Returns the number of messages lost because the queue was full.
+    */
+    juce::uint64 getNumDropped() const { return numDropped.load(std::memory_order_relaxed); }
+
+private:
+    //=========================================================================
+    struct Arg
+    {
+        enum Type { integer, real } type;
+        union
+        {
+            juce::int64 i;
+            double d;
+        };
+    };
+
+    struct Record
+    {
+        CallSite* site;
+        juce::int64 ticks;
+        juce::uint32 numSuppressed;
+        int numArgs;
+        std::array<Arg, maxArgs> args;
+
+        template <typename T>
+        void addArg(T value)
+        {
+            static_assert(std::is_arithmetic_v<T>, "RT_LOG arguments must be numbers");
+
+            auto& arg = args[(size_t)numArgs++];
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                arg.type = Arg::real;
+                arg.d = (double)value;
+            }
+            else
+            {
+                arg.type = Arg::integer;
+                arg.i = (juce::int64)value;
+            }
+        }
+    };
+
+    /*  One slot of the queue. The sequence number tells producers and the
+        consumer whose turn it is to use the slot (see Vyukov's bounded
+        MPMC queue, here with a single consumer).
+    */
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    //=========================================================================
+    RTLogger();
+    ~RTLogger();
+
+    bool claimCallSite(CallSite& site, juce::int64 now);
+    bool push(const Record& record);
+    bool pop(Record& record);
+
+    void run();
+    void flush();
+    juce::String format(const Record& record) const;
+
+    //=========================================================================
+    std::array<Cell, capacity> cells;
+    alignas(64) std::atomic<size_t> enqueuePosition { 0 };
+    alignas(64) size_t dequeuePosition = 0; // Only used by the writer thread
+
+    std::atomic<juce::uint64> numDropped { 0 };
+    juce::uint64 numDroppedReported = 0;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool shouldExit = false;
+
+    const juce::int64 startTicks;
+
+    static constexpr int flushIntervalMs = 50;
+
+    //=========================================================================
+    // No leak detector, since the instance outlives the detector's statics
+    JUCE_DECLARE_NON_COPYABLE(RTLogger)
+};
+
+
+//=============================================================================
+/*  Logs a message from any thread, at most once per second per call site.
+    The first argument is the format string.
+*/
+#define RT_LOG(...) \
+    RT_LOG_EVERY(RTLogger::defaultIntervalMs, __VA_ARGS__)
+
+/*  Logs a message from any thread, at most once per intervalMs per call
+    site.
+*/
+#define RT_LOG_EVERY(intervalMs, ...) \
+    do { \
+        static RTLogger::CallSite rtLogCallSite_ { RT_LOG_FORMAT_(__VA_ARGS__), intervalMs }; \
+        RTLogger::getInstance().logWithFormat(rtLogCallSite_, __VA_ARGS__); \
+    } while (false)
+
+// Picks the format out of the arguments without an empty __VA_ARGS__,
+// which isn't portable before C++20. The extra expansion is for MSVC.
+#define RT_LOG_EXPAND_(x) x
+#define RT_LOG_FORMAT_(...) RT_LOG_EXPAND_(RT_LOG_FIRST_(__VA_ARGS__, unused))
+#define RT_LOG_FIRST_(format, ...) format
@@ -0,0 +1,193 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#include "RawMatroskaStream.h"
+
+
+//=============================================================================
+namespace
+{
+    // Element IDs
+    enum : juce::uint32
+    {
+        ebmlHeader          = 0x1A45DFA3,
+        ebmlVersion         = 0x4286,
+        ebmlReadVersion     = 0x42F7,
+        ebmlMaxIdLength     = 0x42F2,
+        ebmlMaxSizeLength   = 0x42F3,
+        docType             = 0x4282,
+        docTypeVersion      = 0x4287,
+        docTypeReadVersion  = 0x4285,
+        segment             = 0x18538067,
+        info                = 0x1549A966,
+        timestampScale      = 0x2AD7B1,
+        muxingApp           = 0x4D80,
+        writingApp          = 0x5741,
+        tracks              = 0x1654AE6B,
+        trackEntry          = 0xAE,
+        trackNumber         = 0xD7,
+        trackUid            = 0x73C5,
+        trackType           = 0x83,
+        flagLacing          = 0x9C,
+        codecId             = 0x86,
+        defaultDuration     = 0x23E383,
+        video               = 0xE0,
+        pixelWidth          = 0xB0,
+        pixelHeight         = 0xBA,
+        colourSpace         = 0x2EB524,
+        cluster             = 0x1F43B675,
+        clusterTimestamp    = 0xE7,
+        simpleBlock         = 0xA3
+    };
+
+    static constexpr juce::uint64 nanosecondsPerTick = 1000000; // Timestamps in ms
+
+    /*  IDs are written as they are, without leading zero bytes.
+    */
+    void writeId(juce::OutputStream& out, juce::uint32 id)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            if ((id >> shift) != 0)
+                out.writeByte((char)((id >> shift) & 0xff));
+    }
+
+    /*  Sizes are always written in 8 bytes, which is simpler than the
+        shortest form and only costs a few bytes per element.
+    */
+    void writeSize(juce::OutputStream& out, juce::uint64 size)
+    {
+        out.writeByte(0x01);
+        for (int shift = 48; shift >= 0; shift -= 8)
+            out.writeByte((char)((size >> shift) & 0xff));
+    }
+
+    void writeUnknownSize(juce::OutputStream& out)
+    {
+        out.writeByte(0x01);
+        for (int i = 0; i < 7; ++i)
+            out.writeByte((char)0xff);
+    }
+
+    void writeUint(juce::OutputStream& out, juce::uint32 id, juce::uint64 value)
+    {
+        writeId(out, id);
+        writeSize(out, 8);
+        out.writeInt64BigEndian((juce::int64)value);
+    }
+
+    void writeBinary(juce::OutputStream& out, juce::uint32 id, const void* data, size_t numBytes)
+    {
+        writeId(out, id);
+        writeSize(out, numBytes);
+        out.write(data, numBytes);
+    }
+
+    void writeString(juce::OutputStream& out, juce::uint32 id, const char* text)
+    {
+        writeBinary(out, id, text, std::strlen(text));
+    }
+
+    void writeMaster(juce::OutputStream& out, juce::uint32 id, const juce::MemoryOutputStream& content)
+    {
+        writeBinary(out, id, content.getData(), content.getDataSize());
+    }
+}
+
+//=============================================================================
+RawMatroskaStream::RawMatroskaStream(const CaptureSettings& s)
+    : settings(s)
+{
+    jassert(settings.fps > 0);
+}
+
+//=============================================================================
+void RawMatroskaStream::writeHeader(juce::OutputStream& out) const
+{
+    juce::MemoryOutputStream header;
+    writeUint(header, ebmlVersion, 1);
+    writeUint(header, ebmlReadVersion, 1);
+    writeUint(header, ebmlMaxIdLength, 4);
+    writeUint(header, ebmlMaxSizeLength, 8);
+    writeString(header, docType, "matroska");
+    writeUint(header, docTypeVersion, 4);
+    writeUint(header, docTypeReadVersion, 2);
+    writeMaster(out, ebmlHeader, header);
+
+    // The segment runs to the end of the stream
+    writeId(out, segment);
+    writeUnknownSize(out);
+
+    juce::MemoryOutputStream segmentInfo;
+    writeUint(segmentInfo, timestampScale, nanosecondsPerTick);
+    writeString(segmentInfo, muxingApp, "MoPanning");
+    writeString(segmentInfo, writingApp, "MoPanning");
+    writeMaster(out, info, segmentInfo);
+
+    // FFmpeg maps the FourCC to a pixel format, as it does for AVI
+    const uint8_t fourCC[4] = { 'I', '4', '2', '0' };
+    const uint8_t rgbFourCC[4] = { 'R', 'G', 'B', 24 };
+
+    juce::MemoryOutputStream videoSettings;
+    writeUint(videoSettings, pixelWidth, (juce::uint64)settings.width);
+    writeUint(videoSettings, pixelHeight, (juce::uint64)settings.height);
+    writeBinary(videoSettings, colourSpace,
+                settings.pixelFormat == CaptureSettings::yuv420p ? fourCC : rgbFourCC, 4);
+
+    // The default duration is how long the last frame lasts
+    juce::MemoryOutputStream track;
+    writeUint(track, trackNumber, 1);
+    writeUint(track, trackUid, 1);
+    writeUint(track, trackType, 1); // Video
+    writeUint(track, flagLacing, 0);
+    writeString(track, codecId, "V_UNCOMPRESSED");
+    writeUint(track, defaultDuration, (juce::uint64)std::llround(1.0e9 / settings.fps));
+    writeMaster(track, video, videoSettings);
+
+    juce::MemoryOutputStream trackList;
+    writeMaster(trackList, trackEntry, track);
+    writeMaster(out, tracks, trackList);
+}
+
+void RawMatroskaStream::writeBlockHeader(juce::OutputStream& out, juce::int64 frameIndex)
+{
+    const auto timestampMs = getTimestampMs(frameIndex);
+    jassert(timestampMs >= clusterMs); // Indices must increase
+
+    if (clusterMs < 0 || timestampMs - clusterMs > maxClusterMs)
+    {
+        // Clusters run until the next one starts
+        clusterMs = timestampMs;
+        writeId(out, cluster);
+        writeUnknownSize(out);
+        writeUint(out, clusterTimestamp, (juce::uint64)clusterMs);
+    }
+
+    writeId(out, simpleBlock);
+    writeSize(out, 4 + (juce::uint64)settings.getFrameBytes());
+    out.writeByte((char)0x81); // Track 1
+    out.writeShortBigEndian((short)(timestampMs - clusterMs));
+    out.writeByte((char)0x80); // Key frame
+}
+
+juce::int64 RawMatroskaStream::getTimestampMs(juce::int64 frameIndex) const
+{
+    return (juce::int64)std::llround((double)frameIndex * 1000.0 / settings.fps);
+}
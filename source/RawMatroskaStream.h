@@ -0,0 +1,70 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "Utils.h"
+
+
+//=============================================================================
+/*  Wraps raw video frames in a minimal Matroska stream, so that each
+    frame carries its own timestamp into FFmpeg.
+
+    FFmpeg's rawvideo input assumes one frame per 1 / fps, so leaving out
+    a frame would shift every frame after it. Here each frame is a block
+    stamped with its index / fps, and is shown until the next one starts.
+
+    The segment and clusters are written with unknown sizes, so nothing
+    has to be filled in afterwards: the stream can go straight down a
+    pipe, and a file that was cut off can be read up to its last whole
+    frame. Only what FFmpeg needs to read it is written.
+*/
+class RawMatroskaStream
+{
+public:
+    //=========================================================================
+    explicit RawMatroskaStream(const CaptureSettings& settings);
+
+    //=========================================================================
+    /*  Writes the header that goes before the first frame.
+    */
+    void writeHeader(juce::OutputStream& out) const;
+
+    /*  Writes what goes before a frame shown at frameIndex / fps, counted
+        from the start of the stream. The frame's getFrameBytes() bytes
+        must be written straight after. Indices must increase.
+    */
+    void writeBlockHeader(juce::OutputStream& out, juce::int64 frameIndex);
+
+private:
+    //=========================================================================
+    juce::int64 getTimestampMs(juce::int64 frameIndex) const;
+
+    //=========================================================================
+    const CaptureSettings settings;
+    juce::int64 clusterMs = -1; // Start of the current cluster
+
+    // Block timestamps are 16 bit, relative to their cluster
+    static constexpr int maxClusterMs = 1000;
+
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RawMatroskaStream)
+};
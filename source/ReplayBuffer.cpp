@@ -0,0 +1,537 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#include "ReplayBuffer.h"
+#include "FFmpegPipe.h"
+#include "FrameStore.h"
+#include "VideoWriter.h"
+
+
+//=============================================================================
+ReplayBuffer::ReplayBuffer()
+    : juce::Thread("ReplayBuffer")
+{
+    selfReference = this;
+}
+
+ReplayBuffer::~ReplayBuffer()
+{
+    stop();
+    savePool.removeAllJobs(true, saveShutdownTimeoutMs);
+    masterReference.clear();
+}
+
+//=============================================================================
+void ReplayBuffer::prepare(double sampleRateIn, int numChannelsIn)
+{
+    sampleRate = sampleRateIn;
+    numChannels = numChannelsIn;
+}
+
+void ReplayBuffer::setFrameQueuePointer(FrameQueue* frameQueuePtr)
+{
+    frameQueue = frameQueuePtr;
+}
+
+//=============================================================================
+void ReplayBuffer::start(const CaptureSettings& newSettings, int lengthSeconds, size_t newMaxBytes)
+{
+    stop();
+
+    settings = newSettings;
+    lengthFrames = (juce::int64)std::max(lengthSeconds, 1) * settings.fps;
+    maxBytes = newMaxBytes;
+    keyFrameInterval = std::max(settings.fps, 1); // So a second can be dropped at a time
+
+    const int frameBytes = settings.getFrameBytes();
+    previous.allocate((size_t)frameBytes, false);
+    delta.allocate((size_t)frameBytes, false);
+    encoded.allocate((size_t)FrameStore::getMaxEncodedSize(frameBytes), false);
+
+    numFramesAdded = 0;
+    nextFrameIndex = 0;
+    numFramesMissing = 0;
+    compressSeconds = 0.0;
+    statsNumCompressed = 0;
+
+    {
+        const juce::SpinLock::ScopedLockType lock(audioLock);
+        audioRing.setSize(numChannels, juce::roundToInt(sampleRate * (lengthSeconds + audioMarginSeconds)));
+        audioRing.clear();
+        numSamplesWritten = 0;
+    }
+
+    running = true;
+    startThread();
+}
+
+void ReplayBuffer::stop()
+{
+    running = false;
+    stopThread(-1);
+
+    frames.clear();
+    numBytesHeld = 0;
+    statsNumFrames = 0;
+    statsNumBytes = 0;
+    statsSeconds = 0.0;
+
+    const juce::SpinLock::ScopedLockType lock(audioLock);
+    audioRing.setSize(0, 0);
+}
+
+//=============================================================================
+void ReplayBuffer::enqueueAudioBlock(const float* const* block, int numChannelsIn, int numSamples)
+{
+    if (!running.load(std::memory_order_acquire))
+        return;
+
+    // Never wait on the audio thread; the lock is only contended while
+    // the ring is being reallocated, when it isn't running anyway
+    const juce::SpinLock::ScopedTryLockType lock(audioLock);
+    if (!lock.isLocked())
+        return;
+
+    const int ringSamples = audioRing.getNumSamples();
+    if (numSamples <= 0 || numSamples > ringSamples)
+        return;
+
+    const auto written = numSamplesWritten.load(std::memory_order_relaxed);
+    const int position = (int)(written % ringSamples);
+    const int numBeforeWrap = std::min(numSamples, ringSamples - position);
+
+    for (int ch = 0; ch < audioRing.getNumChannels(); ++ch)
+    {
+        if (ch < numChannelsIn)
+        {
+            audioRing.copyFrom(ch, position, block[ch], numBeforeWrap);
+            if (numBeforeWrap < numSamples)
+                audioRing.copyFrom(ch, 0, block[ch] + numBeforeWrap, numSamples - numBeforeWrap);
+        }
+        else
+        {
+            audioRing.clear(ch, position, numBeforeWrap);
+            if (numBeforeWrap < numSamples)
+                audioRing.clear(ch, 0, numSamples - numBeforeWrap);
+        }
+    }
+
+    numSamplesWritten.store(written + numSamples, std::memory_order_release);
+}
+
+void ReplayBuffer::readAudio(juce::int64 startSample, int numSamples,
+                             juce::AudioBuffer<float>& dest)
+{
+    dest.setSize(numChannels, numSamples);
+    dest.clear();
+
+    const int ringSamples = audioRing.getNumSamples();
+    if (ringSamples == 0)
+        return;
+
+    // Only what has been written and not yet overwritten
+    const auto written = numSamplesWritten.load(std::memory_order_acquire);
+    const auto first = std::max(startSample, written - ringSamples);
+    const auto end = std::min(startSample + numSamples, written);
+
+    for (auto s = first; s < end;)
+    {
+        const int position = (int)(s % ringSamples);
+        const int n = (int)std::min(end - s, (juce::int64)(ringSamples - position));
+
+        for (int ch = 0; ch < dest.getNumChannels(); ++ch)
+            dest.copyFrom(ch, (int)(s - startSample), audioRing, ch, position, n);
+
+        s += n;
+    }
+
+    // Anything the audio thread came round to while we were copying is
+    // damaged. The margin makes this very unlikely.
+    const auto overwritten = numSamplesWritten.load(std::memory_order_acquire) - ringSamples;
+    if (overwritten > first)
+    {
+        const auto damagedEnd = std::min(overwritten, end);
+        dest.clear((int)(first - startSample), (int)(damagedEnd - first));
+        juce::Logger::writeToLog("Replay: " + juce::String(damagedEnd - first)
+                                 + " audio samples were overwritten while saving");
+    }
+}
+
+//=============================================================================
+void ReplayBuffer::saveReplay(const juce::File& destination)
+{
+    if (!isRunning())
+    {
+        notifySaved(destination, false);
+        return;
+    }
+
+    const juce::ScopedLock sl(saveLock);
+    pendingSaves.add(destination);
+}
+
+ReplayBuffer::Stats ReplayBuffer::getStats() const
+{
+    Stats stats;
+    stats.numFrames = statsNumFrames.load(std::memory_order_relaxed);
+    stats.seconds = statsSeconds.load(std::memory_order_relaxed);
+    stats.numBytes = statsNumBytes.load(std::memory_order_relaxed);
+    stats.numMissing = numFramesMissing.load(std::memory_order_relaxed);
+
+    const auto numCompressed = statsNumCompressed.load(std::memory_order_relaxed);
+    if (numCompressed > 0)
+        stats.compressMs = 1000.0 * compressSeconds.load(std::memory_order_relaxed) / (double)numCompressed;
+
+    return stats;
+}
+
+//=============================================================================
+void ReplayBuffer::run()
+{
+    while (!threadShouldExit())
+    {
+        juce::Array<juce::File> saves;
+        {
+            const juce::ScopedLock sl(saveLock);
+            saves.swapWith(pendingSaves);
+        }
+
+        for (const auto& destination : saves)
+            takeSnapshot(destination);
+
+        if (!addQueuedFrames())
+        {
+            // No frame to add, sleep briefly
+            juce::Thread::sleep(1);
+        }
+    }
+
+    // Anything asked for after the last snapshot can't be saved now
+    const juce::ScopedLock sl(saveLock);
+    for (const auto& destination : pendingSaves)
+        notifySaved(destination, false);
+    pendingSaves.clear();
+}
+
+bool ReplayBuffer::addQueuedFrames()
+{
+    std::array<const uint8_t*, maxFramesPerRead> slots;
+    std::array<juce::int64, maxFramesPerRead> indices;
+    const int numFrames = frameQueue->acquireReadSlots(slots.data(), indices.data(),
+                                                       maxFramesPerRead);
+
+    if (numFrames == 0)
+        return false;
+
+    jassert(frameQueue->getFrameBytes() == settings.getFrameBytes());
+
+    for (int i = 0; i < numFrames; ++i)
+    {
+        const auto index = indices[(size_t)i];
+        if (index < nextFrameIndex)
+        {
+            jassertfalse; // Frames should arrive in order
+            continue;
+        }
+
+        numFramesMissing += index - nextFrameIndex;
+        addFrame(slots[(size_t)i], index);
+        nextFrameIndex = index + 1;
+    }
+
+    frameQueue->releaseReadSlots(numFrames);
+
+    trim();
+
+    statsNumFrames = (int)frames.size();
+    statsNumBytes = (juce::int64)numBytesHeld;
+    statsSeconds = frames.empty() ? 0.0
+                 : (double)(frames.back()->index - frames.front()->index + 1) / settings.fps;
+    return true;
+}
+
+void ReplayBuffer::addFrame(const uint8_t* frame, juce::int64 index)
+{
+    const auto startTicks = juce::Time::getHighResolutionTicks();
+    const int frameBytes = settings.getFrameBytes();
+
+    const bool isKeyFrame = numFramesAdded % keyFrameInterval == 0;
+    const uint8_t* source = frame;
+
+    if (!isKeyFrame)
+    {
+        // Unchanged pixels become zeros, which run-length encode well
+        for (int i = 0; i < frameBytes; ++i)
+            delta[i] = frame[i] ^ previous[i];
+        source = delta;
+    }
+
+    const int encodedBytes = FrameStore::encode(source, frameBytes, encoded);
+
+    auto stored = std::make_shared<Frame>();
+    stored->index = index;
+
+    if (encodedBytes >= frameBytes)
+    {
+        stored->type = Frame::raw;
+        stored->data.append(frame, (size_t)frameBytes);
+    }
+    else
+    {
+        stored->type = isKeyFrame ? Frame::key : Frame::delta;
+        stored->data.append(encoded, (size_t)encodedBytes);
+    }
+
+    std::memcpy(previous, frame, (size_t)frameBytes);
+    ++numFramesAdded;
+
+    numBytesHeld += stored->data.getSize();
+    frames.push_back(std::move(stored));
+
+    const double seconds = juce::Time::highResolutionTicksToSeconds(
+                               juce::Time::getHighResolutionTicks() - startTicks);
+    compressSeconds = compressSeconds.load(std::memory_order_relaxed) + seconds;
+    ++statsNumCompressed;
+
+    // If this keeps happening the frame queue fills up and frames are
+    // dropped, to be repeated when the replay is saved
+    if (seconds * settings.fps > 1.0)
+        RT_LOG("Replay: compressing frame {} took {} ms, longer than a frame",
+               index, seconds * 1000.0);
+}
+
+void ReplayBuffer::trim()
+{
+    auto isTooBig = [this]
+    {
+        return numBytesHeld > maxBytes
+            || frames.back()->index - frames.front()->index >= lengthFrames;
+    };
+
+    while (frames.size() > 1 && isTooBig())
+    {
+        // Drop up to the next frame that can be decoded on its own
+        do
+        {
+            numBytesHeld -= frames.front()->data.getSize();
+            frames.pop_front();
+        }
+        while (!frames.empty() && frames.front()->type == Frame::delta);
+    }
+
+    // A whole key frame interval was over the size limit. The frames
+    // after it would be deltas with nothing to decode them from, so the
+    // next one is made a key frame.
+    if (frames.empty())
+    {
+        RT_LOG("Replay: {} frames are more than the {} byte limit", keyFrameInterval, maxBytes);
+        numFramesAdded = 0;
+    }
+}
+
+//=============================================================================
+void ReplayBuffer::takeSnapshot(const juce::File& destination)
+{
+    if (frames.empty())
+    {
+        DBG("Replay: nothing to save yet");
+        notifySaved(destination, false);
+        return;
+    }
+
+    std::vector<FramePtr> snapshot(frames.begin(), frames.end());
+    jassert(snapshot.front()->type != Frame::delta);
+
+    // The audio that plays over the frames, by the capture clock
+    const auto startSample = (juce::int64)std::llround((double)snapshot.front()->index
+                                                       * sampleRate / settings.fps);
+    const auto endSample = (juce::int64)std::llround((double)(snapshot.back()->index + 1)
+                                                     * sampleRate / settings.fps);
+
+    auto audio = std::make_unique<juce::AudioBuffer<float>>();
+    readAudio(startSample, (int)(endSample - startSample), *audio);
+
+    DBG("Replay: saving " << (int)snapshot.size() << " frames to " << destination.getFullPathName());
+    savePool.addJob(new SaveJob(*this, destination, settings, sampleRate,
+                                std::move(snapshot), std::move(audio)), true);
+}
+
+void ReplayBuffer::notifySaved(const juce::File& file, bool ok)
+{
+    juce::Logger::writeToLog(ok ? "Replay saved to " + file.getFullPathName()
+                                : "Couldn't save the replay to " + file.getFullPathName());
+
+    juce::MessageManager::callAsync([self = selfReference, file, ok]
+    {
+        if (self != nullptr && self->onReplaySaved != nullptr)
+            self->onReplaySaved(file, ok);
+    });
+}
+
+//=============================================================================
+juce::ThreadPoolJob::JobStatus ReplayBuffer::SaveJob::runJob()
+{
+    const auto tempDir = juce::File::getSpecialLocation(juce::File::tempDirectory)
+                             .getChildFile("MoPanning");
+    tempDir.createDirectory();
+
+    const auto wavFile = tempDir.getNonexistentChildFile("replay_audio", ".wav", false);
+    const auto videoFile = tempDir.getNonexistentChildFile("replay_video", ".mp4", false);
+    const auto logFile = tempDir.getNonexistentChildFile("replay_encoder", ".log", false);
+
+    bool ok = writeAudio(wavFile) && encodeVideo(wavFile, videoFile, logFile);
+
+    if (ok)
+    {
+        destination.getParentDirectory().createDirectory();
+        ok = videoFile.moveFileTo(destination);
+    }
+    else if (!shouldExit())
+    {
+        juce::Logger::writeToLog("Replay encoding failed:\n"
+                                 + logFile.loadFileAsString().getLastCharacters(2000));
+    }
+
+    wavFile.deleteFile();
+    videoFile.deleteFile();
+    logFile.deleteFile();
+
+    parent.notifySaved(destination, ok);
+    return jobHasFinished;
+}
+
+bool ReplayBuffer::SaveJob::writeAudio(const juce::File& wavFile)
+{
+    auto options = AudioFormatWriterOptions()
+        .withSampleRate(sampleRate)
+        .withNumChannels(audio->getNumChannels())
+        .withBitsPerSample(24);
+
+    auto fileStream = wavFile.createOutputStream();
+    if (fileStream == nullptr || !fileStream->openedOk())
+        return false;
+
+    std::unique_ptr<OutputStream> outStream;
+    outStream.reset(fileStream.release());
+
+    juce::WavAudioFormat wav;
+    auto writer = wav.createWriterFor(outStream, options);
+
+    return writer != nullptr
+        && writer->writeFromAudioSampleBuffer(*audio, 0, audio->getNumSamples());
+}
+
+bool ReplayBuffer::SaveJob::encodeVideo(const juce::File& wavFile, const juce::File& videoFile,
+                                        const juce::File& logFile)
+{
+    juce::StringArray args;
+    args.add(VideoWriter::locateFFmpeg().getFullPathName());
+    args.add("-y");
+    args.add("-hide_banner");
+    args.add("-nostats");
+
+    // Input 0: raw frames on stdin
+    args.add("-f");             args.add("rawvideo");
+    args.add("-pixel_format");  args.add(settings.getFFmpegPixelFormat());
+    args.add("-video_size");    args.add(juce::String(settings.width) + "x" + juce::String(settings.height));
+    args.add("-framerate");     args.add(juce::String(settings.fps));
+    args.add("-i");             args.add("pipe:0");
+
+    // Input 1: WAV audio
+    args.add("-i");             args.add(wavFile.getFullPathName());
+
+    // CPU x264 or x265
+    args.add("-c:v");           args.add(settings.getFFmpegEncoder());
+    args.add("-preset");        args.add("slow");
+    args.add("-crf");           args.add(juce::String(settings.crf));
+    args.add("-pix_fmt");       args.add("yuv420p");
+    args.add("-tune");          args.add("grain");
+
+    if (settings.codec == CaptureSettings::hevc)
+    {
+        args.add("-tag:v");     args.add("hvc1");
+    }
+
+    args.add("-c:a");           args.add("aac");
+    args.add("-b:a");           args.add("320k");
+
+    args.add(videoFile.getFullPathName());
+
+    FFmpegPipe encoder;
+    if (!encoder.start(args, logFile))
+    {
+        DBG("Failed to start encoding the replay.");
+        return false;
+    }
+
+    const int frameBytes = settings.getFrameBytes();
+    juce::HeapBlock<uint8_t> frame((size_t)frameBytes), previous((size_t)frameBytes, true);
+    juce::int64 nextIndex = frames.front()->index;
+
+    for (const auto& stored : frames)
+    {
+        if (shouldExit())
+            return false; // The encoder is killed when it goes out of scope
+
+        // Repeat the last frame over any gap, so the video stays in sync
+        // with the audio
+        for (; nextIndex < stored->index; ++nextIndex)
+            if (!encoder.write(previous, (size_t)frameBytes))
+                return false;
+
+        if (!decodeFrame(*stored, previous, frame, frameBytes)
+            || !encoder.write(frame, (size_t)frameBytes))
+            return false;
+
+        std::memcpy(previous, frame, (size_t)frameBytes);
+        nextIndex = stored->index + 1;
+    }
+
+    return encoder.finish(encoderFinishTimeoutMs);
+}
+
+bool ReplayBuffer::SaveJob::decodeFrame(const Frame& frame, const uint8_t* previous,
+                                        uint8_t* dest, int frameBytes)
+{
+    const auto* data = static_cast<const uint8_t*>(frame.data.getData());
+    const int dataBytes = (int)frame.data.getSize();
+
+    switch (frame.type)
+    {
+        case Frame::raw:
+            if (dataBytes != frameBytes)
+                return false;
+            std::memcpy(dest, data, (size_t)frameBytes);
+            return true;
+
+        case Frame::key:
+            return FrameStore::decode(data, dataBytes, dest, frameBytes);
+
+        case Frame::delta:
+            if (!FrameStore::decode(data, dataBytes, dest, frameBytes))
+                return false;
+            for (int i = 0; i < frameBytes; ++i)
+                dest[i] ^= previous[i];
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,267 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+#include <deque>
+#include "Utils.h"
+#include "FrameQueue.h"
+#include "RTLogger.h"
+
+
+//=============================================================================
+/*  Keeps the last few seconds of capture frames and audio in memory, so
+    a moment can be saved after it has happened.
+
+    While it runs, a worker thread takes frames from the frame queue and
+    compresses them with the FrameStore codec (XOR with the frame before,
+    then run-length encoded, with a key frame every second) into a ring
+    held in RAM. The oldest second is dropped once the ring is longer
+    than the replay length or bigger than its memory cap, so the ring
+    always starts on a key frame. The audio goes into a ring of floats
+    that the audio thread writes without locking or allocating.
+
+    Saving takes a snapshot of both rings and encodes it with FFmpeg on
+    a background thread, so the live view carries on undisturbed. The
+    snapshot shares the compressed frames rather than copying them.
+*/
+class ReplayBuffer : private juce::Thread
+{
+public:
+    //=========================================================================
+    ReplayBuffer();
+    ~ReplayBuffer() override;
+
+    //=========================================================================
+    /*  Sets the audio format. It takes effect the next time the buffer
+        starts.
+    */
+    void prepare(double sampleRateIn, int numChannelsIn);
+
+    /*  Sets the pointer to the queue the capture frames arrive in.
+    */
+    void setFrameQueuePointer(FrameQueue* frameQueuePtr);
+
+    //=========================================================================
+    /*  Starts buffering frames in the given format, keeping up to
+        lengthSeconds of them in at most maxBytes. The frame queue must
+        already be allocated for the format, and the capture clock reset.
+    */
+    void start(const CaptureSettings& newSettings, int lengthSeconds, size_t maxBytes);
+
+    /*  Stops buffering and frees the frames. Saves in progress carry on.
+    */
+    void stop();
+
+    bool isRunning() const { return running.load(); }
+
+    //=========================================================================
+    /*  Adds a block of audio to the ring. Call it from the audio thread,
+        for the same samples that advance the capture clock. Channels the
+        block doesn't have are recorded as silence.
+    */
+    void enqueueAudioBlock(const float* const* block, int numChannelsIn, int numSamples);
+
+    //=========================================================================
+    /*  Saves what the buffer holds to destination as an .mp4, in the
+        background. onReplaySaved is called when it is done.
+    */
+    void saveReplay(const juce::File& destination);
+
+    /*  Called on the message thread when a replay has been saved, or
+        failed to be.
+    */
+    std::function<void(const juce::File& file, bool ok)> onReplaySaved;
+
+    //=========================================================================
+    /*  What the buffer holds, and what it costs.
+    */
+    struct Stats
+    {
+        int numFrames = 0;
+        double seconds = 0.0;
+        juce::int64 numBytes = 0;
+        double compressMs = 0.0; // Average per frame
+        juce::int64 numMissing = 0; // Dropped before reaching the buffer
+
+        juce::String toString() const
+        {
+            juce::String s;
+            s << "Replay: " << numFrames << " frames (" << juce::String(seconds, 1) << " s) in "
+              << juce::String(numBytes / 1.0e6, 1) << " MB, compressed in "
+              << juce::String(compressMs, 2) << " ms/frame, " << numMissing << " missing";
+            return s;
+        }
+    };
+
+    Stats getStats() const;
+
+private:
+    //=========================================================================
+    /*  One compressed frame. Frames are shared with the snapshots being
+        saved, so they are never changed once made.
+    */
+    struct Frame
+    {
+        enum Type : uint8_t { raw, key, delta };
+
+        juce::int64 index = 0; // In the capture, counted from start()
+        Type type = raw;
+        juce::MemoryBlock data;
+    };
+
+    using FramePtr = std::shared_ptr<const Frame>;
+
+    class SaveJob;
+
+    //=========================================================================
+    /*  Takes frames from the queue, compresses them into the ring and
+        handles requests to save, until the thread is stopped.
+    */
+    void run() override;
+
+    /*  Compresses any queued frames into the ring. Returns false if there
+        were none.
+    */
+    bool addQueuedFrames();
+    void addFrame(const uint8_t* frame, juce::int64 index);
+
+    /*  Drops whole seconds from the start of the ring until it fits in
+        the replay length and the memory cap.
+    */
+    void trim();
+
+    /*  Hands the ring's current contents, and the audio that goes with
+        them, to a SaveJob.
+    */
+    void takeSnapshot(const juce::File& destination);
+
+    /*  Copies numSamples of audio, from startSample samples after start(),
+        into dest. Any part that isn't in the ring is left silent.
+    */
+    void readAudio(juce::int64 startSample, int numSamples, juce::AudioBuffer<float>& dest);
+
+    void notifySaved(const juce::File& file, bool ok);
+
+    //=========================================================================
+    double sampleRate = 44100.0;
+    int numChannels = 2;
+
+    CaptureSettings settings; // Set via start()
+    juce::int64 lengthFrames = 0;
+    size_t maxBytes = 0;
+    int keyFrameInterval = 1;
+
+    std::atomic<bool> running { false };
+    FrameQueue* frameQueue = nullptr;
+
+    // The ring of frames, only used by the worker thread
+    std::deque<FramePtr> frames;
+    size_t numBytesHeld = 0;
+    juce::int64 numFramesAdded = 0;
+    juce::int64 nextFrameIndex = 0;
+    juce::HeapBlock<uint8_t> previous, delta, encoded;
+
+    // Copies for getStats()
+    std::atomic<int> statsNumFrames { 0 };
+    std::atomic<juce::int64> statsNumBytes { 0 };
+    std::atomic<double> statsSeconds { 0.0 };
+    std::atomic<double> compressSeconds { 0.0 };
+    std::atomic<juce::int64> statsNumCompressed { 0 };
+    std::atomic<juce::int64> numFramesMissing { 0 };
+
+    // The audio ring. The audio thread only tries the lock, so it never
+    // waits; it is only held for long when the ring is reallocated.
+    juce::AudioBuffer<float> audioRing;
+    std::atomic<juce::int64> numSamplesWritten { 0 };
+    juce::SpinLock audioLock;
+
+    // Extra audio kept beyond the replay length, so a snapshot can be
+    // copied before the audio thread comes round to overwrite it
+    static constexpr double audioMarginSeconds = 2.0;
+
+    // Save requests, from the message thread to the worker
+    juce::CriticalSection saveLock;
+    juce::Array<juce::File> pendingSaves;
+
+    juce::ThreadPool savePool { juce::ThreadPoolOptions{}
+                                    .withThreadName("ReplaySave")
+                                    .withNumberOfThreads(1)
+                                    .withDesiredThreadPriority(juce::Thread::Priority::low) };
+
+    juce::WeakReference<ReplayBuffer> selfReference; // For callbacks from other threads
+
+    static constexpr int maxFramesPerRead = 4;
+    static constexpr int saveShutdownTimeoutMs = 10000;
+
+    //=========================================================================
+    JUCE_DECLARE_WEAK_REFERENCEABLE(ReplayBuffer)
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ReplayBuffer)
+};
+
+
+//=============================================================================
+/*  Encodes a snapshot of the replay buffer into an .mp4.
+
+    It writes the audio to a temp WAV, then decompresses the frames into
+    FFmpeg, repeating the last frame over any gap so the video stays in
+    sync with the audio, and moves the result to the destination.
+*/
+class ReplayBuffer::SaveJob : public juce::ThreadPoolJob
+{
+public:
+    //=========================================================================
+    SaveJob(ReplayBuffer& rb, const juce::File& dest, const CaptureSettings& s,
+            double rate, std::vector<FramePtr> snapshot, 
+            std::unique_ptr<juce::AudioBuffer<float>> snapshotAudio)
+        : juce::ThreadPoolJob("Save replay"), parent(rb), destination(dest), 
+          settings(s), sampleRate(rate), frames(std::move(snapshot)), 
+          audio(std::move(snapshotAudio))
+    {
+    }
+
+    JobStatus runJob() override;
+
+private:
+    //=========================================================================
+    bool writeAudio(const juce::File& wavFile);
+    bool encodeVideo(const juce::File& wavFile, const juce::File& videoFile,
+                     const juce::File& logFile);
+
+    /*  Decompresses a frame into dest. previous must hold the frame 
+        before it, for delta frames.
+    */
+    static bool decodeFrame(const Frame& frame, const uint8_t* previous, 
+                            uint8_t* dest, int frameBytes);
+
+    //=========================================================================
+    ReplayBuffer& parent;
+    const juce::File destination;
+    const CaptureSettings settings;
+    const double sampleRate;
+    const std::vector<FramePtr> frames;
+    const std::unique_ptr<juce::AudioBuffer<float>> audio;
+
+    static constexpr int encoderFinishTimeoutMs = 60000;
+
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SaveJob)
+};
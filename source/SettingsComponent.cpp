@@ -107,10 +107,10 @@ SettingsComponent::SettingsComponent(MainController& c) : controller(c)
     tabs->setOutline(0);                 // removes border
     tabs->setIndent(10);                 // optional padding
 
-    // Set up device selector--max 16 input channels, 2 output channels
+    // Set up device selector--max 64 input channels, 2 output channels
     ioPage->deviceSelector = std::make_unique<CustomAudioDeviceSelectorComponent>(
         controller.getDeviceManager(),
-        2, 16, 2, 2,
+        1, 64, 2, 2,
         false, false, true, true);
 
     ioPage->deviceSelector.get()->onHeightChanged = [this]()
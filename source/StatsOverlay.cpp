@@ -0,0 +1,89 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#include "StatsOverlay.h"
+
+
+//=============================================================================
+StatsOverlay::StatsOverlay()
+{
+    setInterceptsMouseClicks(false, false);
+}
+
+void StatsOverlay::setTextSource(std::function<juce::String()> source)
+{
+    textSource = std::move(source);
+}
+
+//=============================================================================
+void StatsOverlay::paint(juce::Graphics& g)
+{
+    if (text.isEmpty())
+        return;
+
+    juce::Font font(juce::FontOptions(juce::Font::getDefaultMonospacedFontName(), 12.0f, 0));
+    g.setFont(font);
+
+    // Size the background box to the text
+    auto lines = juce::StringArray::fromLines(text);
+    float width = 0.0f;
+    for (auto& line : lines)
+        width = std::max(width, juce::GlyphArrangement::getStringWidth(font, line));
+
+    auto box = juce::Rectangle<float>(8.0f, 8.0f, width + 16.0f, 
+                                      lines.size() * font.getHeight() + 12.0f);
+
+    g.setColour(juce::Colours::black.withAlpha(0.6f));
+    g.fillRoundedRectangle(box, 4.0f);
+
+    g.setColour(juce::Colours::lightgrey);
+    g.drawMultiLineText(text, (int)box.getX() + 8, 
+                        (int)(box.getY() + 6.0f + font.getAscent()), 
+                        (int)width + 1);
+}
+
+void StatsOverlay::visibilityChanged()
+{
+    // Only poll while visible
+    if (isVisible())
+    {
+        timerCallback();
+        startTimerHz(refreshRateHz);
+    }
+    else
+    {
+        stopTimer();
+    }
+}
+
+//=============================================================================
+void StatsOverlay::timerCallback()
+{
+    if (textSource == nullptr)
+        return;
+
+    auto newText = textSource();
+    if (newText != text)
+    {
+        text = newText;
+        repaint();
+    }
+}
@@ -0,0 +1,59 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+
+
+//=============================================================================
+/*  A text overlay showing performance stats on top of the visualization.
+
+    The overlay polls its text source a few times a second while it is
+    visible, so nothing has to push stats to it.
+*/
+class StatsOverlay : public juce::Component,
+                     private juce::Timer
+{
+public:
+    //=========================================================================
+    StatsOverlay();
+    ~StatsOverlay() override = default;
+
+    /*  Sets the function that returns the text to show. It is called on
+        the message thread.
+    */
+    void setTextSource(std::function<juce::String()> source);
+
+    void paint(juce::Graphics& g) override;
+    void visibilityChanged() override;
+
+private:
+    //=========================================================================
+    void timerCallback() override;
+
+    std::function<juce::String()> textSource;
+    juce::String text;
+
+    static constexpr int refreshRateHz = 4;
+
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(StatsOverlay)
+};
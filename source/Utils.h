@@ -21,21 +21,111 @@
 
 #pragma once
 
-/*  This file holds enums and constants that all MoPanning files can use.
+/*  This file holds the enums, constants and small shared types that all
+    MoPanning files can use: the recording format (CaptureSettings) and
+    the clock that times recorded frames (CaptureClock), the analysis
+    results passed from the analyzer to the visualizer, and the settings
+    enums.
 */
 
 //=============================================================================
 namespace Constants
 {
     constexpr int maxTracks = 8;
-
-    // Video recording settings
-    constexpr int W = 1920;
-    constexpr int H = 1080;
-    constexpr int FPS = 60;
-    constexpr int frameBytes = W * H * 3;
+    constexpr int maxCaptureTargets = 4; // Videos recorded at once
 }
 
+//=============================================================================
+/*  The format of a video recording, chosen when recording starts.
+*/
+struct CaptureSettings
+{
+    /*  The format frames are read back from the GPU in. yuv420p is 
+        converted on the GPU and is half the size of rgb24. It needs an
+        even width and height, as does the encoder's output format.
+    */
+    enum PixelFormat { rgb24, yuv420p };
+
+    /*  What to do when the frame queue is full. Either way each frame 
+        carries its index, so the writer sees any gap.
+
+        duplicateLast: drop the frame, and the writer repeats the last
+        frame in its place so the video stays in sync with the audio.
+        blockWithTimeout: make the GL thread wait up to blockTimeoutMs 
+        for room, then fall back to duplicateLast.
+        logGap: drop the frame and only log the gap, so the video ends
+        up shorter than the audio. For diagnosing the capture path.
+    */
+    enum GapPolicy { duplicateLast, blockWithTimeout, logGap };
+
+    /*  The encoder the video is compressed with. hevc is about half the
+        size at the same quality, but slower to encode and to play.
+    */
+    enum VideoCodec { h264, hevc };
+
+    int width = 1920;
+    int height = 1080;
+    int fps = 60;
+    int queueDepth = 8; // Frames buffered between the GL thread and the writer
+    bool liveEncode = true; // Encode while recording, rather than after
+    bool compressFrames = true; // Compress frames kept on disk to encode after
+    PixelFormat pixelFormat = yuv420p;
+    GapPolicy gapPolicy = duplicateLast;
+    int blockTimeoutMs = 20;
+    int segmentSeconds = 60; // Length of the pieces the video is written in
+    bool elideUnchangedFrames = true; // Leave out frames identical to the one before
+    bool floatAudio = false; // 32 bit float WAV rather than 24 bit
+    VideoCodec codec = h264;
+    int crf = 18; // Encoder quality, lower is better
+
+    int getFrameBytes() const
+    {
+        return pixelFormat == yuv420p ? width * height * 3 / 2 // Planar Y, U, V
+                                      : width * height * 3;
+    }
+
+    /*  Returns the name FFmpeg uses for the pixel format.
+    */
+    const char* getFFmpegPixelFormat() const
+    {
+        return pixelFormat == yuv420p ? "yuv420p" : "rgb24";
+    }
+
+    /*  Returns the name of the FFmpeg encoder for the codec.
+    */
+    const char* getFFmpegEncoder() const
+    {
+        return codec == hevc ? "libx265" : "libx264";
+    }
+};
+
+/*  The clock that capture frames are timed by: the number of audio 
+    samples written to the current recording. The audio thread advances
+    it and the GL thread reads it.
+*/
+struct CaptureClock
+{
+    void reset(double newSampleRate)
+    {
+        sampleRate.store(newSampleRate);
+        samplesRecorded.store(0);
+    }
+
+    void advance(int numSamples)
+    {
+        samplesRecorded.fetch_add(numSamples, std::memory_order_relaxed);
+    }
+
+    double getSeconds() const
+    {
+        const double rate = sampleRate.load(std::memory_order_relaxed);
+        return rate > 0.0 ? (double)samplesRecorded.load(std::memory_order_relaxed) / rate : 0.0;
+    }
+
+    std::atomic<int64_t> samplesRecorded { 0 };
+    std::atomic<double> sampleRate { 0.0 };
+};
+
 //=============================================================================
 /*  Contains the data ascociated with one frequency band. 
 */
@@ -53,6 +143,7 @@ struct TrackSlot
 {
     std::array<std::vector<FrequencyBand>, 2> buffers;
     std::atomic<int> activeIndex { 0 }; // Which buffer the reader should use
+    std::atomic<uint32_t> generation { 0 }; // Bumped when a new buffer is published
 };
 
 
@@ -21,6 +21,20 @@
 
 #include "VideoWriter.h"
 
+//=============================================================================
+VideoWriter::VideoWriter()
+{
+    selfReference = this;
+}
+
+VideoWriter::~VideoWriter()
+{
+    // Cancel any exports still running; their temp files go with them
+    exportPool.removeAllJobs(true, exportShutdownTimeoutMs);
+    segmentPool.removeAllJobs(true, exportShutdownTimeoutMs);
+    masterReference.clear();
+}
+
 //=============================================================================
 void VideoWriter::prepare(double newSampleRate, int newSamplesPerBlock, int newNumChannels)
 {
@@ -31,14 +45,58 @@ void VideoWriter::prepare(double newSampleRate, int newSamplesPerBlock, int newN
 }
 
 //=============================================================================
-void VideoWriter::start()
+void VideoWriter::start(const CaptureSettings& newCaptureSettings, std::shared_ptr<Take> take)
 {
-    // Set up the video output stream
-    framesOut = std::make_unique<juce::FileOutputStream>(rawFrames);
-    jassert(framesOut != nullptr && framesOut->openedOk());
-
-    // Initialize the WAV writer for audio capture
-    startWavWriter();
+    jassert(take != nullptr); // The video would have no audio
+
+    captureSettings = newCaptureSettings;
+    videoBytesWritten = 0;
+    frameCount = 0;
+    nextFrameIndex = 0;
+    timelineShift = 0;
+    numFramesMissing = 0;
+    numFramesFilled = 0;
+    numFramesElided = 0;
+    lastFrameHash = 0;
+    lastWrittenIndex = -1;
+    lastCoveredIndex = -1;
+
+    // Give the recording its own temp directory, so it can be exported 
+    // while the next one is being recorded
+    auto directory = juce::File::getSpecialLocation(juce::File::tempDirectory)
+                         .getChildFile("MoPanning")
+                         .getNonexistentChildFile("recording_" 
+                             + juce::Time::getCurrentTime().formatted("%Y%m%d_%H%M%S"), 
+                             "", false);
+
+    if (!directory.createDirectory())
+        DBG("Couldn't create " + directory.getFullPathName());
+
+    session = std::make_shared<Session>(directory);
+    session->take = std::move(take);
+    session->settings = captureSettings;
+    session->encodedLive = captureSettings.liveEncode;
+    session->storedCompressed = !captureSettings.liveEncode && captureSettings.compressFrames;
+
+    segmentIndex = 0;
+    segmentStartIndex = 0;
+    framesPerSegment = std::max((juce::int64)captureSettings.segmentSeconds * captureSettings.fps, 
+                                (juce::int64)1);
+    stopRequested = false;
+
+    // Until the rate the disk fills up can be measured, assume frames on
+    // disk take their full size and encoded video a tenth of that
+    const double rawBytesPerSecond = (double)captureSettings.getFrameBytes() * captureSettings.fps;
+    bytesPerSecond = (captureSettings.liveEncode || captureSettings.compressFrames) 
+                   ? rawBytesPerSecond / 10.0 : rawBytesPerSecond;
+    bytesPerSecond += (double)sampleRate * numChannels * 3; // 24 bit WAV
+
+    lastFreeBytes = directory.getBytesFreeOnVolume();
+    lastFreeBytesMs = juce::Time::getMillisecondCounterHiRes();
+
+    // Set up the first segment's video output. If there isn't room, the
+    // recording is stopped again straight away.
+    startSegment();
 
     // Start the video worker thread
     videoWorkerThread = std::make_unique<Worker>(*this);
@@ -53,39 +111,34 @@ void VideoWriter::stop()
     if (videoWorkerThread != nullptr)
         videoWorkerThread->stopThread(-1);
 
-    if (framesOut != nullptr)
+    // The recording may have ended on frames left out as unchanged
+    if (frameQueue != nullptr)
     {
-        framesOut->flush();
-        framesOut.reset();
-    }
+        if (!closeHeldFrame(frameQueue->getHeldSlot()))
+            DBG("Couldn't write the last video frame");
 
-    // Unpublish the WAV writer so the audio thread stops using it
-    auto* tw = wavWriterPtr.exchange(nullptr, std::memory_order_acq_rel);
+        frameQueue->releaseHeldSlot();
+    }
 
-    // Destroy the ThreadedWriter and finalize the .wav header
-    wavWriter.reset();
+    finishSegment();
 
-    // Stop the audio worker thread
-    if (wavThread != nullptr)
-        wavThread->stopThread(-1);
+    if (recording)
+        juce::Logger::writeToLog(getStats().toString());
 
-    // Finalize and save the completed video in a user-specified location
-    if (recording == true)
+    // Hand the recording over to be saved. The last segments may still
+    // be being finished; the export waits for them.
+    if (recording && session != nullptr)
     {
-        juce::File outputLocation = promptUserForSaveLocation();
-        if (outputLocation.getFileName().isEmpty() == false)
-        {
-            runFFmpeg(outputLocation);
-        }
-    }
+        session->numFrames = frameCount.load();
+        session->lengthInFrames = nextFrameIndex;
 
-    // Clean up temporary files
-    if (rawFrames.existsAsFile())
-        rawFrames.deleteFile();
-    
-    if (wavAudio.existsAsFile())
-        wavAudio.deleteFile();
+        if (session->numFrames > 0)
+            chooseDestination(session);
+        else
+            session->cancelled = true; // Nothing to save
+    }
 
+    session.reset();
     recording = false;
 }
 
@@ -96,21 +149,14 @@ void VideoWriter::setFrameQueuePointer(FrameQueue* frameQueuePtr)
 }
 
 //=============================================================================
-void VideoWriter::enqueueAudioBlock(const float* const* newBlock, int numSamples)
+VideoWriter::Stats VideoWriter::getStats() const
 {
-    // Ensure the WAV writer is ready and we have valid data
-    auto* tw = wavWriterPtr.load(std::memory_order_acquire);
-    if (tw == nullptr || numSamples <= 0 || numChannels <= 0) return;
-
-    jassert(audioTmp.getNumChannels() == numChannels || audioTmp.getNumSamples() >= numSamples);
-
-    // Copy non-interleaved device data into our stable buffer
-    for (int ch = 0; ch < numChannels; ++ch)
-        juce::FloatVectorOperations::copy(audioTmp.getWritePointer(ch),
-                                          newBlock[ch], numSamples);
-
-    // Queue it to the background writer
-    tw->write(audioTmp.getArrayOfReadPointers(), numSamples);
+    Stats stats;
+    stats.numWritten = frameCount.load(std::memory_order_relaxed);
+    stats.numMissing = numFramesMissing.load(std::memory_order_relaxed);
+    stats.numFilled = numFramesFilled.load(std::memory_order_relaxed);
+    stats.numElided = numFramesElided.load(std::memory_order_relaxed);
+    return stats;
 }
 
 //=============================================================================
@@ -148,30 +194,386 @@ void VideoWriter::getFFmpegVersion()
 //=============================================================================
 bool VideoWriter::dequeueVideoFrame()
 {
-    // Get the buffer data from the FIFO
-    const uint8_t* data = frameQueue->readNextBuffer();
+    // Take as many queued frames as we can write in one go
+    std::array<const uint8_t*, maxFramesPerWrite> frames;
+    std::array<juce::int64, maxFramesPerWrite> indices;
+    const int numFrames = frameQueue->acquireReadSlots(frames.data(), indices.data(), 
+                                                       maxFramesPerWrite);
 
-    if (data == nullptr)
+    if (numFrames == 0)
     {
         // No frame available
         return false; 
     }
 
-    // Write the RGB24 frame
-    framesOut->write(data, (size_t)Constants::frameBytes);
-    frameQueue->finishRead();
+    // Discard frames while waiting for the recording to be stopped,
+    // first writing out any held back as unchanged
+    if (stopRequested.load())
+    {
+        closeHeldFrame(frameQueue->getHeldSlot());
+        frameQueue->releaseReadSlots(numFrames);
+        return true;
+    }
+
+    // Write the frames straight from the queue's storage. The last
+    // frame of the previous batch is still held in the queue.
+    bool failed = false;
+    const uint8_t* previous = frameQueue->getHeldSlot();
 
-    if (framesOut->getStatus().failed())
+    for (int i = 0; i < numFrames && !failed; ++i)
     {
-        DBG("framesOut write failed");
+        const auto index = indices[(size_t)i];
+        if (index < nextFrameIndex)
+        {
+            jassertfalse; // Frames should arrive in order
+            continue;
+        }
+
+        failed = !fillGap(index - nextFrameIndex, previous)
+              || !addFrame(frames[(size_t)i], previous, index - timelineShift);
+        nextFrameIndex = index + 1;
+        previous = frames[(size_t)i];
+    }
+
+    // Hold on to the last frame in case it has to be repeated
+    const bool keepLast = !failed && (captureSettings.gapPolicy != CaptureSettings::logGap 
+                                      || captureSettings.elideUnchangedFrames);
+    frameQueue->releaseReadSlots(numFrames, keepLast);
+
+    if (failed)
+    {
+        RT_LOG("Video frame write failed");
+        requestStop("Video frames couldn't be written.");
         return false;
     }
 
-    videoBytesWritten += Constants::frameBytes;
-    ++frameCount;
     return true;
 }
 
+bool VideoWriter::addFrame(const uint8_t* frame, const uint8_t* previous, juce::int64 timelineIndex)
+{
+    if (isUnchanged(frame, timelineIndex))
+    {
+        lastCoveredIndex = timelineIndex;
+        ++numFramesElided;
+        return true;
+    }
+
+    return writeFrame(frame, previous, timelineIndex);
+}
+
+bool VideoWriter::writeFrame(const uint8_t* frame, const uint8_t* previous, juce::int64 timelineIndex)
+{
+    // Move on to the next segment once this one is full. The next one 
+    // starts where this one ends, so no time is lost between them.
+    if (segmentOpen && timelineIndex >= segmentStartIndex + framesPerSegment)
+    {
+        if (!closeHeldFrame(previous))
+            return false;
+
+        finishSegment();
+        ++segmentIndex;
+        segmentStartIndex = std::max(lastCoveredIndex + 1, segmentStartIndex + framesPerSegment);
+        startSegment();
+    }
+
+    if (!segmentOpen)
+        return false;
+
+    return writeToSegment(frame, timelineIndex);
+}
+
+bool VideoWriter::writeToSegment(const uint8_t* frame, juce::int64 timelineIndex)
+{
+    const int frameBytes = captureSettings.getFrameBytes();
+    const auto indexInSegment = timelineIndex - segmentStartIndex;
+    bool ok;
+
+    if (liveEncoder != nullptr)
+    {
+        blockHeader.reset();
+        frameStream->writeBlockHeader(blockHeader, indexInSegment);
+        ok = liveEncoder->write(blockHeader.getData(), blockHeader.getDataSize())
+          && liveEncoder->write(frame, (size_t)frameBytes);
+    }
+    else if (frameStoreOut != nullptr)
+    {
+        ok = frameStoreOut->write(frame, indexInSegment);
+    }
+    else
+    {
+        frameStream->writeBlockHeader(*framesOut, indexInSegment);
+        ok = framesOut->write(frame, (size_t)frameBytes) && !framesOut->getStatus().failed();
+    }
+
+    if (ok)
+    {
+        videoBytesWritten += frameBytes;
+        ++frameCount;
+        lastWrittenIndex = timelineIndex;
+        lastCoveredIndex = timelineIndex;
+    }
+
+    return ok;
+}
+
+bool VideoWriter::closeHeldFrame(const uint8_t* previous)
+{
+    if (!segmentOpen || previous == nullptr || lastCoveredIndex <= lastWrittenIndex)
+        return true;
+
+    return writeToSegment(previous, lastCoveredIndex);
+}
+
+bool VideoWriter::isUnchanged(const uint8_t* frame, juce::int64 timelineIndex)
+{
+    if (!captureSettings.elideUnchangedFrames)
+        return false;
+
+    const auto hash = hashFrame(frame, captureSettings.getFrameBytes());
+    const bool sameAsLast = hash == lastFrameHash;
+    lastFrameHash = hash;
+
+    // Each segment starts with a frame of its own, and a frame is never
+    // held for too long
+    return sameAsLast
+        && segmentOpen
+        && lastWrittenIndex >= segmentStartIndex
+        && timelineIndex < segmentStartIndex + framesPerSegment
+        && timelineIndex - lastWrittenIndex < (juce::int64)maxHeldSeconds * captureSettings.fps;
+}
+
+/*  FNV-1a over 64 bit words rather than bytes, so it runs at close to
+    memory speed. A collision would only hold a frame that changed, for
+    at most maxHeldSeconds.
+*/
+juce::uint64 VideoWriter::hashFrame(const uint8_t* frame, int numBytes)
+{
+    constexpr juce::uint64 prime = 0x100000001b3ull;
+    juce::uint64 hash = 0xcbf29ce484222325ull;
+
+    const int numWords = numBytes / (int)sizeof(juce::uint64);
+    for (int i = 0; i < numWords; ++i)
+    {
+        juce::uint64 word;
+        std::memcpy(&word, frame + (size_t)i * sizeof(juce::uint64), sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+
+    for (int i = numWords * (int)sizeof(juce::uint64); i < numBytes; ++i)
+        hash = (hash ^ frame[i]) * prime;
+
+    return hash;
+}
+
+bool VideoWriter::fillGap(juce::int64 numMissing, const uint8_t* previous)
+{
+    if (numMissing <= 0)
+        return true;
+
+    numFramesMissing += numMissing;
+
+    if (captureSettings.gapPolicy == CaptureSettings::logGap || previous == nullptr)
+    {
+        RT_LOG("Video frames {} to {} are missing", nextFrameIndex, nextFrameIndex + numMissing - 1);
+
+        if (captureSettings.gapPolicy == CaptureSettings::logGap)
+            timelineShift += numMissing;
+
+        return true;
+    }
+
+    // Repeat the last frame so everything after stays in sync. When 
+    // unchanged frames are left out, this just holds it for longer.
+    for (juce::int64 i = 0; i < numMissing; ++i)
+    {
+        if (!addFrame(previous, previous, nextFrameIndex + i - timelineShift))
+            return false;
+
+        ++numFramesFilled;
+    }
+
+    RT_LOG("Video frames {} to {} were dropped, repeated the last frame", 
+           nextFrameIndex, nextFrameIndex + numMissing - 1);
+    return true;
+}
+
+//=============================================================================
+bool VideoWriter::startLiveEncoder(const juce::File& output, const juce::File& logFile)
+{
+    juce::File ffExecutable = locateFFmpeg();
+
+    juce::StringArray args;
+    args.add(ffExecutable.getFullPathName());
+    args.add("-y");
+    args.add("-hide_banner");
+    args.add("-nostats");
+
+    // Input: raw frames on stdin, with their timestamps
+    args.add("-f");             args.add("matroska");
+    args.add("-i");             args.add("pipe:0");
+
+    // Keep the timestamps rather than filling in left out frames
+    args.add("-fps_mode");      args.add("passthrough");
+
+    // CPU x264 or x265, with a preset fast enough to keep up in real time
+    args.add("-c:v");           args.add(captureSettings.getFFmpegEncoder());
+    args.add("-preset");        args.add("veryfast");
+    args.add("-crf");           args.add(juce::String(captureSettings.crf));
+    args.add("-pix_fmt");       args.add("yuv420p");
+    args.add("-tune");          args.add("grain");
+
+    // Matroska, since it stays readable if the encoder is cut off
+    args.add(output.getFullPathName());
+
+    liveEncoder = std::make_unique<FFmpegPipe>();
+    if (!liveEncoder->start(args, logFile))
+    {
+        DBG("Couldn't start the live encoder");
+        liveEncoder.reset();
+        return false;
+    }
+
+    blockHeader.reset();
+    frameStream->writeHeader(blockHeader);
+    return liveEncoder->write(blockHeader.getData(), blockHeader.getDataSize());
+}
+
+//=============================================================================
+bool VideoWriter::startSegment()
+{
+    if (!hasRoomForSegment())
+    {
+        requestStop("The disk is nearly full. Everything recorded so far has been kept.");
+        return false;
+    }
+
+    auto& s = *session;
+    frameStream = std::make_unique<RawMatroskaStream>(captureSettings);
+
+    if (s.encodedLive 
+        && !startLiveEncoder(s.getSegmentFile(segmentIndex, ".mkv"), 
+                             s.getSegmentFile(segmentIndex, ".log")))
+    {
+        if (segmentIndex > 0)
+        {
+            requestStop("The encoder couldn't be started for the next segment.");
+            return false;
+        }
+
+        // Fall back to frames on disk for the whole recording
+        DBG("Writing frames to disk to encode in the background instead");
+        s.encodedLive = false;
+        s.storedCompressed = captureSettings.compressFrames;
+    }
+
+    if (s.storedCompressed)
+    {
+        const auto file = s.getSegmentFile(segmentIndex, ".mpfs");
+        frameStoreOut = std::make_unique<FrameStore::Writer>();
+        if (!frameStoreOut->open(file, captureSettings))
+        {
+            frameStoreOut.reset();
+            requestStop("Couldn't create " + file.getFullPathName());
+            return false;
+        }
+    }
+    else if (!s.encodedLive)
+    {
+        const auto file = s.getSegmentFile(segmentIndex, ".raw");
+        framesOut = std::make_unique<juce::FileOutputStream>(file);
+        if (!framesOut->openedOk())
+        {
+            framesOut.reset();
+            requestStop("Couldn't create " + file.getFullPathName());
+            return false;
+        }
+
+        frameStream->writeHeader(*framesOut);
+    }
+
+    segmentOpen = true;
+    return true;
+}
+
+void VideoWriter::finishSegment()
+{
+    if (!segmentOpen)
+        return;
+
+    segmentOpen = false;
+
+    // The live encoder finishes the frames it has in the background
+    if (liveEncoder != nullptr)
+        liveEncoder->closeInput();
+
+    if (framesOut != nullptr)
+    {
+        framesOut->flush();
+        framesOut.reset();
+    }
+
+    if (frameStoreOut != nullptr)
+    {
+        frameStoreOut->close();
+        juce::Logger::writeToLog(frameStoreOut->getStats().toString());
+        frameStoreOut.reset();
+    }
+
+    frameStream.reset();
+
+    session->numSegments = segmentIndex + 1;
+    ++session->numSegmentsPending;
+    segmentPool.addJob(new SegmentJob(session, segmentIndex, std::move(liveEncoder)), true);
+}
+
+bool VideoWriter::hasRoomForSegment()
+{
+    const auto freeBytes = session->directory.getBytesFreeOnVolume();
+    const double nowMs = juce::Time::getMillisecondCounterHiRes();
+
+    // Measure how fast the disk is filling up from the space used since 
+    // the last segment started, which counts everything the recording 
+    // writes. Space freed by encoded segments makes this an underestimate,
+    // so keep the last rate if it went the other way.
+    const double seconds = (nowMs - lastFreeBytesMs) / 1000.0;
+    if (segmentIndex > 0 && seconds > 0.0 && freeBytes < lastFreeBytes)
+        bytesPerSecond = (double)(lastFreeBytes - freeBytes) / seconds;
+
+    lastFreeBytes = freeBytes;
+    lastFreeBytesMs = nowMs;
+
+    // Joining the segments at the end needs as much space again
+    juce::int64 encodedBytes = 0;
+    for (const auto& f : session->directory.findChildFiles(juce::File::findFiles, false, "segment_*.mkv"))
+        encodedBytes += f.getSize();
+
+    const double neededBytes = bytesPerSecond * captureSettings.segmentSeconds * diskSafetyFactor
+                             + (double)encodedBytes + (double)minFreeBytes;
+
+    if ((double)freeBytes >= neededBytes)
+        return true;
+
+    juce::Logger::writeToLog("Recording needs " + juce::File::descriptionOfSizeInBytes((juce::int64)neededBytes)
+                             + " for the next segment, but only " 
+                             + juce::File::descriptionOfSizeInBytes(freeBytes) + " is free");
+    return false;
+}
+
+void VideoWriter::requestStop(const juce::String& reason)
+{
+    if (stopRequested.exchange(true))
+        return;
+
+    juce::Logger::writeToLog("Stopping the recording: " + reason);
+
+    juce::MessageManager::callAsync([self = selfReference, reason]
+    {
+        if (self != nullptr && self->recording && self->onStopRequested != nullptr)
+            self->onStopRequested(reason);
+    });
+}
+
 //=============================================================================
 juce::File VideoWriter::locateFFmpeg()
 {
@@ -191,187 +593,406 @@ juce::File VideoWriter::locateFFmpeg()
 }
 
 //=============================================================================
-void VideoWriter::startWavWriter()
+void VideoWriter::setExportProgressCallback(std::function<void(const ExportProgress&)> callback)
 {
-    const unsigned int bitsPerSample = 24;
-
-    auto options = AudioFormatWriterOptions()
-        .withSampleRate((double)sampleRate)
-        .withNumChannels(numChannels)
-        .withBitsPerSample((int)bitsPerSample);
-
-    auto fileStream = wavAudio.createOutputStream();
-    jassert(fileStream && fileStream->openedOk());
+    exportProgressCallback = std::move(callback);
+}
 
-    std::unique_ptr<OutputStream> outStream;
-    outStream.reset(fileStream.release());
+void VideoWriter::cancelExports()
+{
+    DBG("Cancelling " << numPendingExports.load() << " video exports.");
+    exportPool.removeAllJobs(true, exportShutdownTimeoutMs);
+}
 
-    juce::WavAudioFormat wav;
-    auto rawWriter = wav.createWriterFor(outStream, options);
-    jassert(rawWriter != nullptr);
+//=============================================================================
+void VideoWriter::chooseDestination(std::shared_ptr<Session> finished)
+{
+    ++numPendingExports;
 
-    if (wavThread == nullptr)
-        wavThread = std::make_unique<juce::TimeSliceThread>("WavWriterThread");
-    
-    wavThread->startThread();
+    auto take = finished->take;
+    if (take->destination != juce::File())
+    {
+        // Another video of the take has already been given a place
+        finished->destination = getCompanionFile(take->destination, finished->settings);
+        enqueueExport(finished);
+        return;
+    }
 
-    const int fifoSamples = (int)juce::roundToInt(sampleRate * 0.2); // 200 ms
-    wavWriter = std::make_unique<juce::AudioFormatWriter::ThreadedWriter>(
-        rawWriter.release(),
-        *wavThread,
-        fifoSamples);
+    // The other writers recording the same take stop at the same time,
+    // so their videos wait for the same choice
+    take->waiting.emplace_back(selfReference, finished);
+    ++numAwaitingDestination;
 
-    // Publish the raw pointer for the audio callback (fast nullptr check)
-    wavWriterPtr.store(wavWriter.get(), std::memory_order_release);
+    if (take->isChoosing)
+        return;
 
-    // Prepare temporary buffer for audio blocks
-    audioTmp.setSize(numChannels, samplesPerBlock);
-}
+    take->isChoosing = true;
 
-//=============================================================================
-juce::File VideoWriter::promptUserForSaveLocation()
-{
     auto chooser = std::make_shared<juce::FileChooser>(
         "Save Video As...",
         juce::File::getSpecialLocation(juce::File::userDesktopDirectory)
             .getChildFile("mopanning_output.mp4"),
         "*.mp4");
 
-    /*  Asynchronous version - this would be better, but would need more 
-        refactoring to handle the async nature of the callback properly.
-    
-    auto flags = juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles;
+    const auto flags = juce::FileBrowserComponent::saveMode 
+                     | juce::FileBrowserComponent::canSelectFiles
+                     | juce::FileBrowserComponent::warnAboutOverwriting;
+
+    // The chooser keeps itself alive until the user makes a choice, and 
+    // the writers may be gone by then
+    chooser->launchAsync(flags, [chooser, take](const juce::FileChooser& fc)
+    {
+        auto destination = fc.getResult();
+        auto waiting = std::move(take->waiting);
+        take->waiting.clear();
+        take->isChoosing = false;
+        take->destination = destination;
+
+        for (size_t i = 0; i < waiting.size(); ++i)
+        {
+            auto& [self, video] = waiting[i];
+
+            if (self == nullptr)
+            {
+                video->cancelled = true;
+                continue;
+            }
+
+            --self->numAwaitingDestination;
+
+            if (destination == juce::File())
+            {
+                // Discarded, the temp files go with the session
+                DBG("Recording discarded.");
+                video->cancelled = true;
+                --self->numPendingExports;
+                self->reportProgress({}, 1.0, "Discarded");
+                continue;
+            }
+
+            video->destination = i == 0 ? destination 
+                                           : getCompanionFile(destination, video->settings);
+            self->enqueueExport(video);
+        }
+    });
+}
 
-    // Launch an asynchronous dialog window
-    chooser->launchAsync(flags, [this, chooser](const juce::FileChooser& fc)
+juce::File VideoWriter::getCompanionFile(const juce::File& firstVideo, const CaptureSettings& settings)
+{
+    juce::String name = firstVideo.getFileNameWithoutExtension();
+    name << "_" << settings.width << "x" << settings.height << "_" << settings.fps << "fps";
+
+    if (settings.codec == CaptureSettings::hevc)
+        name << "_hevc";
+
+    return firstVideo.getSiblingFile(name + firstVideo.getFileExtension());
+}
+
+void VideoWriter::enqueueExport(std::shared_ptr<Session> finishedSession)
+{
+    reportProgress(finishedSession->destination.getFileName(), 0.0, "Waiting...");
+    exportPool.addJob(new FinalizeJob(*this, std::move(finishedSession)), true);
+}
+
+void VideoWriter::reportProgress(const juce::String& name, double progress, 
+                                 const juce::String& status)
+{
+    ExportProgress p;
+    p.numPending = numPendingExports.load();
+    p.name = name;
+    p.progress = juce::jlimit(0.0, 1.0, progress);
+    p.status = status;
+
+    juce::MessageManager::callAsync([self = selfReference, p]
+    {
+        if (self != nullptr && self->exportProgressCallback != nullptr)
+            self->exportProgressCallback(p);
+    });
+}
+
+//=============================================================================
+VideoWriter::Take::Take()
+    : directory(juce::File::getSpecialLocation(juce::File::tempDirectory)
+                    .getChildFile("MoPanning")
+                    .getNonexistentChildFile("audio_" 
+                        + juce::Time::getCurrentTime().formatted("%Y%m%d_%H%M%S"),
+                        "", false))
+{
+    if (!directory.createDirectory())
+        DBG("Couldn't create " + directory.getFullPathName());
+}
+
+//=============================================================================
+void VideoWriter::Worker::run()
+{
+    while (threadShouldExit() == false) 
     {
-        juce::ignoreUnused(chooser);
-        auto choice = fc.getResult();
+        bool frameWritten = parent.dequeueVideoFrame();
+
+        if (frameWritten == false)
+        {
+            // No frame to write, sleep briefly
+            juce::Thread::sleep(1);
+        }
+    }
+
+    // Write out whatever was queued before the thread was stopped
+    while (parent.dequeueVideoFrame())
+        ;
+}
+
+//=============================================================================
+VideoWriter::SegmentJob::~SegmentJob()
+{
+    // Also runs for jobs removed before they started
+    --session->numSegmentsPending;
+}
 
-        recording = false;
-    }); */
+juce::ThreadPoolJob::JobStatus VideoWriter::SegmentJob::runJob()
+{
+    const bool ok = liveEncoder != nullptr ? waitForEncoder(*liveEncoder, encoderFinishTimeoutMs)
+                                           : encodeFrames();
+    liveEncoder.reset();
 
-    // Modal dialog - blocks the message thread until the user makes a choice
-    if (chooser->browseForFileToSave(true) == true)
+    if (!ok && !shouldStop())
     {
-        return chooser->getResult();
+        // The recording is joined up without this segment
+        juce::Logger::writeToLog("Video segment " + juce::String(index) + " failed:\n"
+                                 + session->getSegmentFile(index, ".log")
+                                       .loadFileAsString().getLastCharacters(2000));
+        session->getSegmentFile(index, ".mkv").deleteFile();
     }
 
-    return juce::File();
+    return jobHasFinished;
 }
 
-void VideoWriter::runFFmpeg(juce::File destination)
+bool VideoWriter::SegmentJob::waitForEncoder(FFmpegPipe& encoder, int timeoutMs)
 {
-    juce::String outputPath = tempVideo.getFullPathName();
+    encoder.closeInput();
 
-    juce::File ffExecutable = locateFFmpeg();
-    if (! ffExecutable.existsAsFile())
+    const auto startMs = juce::Time::getMillisecondCounter();
+    while (encoder.isRunning())
     {
-        DBG("FFmpeg not found at: " + ffExecutable.getFullPathName());
-        return;
+        const bool timedOut = timeoutMs >= 0 
+            && juce::Time::getMillisecondCounter() - startMs >= (juce::uint32)timeoutMs;
+
+        if (shouldStop() || timedOut)
+        {
+            encoder.kill();
+            break;
+        }
+
+        juce::Thread::sleep(pollIntervalMs);
     }
 
+    return encoder.getExitCode() == 0 && !shouldStop();
+}
+
+bool VideoWriter::SegmentJob::encodeFrames()
+{
+    const auto& s = *session;
+    const auto rawFrames = s.getSegmentFile(index, ".raw");
+    const auto frameStore = s.getSegmentFile(index, ".mpfs");
+
     juce::StringArray args;
-    args.add(ffExecutable.getFullPathName());
+    args.add(locateFFmpeg().getFullPathName());
     args.add("-y");
     args.add("-hide_banner");
+    args.add("-nostats");
 
-    // Input 0: raw RGB frames
-    args.add("-f");             args.add("rawvideo");
-    args.add("-pixel_format");  args.add("rgb24");
-    args.add("-video_size");    args.add(juce::String(Constants::W) + "x" + juce::String(Constants::H));
-    args.add("-framerate");     args.add(juce::String(Constants::FPS));
-    args.add("-i");             args.add(rawFrames.getFullPathName());
+    // Raw frames with their timestamps, from the frame store via stdin
+    // or from the file
+    args.add("-f");             args.add("matroska");
+    args.add("-i");             args.add(s.storedCompressed ? juce::String("pipe:0") 
+                                                            : rawFrames.getFullPathName());
 
-    // Input 1: WAV audio
-    args.add("-i");             args.add(wavAudio.getFullPathName());
+    args.add("-fps_mode");      args.add("passthrough");
 
-    // CPU x264
-    args.add("-c:v");           args.add("libx264");
+    // CPU x264 or x265
+    args.add("-c:v");           args.add(s.settings.getFFmpegEncoder());
     args.add("-preset");        args.add("slow");
-    args.add("-crf");           args.add("18");
+    args.add("-crf");           args.add(juce::String(s.settings.crf));
     args.add("-pix_fmt");       args.add("yuv420p");
     args.add("-tune");          args.add("grain");
 
-    args.add("-c:a");           args.add("aac");
-    args.add("-b:a");           args.add("320k");
+    args.add(s.getSegmentFile(index, ".mkv").getFullPathName());
 
-    args.add("-loglevel");      args.add("info");
-
-    // Output file
-    args.add(outputPath);
+    FFmpegPipe encoder;
+    if (!encoder.start(args, s.getSegmentFile(index, ".log")))
+    {
+        DBG("Failed to start encoding segment " << index);
+        return false;
+    }
 
-    const int flags = juce::ChildProcess::wantStdErr; // capture logs
-    if (! ffProcess.start(args, flags))
+    if (s.storedCompressed)
     {
-        DBG("Failed to start FFmpeg process.");
-        return;
+        // Decompress the frames into FFmpeg's stdin
+        FrameStore::Reader reader;
+        if (!reader.open(frameStore))
+            return false;
+
+        const int frameBytes = reader.getSettings().getFrameBytes();
+        juce::HeapBlock<uint8_t> frame((size_t)frameBytes);
+        juce::int64 frameIndex = 0;
+
+        RawMatroskaStream stream(reader.getSettings());
+        juce::MemoryOutputStream header;
+        stream.writeHeader(header);
+        if (!encoder.write(header.getData(), header.getDataSize()))
+            return false;
+
+        while (reader.readNextFrame(frame, frameIndex))
+        {
+            header.reset();
+            stream.writeBlockHeader(header, frameIndex);
+
+            if (shouldStop() 
+                || !encoder.write(header.getData(), header.getDataSize())
+                || !encoder.write(frame, (size_t)frameBytes))
+                return false; // The encoder is killed when it goes out of scope
+        }
     }
 
-    // Launch rendering window thread
-    RenderingWindow renderingWindow(*this);
+    if (!waitForEncoder(encoder, -1))
+        return false;
+
+    // The frames aren't needed once they are encoded
+    rawFrames.deleteFile();
+    frameStore.deleteFile();
+    return true;
+}
 
-    DBG("Launching FFmpeg...");
-    if (renderingWindow.runThread())
-    {
-        // Process completed successfully
-        DBG("FFmpeg rendering completed.");
+//=============================================================================
+VideoWriter::FinalizeJob::~FinalizeJob()
+{
+    // Nothing needs the segments now, so stop work on any still queued
+    session->cancelled = true;
+
+    // Also runs for jobs cancelled before they started
+    --parent.numPendingExports;
+    parent.reportProgress(session->destination.getFileName(), 1.0, outcome);
+}
+
+juce::ThreadPoolJob::JobStatus VideoWriter::FinalizeJob::runJob()
+{
+    const auto& s = *session;
+    DBG("Exporting " + s.destination.getFullPathName());
+
+    bool ok = waitForSegments() && writeSegmentList();
 
-        // Move the temp video file to the user-selected location
-        if (tempVideo.existsAsFile() && tempVideo.moveFileTo(destination))
+    if (ok)
+    {
+        juce::File ffExecutable = locateFFmpeg();
+        if (! ffExecutable.existsAsFile())
         {
-            DBG("Video saved to: " + destination.getFullPathName());
-            return;
+            DBG("FFmpeg not found at: " + ffExecutable.getFullPathName());
+            ok = false;
         }
+    }
 
-        DBG("Failed to save video :(");
+    if (ok)
+    {
+        report(0.0, "Joining the segments...");
+
+        DBG("Launching FFmpeg...");
+        ok = runFFmpeg(buildArgs());
     }
-    else
+
+    if (shouldExit())
     {
-        // User cancelled the operation
         DBG("FFmpeg rendering cancelled by user.");
-
-        ffProcess.kill();
-        if (tempVideo.existsAsFile())
-            tempVideo.deleteFile();
+        outcome = "Cancelled";
     }
+    else if (ok && s.tempVideo.existsAsFile() && s.tempVideo.moveFileTo(s.destination))
+    {
+        DBG("Video saved to: " + s.destination.getFullPathName());
+        outcome = "Saved";
+    }
+    else
+    {
+        // The log is deleted with the session, so keep the end of it
+        DBG("Failed to save video :(");
+        juce::Logger::writeToLog("Export of " + s.destination.getFileName() + " failed:\n"
+                                 + s.encoderLog.loadFileAsString().getLastCharacters(2000));
+        outcome = "Failed";
+    }
+
+    return jobHasFinished;
 }
 
 //=============================================================================
-void VideoWriter::Worker::run()
+bool VideoWriter::FinalizeJob::waitForSegments()
 {
-    while (threadShouldExit() == false) 
+    if (session->numSegmentsPending.load() > 0)
+        report(0.0, "Finishing the last segments...");
+
+    while (session->numSegmentsPending.load() > 0)
     {
-        bool frameWritten = parent.dequeueVideoFrame();
+        if (shouldExit())
+            return false;
 
-        if (frameWritten == false)
+        juce::Thread::sleep(pollIntervalMs);
+    }
+
+    return true;
+}
+
+bool VideoWriter::FinalizeJob::writeSegmentList()
+{
+    const auto& s = *session;
+
+    // Paths are relative to the list, which is in the same directory
+    juce::String list = "ffconcat version 1.0\n";
+    int numFound = 0;
+
+    for (int i = 0; i < s.numSegments; ++i)
+    {
+        const auto segment = s.getSegmentFile(i, ".mkv");
+        if (segment.getSize() > 0)
         {
-            // No frame to write, sleep briefly
-            juce::Thread::sleep(1);
+            list << "file '" << segment.getFileName() << "'\n";
+            ++numFound;
+        }
+        else
+        {
+            // The video will be short by a segment from here on
+            juce::Logger::writeToLog("Video segment " + juce::String(i) + " is missing");
         }
     }
+
+    return numFound > 0 && s.segmentList.replaceWithText(list);
 }
 
-void VideoWriter::RenderingWindow::run()
+bool VideoWriter::FinalizeJob::runFFmpeg(const juce::StringArray& args)
 {
-    setStatusMessage("Starting the encoding process...");
-    while (threadShouldExit() == false)
+    juce::ChildProcess process;
+
+    const int flags = juce::ChildProcess::wantStdErr; // capture logs
+    if (! process.start(args, flags))
+    {
+        DBG("Failed to start FFmpeg process.");
+        return false;
+    }
+
+    int lastFrame = 0;
+
+    while (process.isRunning())
     {
-        // Check if the FFmpeg process has finished
-        if (parent.ffProcess.isRunning() == false)
+        if (shouldExit())
         {
-            setStatusMessage("Complete!");
-            juce::Thread::sleep(1000);
-            break;
+            process.kill();
+            return false;
         }
 
         // Read FFmpeg output
-        int bytesRead = parent.ffProcess.readProcessOutput(buffer, bufferSize - 1);
+        int bytesRead = process.readProcessOutput(buffer, bufferSize - 1);
 
         if (bytesRead > 0)
         {
-            // Convert the raw buffer to a JUCE String
+            // Convert the raw buffer to a JUCE String, and keep it in case
+            // FFmpeg fails
             juce::String output(buffer, (size_t)bytesRead);
+            session->encoderLog.appendText(output, false, false, nullptr);
 
             // Look for "frame=" to extract progress
             int index = output.lastIndexOf("frame=");
@@ -385,11 +1006,9 @@ void VideoWriter::RenderingWindow::run()
 
                 if (currentFrame > lastFrame)
                 {
-                    double progress = (double)currentFrame / (double)totalFrames;
-                    setProgress(juce::jlimit(0.0, 1.0, progress));
-                    
-                    setStatusMessage("Encoding frame " + juce::String(currentFrame) + 
-                                     " of " + juce::String(totalFrames) + "...");
+                    report((double)currentFrame / (double)totalFrames,
+                           "Encoding frame " + juce::String(currentFrame) + 
+                           " of " + juce::String(totalFrames) + "...");
                     
                     lastFrame = currentFrame;
                 }
@@ -398,8 +1017,64 @@ void VideoWriter::RenderingWindow::run()
         else
         {
             // If no data was read, sleep briefly to prevent CPU spinning
-            wait(10); 
+            juce::Thread::sleep(pollIntervalMs);
         }
     }
 
+    return process.getExitCode() == 0;
+}
+
+//=============================================================================
+juce::StringArray VideoWriter::FinalizeJob::buildArgs() const
+{
+    const auto& s = *session;
+
+    juce::StringArray args;
+    args.add(locateFFmpeg().getFullPathName());
+    args.add("-y");
+    args.add("-hide_banner");
+
+    // Input 0: the segments, joined by the concat demuxer
+    args.add("-f");             args.add("concat");
+    args.add("-safe");          args.add("0");
+    args.add("-i");             args.add(s.segmentList.getFullPathName());
+
+    // Input 1: WAV audio, cut to end where the last frame does. Frame n
+    // starts at sample n * sampleRate / fps, so this lines up exactly.
+    AudioCapture::Timeline timeline;
+    if (AudioCapture::readTimeline(s.take->timeline, timeline) && s.lengthInFrames > 0)
+    {
+        if (timeline.numGaps > 0)
+            juce::Logger::writeToLog("Audio has " + juce::String(timeline.numGaps) + " gaps, "
+                                     + juce::String(timeline.numGapSamples) + " samples of silence");
+
+        const double seconds = (double)s.lengthInFrames / s.settings.fps;
+        args.add("-t");         args.add(juce::String(seconds, 6));
+    }
+
+    args.add("-i");             args.add(s.take->wavAudio.getFullPathName());
+
+    // Already encoded, so just copy it into the new container
+    args.add("-c:v");           args.add("copy");
+
+    // The tag Apple's players need to play HEVC from an .mp4
+    if (s.settings.codec == CaptureSettings::hevc)
+    {
+        args.add("-tag:v");     args.add("hvc1");
+    }
+
+    args.add("-c:a");           args.add("aac");
+    args.add("-b:a");           args.add("320k");
+
+    args.add("-loglevel");      args.add("info");
+
+    // Output file
+    args.add(s.tempVideo.getFullPathName());
+
+    return args;
+}
+
+void VideoWriter::FinalizeJob::report(double progress, const juce::String& status)
+{
+    parent.reportProgress(session->destination.getFileName(), progress, status);
 }
\ No newline at end of file
@@ -23,22 +23,63 @@
 #include <JuceHeader.h>
 #include "Utils.h"
 #include "FrameQueue.h"
+#include "FFmpegPipe.h"
+#include "FrameStore.h"
+#include "RawMatroskaStream.h"
+#include "AudioCapture.h"
+#include "RTLogger.h"
 
 
 //=============================================================================
 /*  Handles writing video files from MoPanning output.
 
-    It works by launching an FFmpeg process and sending raw RGB frames
-    to it via a named pipe. Frames are enqued from the GL thread into
-    a FIFO buffer, and a worker thread dequeues them and writes them
-    to the pipe for FFmpeg to encode.
+    Frames are enqued from the GL thread into a FIFO buffer, and a 
+    worker thread dequeues them and streams them to an FFmpeg process 
+    that encodes them as they arrive. When recording stops, FFmpeg only
+    has to mux the encoded video with the audio.
+
+    If live encoding is turned off or FFmpeg can't be started, the 
+    worker writes the frames to a temp file instead, and they are
+    encoded in the background. The file is a compressed FrameStore
+    unless compression is turned off, in which case it is raw frames. 
+    Frames are RGB24 or YUV420p, as set in the CaptureSettings.
+
+    When nothing on screen moves (e.g. during silence or while playback
+    is paused), the frames are all the same. Each frame is hashed, and a
+    frame identical to the one before is left out; the one before is 
+    then shown for longer. Frames reach FFmpeg in a raw Matroska stream
+    (see RawMatroskaStream), so each keeps its time of index / fps and 
+    the video comes out with a variable frame rate that still matches
+    the audio. Frames on disk are stored with their indices for the 
+    same reason.
+
+    The video is split into segments of CaptureSettings::segmentSeconds.
+    Each one is finished (and encoded, if need be) in the background as
+    soon as the next starts, and they are joined without re-encoding at
+    the end, so a crash or a full disk costs at most one segment. The 
+    WAV header is rewritten regularly for the same reason. Before each 
+    segment the writer checks there is room for it at the rate the disk
+    is filling up, and if not it asks for the recording to be stopped.
+
+    The audio is recorded separately, by an AudioCapture, into a Take
+    that every video made from the same performance shares. When the 
+    video is saved, the audio is cut to end exactly where the last frame
+    does. Several formats can be recorded at once with a writer for 
+    each, so each is encoded on its own threads, and the user is only 
+    asked once where to save them.
+
+    Each recording keeps its files in its own temp directory. When it 
+    stops, the user picks where to save it without blocking the message
+    thread, and it joins a queue of exports that are finalized one at a
+    time on a background thread. Rendering carries on meanwhile, and a
+    new recording can start straight away.
 */
 class VideoWriter 
 {
 public:
     //=========================================================================
-    VideoWriter() = default;
-    ~VideoWriter() = default;
+    VideoWriter();
+    ~VideoWriter();
 
     //=========================================================================
     /*  Sets the audio parameters the VideoWriter needs.
@@ -48,18 +89,24 @@ public:
     void prepare(double sampleRateIn, int samplesPerBlockIn, int numChannelsIn);
 
     //=========================================================================
+    struct Take; // See below
+
     /*  Starts the video writing process. 
     
-        This function initializes the FIFO storage, output streams,
-        and worker threads. It should be called when the user would like
-        to begin recording video.
+        This function initializes the output streams and worker threads.
+        It should be called when the user would like to begin recording 
+        video, after the frame queue has been allocated for the same
+        settings. The audio is recorded into take by the caller, and is
+        added to the video when it is saved.
     */
-    void start();
+    void start(const CaptureSettings& newCaptureSettings, std::shared_ptr<Take> take);
 
-    /*  Stops video writing and cleans up resources.
+    /*  Stops video writing.
     
-        This function stops the worker threads, finalizes the video
-        file, and prompts the user to save the completed video.
+        This function stops the worker threads, closes the recording's
+        files, and asks the user where to save the video. The dialog is
+        asynchronous, and once a location is chosen the video is 
+        finalized in the background.
     */
     void stop();
 
@@ -77,18 +124,70 @@ public:
     */
     void enqueueVideoFrame(const uint8_t* rgb, int numBytes);
 
-    /*  Enques an audio block for writing.
-    
-        This function should be called from the audio thread whenever a 
-        new block is ready to be written. It copies the provided data
-        to the wav writer to write to disk on a background thread.
+    //=========================================================================
+    /*  Returns true if recording is in progress. 
+    */
+    bool isRecording();
+
+    /*  Counts of the frames written in the current or last recording.
     */
-    void enqueueAudioBlock(const float* const* newBlock, int numSamples);
+    struct Stats
+    {
+        juce::int64 numWritten = 0; // Including repeats
+        juce::int64 numMissing = 0; // Dropped before reaching the writer
+        juce::int64 numFilled = 0; // Repeats written in place of missing frames
+        juce::int64 numElided = 0; // Left out as unchanged
+        juce::int64 numAudioDropped = 0; // Samples replaced with silence, set by the take's owner
+
+        juce::String toString() const
+        {
+            juce::String s;
+            s << "Writer: " << numWritten << " frames written, "
+              << numMissing << " missing, " << numFilled << " filled, "
+              << numElided << " unchanged, " << numAudioDropped << " audio samples dropped";
+            return s;
+        }
+    };
+
+    Stats getStats() const;
 
     //=========================================================================
-    /*  Returns true if recording or writing is in progress. 
+    /*  The state of the export queue.
     */
-    bool isRecording();
+    struct ExportProgress
+    {
+        int numPending = 0; // This writer's recordings not yet saved, including this one
+        juce::String name; // File name of the video being saved
+        double progress = 0.0; // Of that video, in the range [0, 1]
+        juce::String status;
+    };
+
+    /*  Called on the message thread when the writer can't carry on (e.g.
+        the disk is nearly full) and the recording should be stopped. 
+        Everything recorded up to then is kept.
+    */
+    std::function<void(const juce::String& reason)> onStopRequested;
+
+    //=========================================================================
+    /*  Sets a function to call on the message thread whenever an export 
+        makes progress, starts or finishes.
+    */
+    void setExportProgressCallback(std::function<void(const ExportProgress&)> callback);
+
+    /*  Returns the number of recordings that have stopped but aren't 
+        saved yet, including any still waiting for a save location.
+    */
+    int getNumPendingExports() const { return numPendingExports.load(); }
+
+    /*  Returns true while a stopped recording is waiting for the user to
+        choose where to save it. Call it on the message thread.
+    */
+    bool isChoosingDestination() const { return numAwaitingDestination > 0; }
+
+    /*  Cancels every export in progress or queued. Their temp files are
+        deleted.
+    */
+    void cancelExports();
 
     //=========================================================================
     /*  Runs an FFmpeg version check.
@@ -97,52 +196,125 @@ public:
         argument to retrieve and log the installed FFmpeg version.
     */
     void getFFmpegVersion();
+
+    /*  Locates the FFmpeg executable on the system.
+    
+        This function attempts to find the FFmpeg binary based
+        on the operating system and expected installation paths.
+        It returns a File object pointing to the executable.
+    */
+    static juce::File locateFFmpeg();
     
     //=========================================================================
     /*  Forward declaration of the worker thread class. */
     class Worker;
-    class RenderingWindow;
+    class SegmentJob;
+    class FinalizeJob;
+    struct Session;
 
 private:
     //=========================================================================
-    /*  Dequeues a frame from the FIFO and writes it to a temp file.
+    /*  Dequeues frames from the FIFO and writes them out.
     
         This function is called by the worker thread to retrieve the
-        next available frame from the FIFO buffer and write it to disk
-        for FFmpeg to process later.
+        next available frames (up to maxFramesPerWrite) from the FIFO 
+        buffer and write them to the live encoder, or to disk for FFmpeg
+        to process later. The frames are written directly from the 
+        FIFO's storage. If the encoder falls behind, this blocks and the
+        FIFO fills up, so the GL thread drops frames rather than waiting.
     */
     bool dequeueVideoFrame();
 
-    //=========================================================================
-    /*  Locates the FFmpeg executable on the system.
-    
-        This function attempts to find the FFmpeg binary based
-        on the operating system and expected installation paths.
-        It returns a File object pointing to the executable.
+    static constexpr int maxFramesPerWrite = 4;
+
+    /*  Writes one frame to the current output, to be shown at 
+        timelineIndex / fps, moving on to the next segment first if it
+        belongs there. previous is the frame before it, or nullptr if 
+        there wasn't one. Returns false if it failed.
     */
-    juce::File locateFFmpeg();
+    bool writeFrame(const uint8_t* frame, const uint8_t* previous, juce::int64 timelineIndex);
 
-    /*  Initializes the WAV audio writer.
-    
-        This function sets up the WAV file writer to record
-        audio data to a temporary .wav file.
+    /*  Writes a frame with writeFrame(), or leaves it out if it is 
+        unchanged. Returns false if writing it failed.
+    */
+    bool addFrame(const uint8_t* frame, const uint8_t* previous, juce::int64 timelineIndex);
+
+    /*  Writes a frame to the current segment, without the checks above.
+    */
+    bool writeToSegment(const uint8_t* frame, juce::int64 timelineIndex);
+
+    /*  If the last frames of the segment were left out as unchanged, 
+        writes the frame they matched again at the last one's time, so 
+        the segment lasts until the next begins. The joined video would
+        otherwise lose the time they covered.
+    */
+    bool closeHeldFrame(const uint8_t* previous);
+
+    /*  Returns true if frame can be left out because it is the same as
+        the frame before it, at timelineIndex. Hashes the frame either way.
+    */
+    bool isUnchanged(const uint8_t* frame, juce::int64 timelineIndex);
+
+    /*  A 64 bit hash of a frame, quick enough to run on every one.
+    */
+    static juce::uint64 hashFrame(const uint8_t* frame, int numBytes);
+
+    /*  Handles numMissing frames missing before the next one, according
+        to the gap policy. Repeating the last frame in the gap keeps 
+        every frame at its true presentation time (index / fps). Only 
+        logging it shifts the timeline back by the gap instead, so the 
+        video ends up shorter than the audio.
+    */
+    bool fillGap(juce::int64 numMissing, const uint8_t* previous);
+
+    /*  Launches FFmpeg to encode frames from its stdin as they are 
+        recorded. Returns false if it couldn't be started.
+    */
+    bool startLiveEncoder(const juce::File& output, const juce::File& logFile);
+
+    /*  Opens the outputs for the next segment. Returns false if there 
+        isn't enough disk space for it, after asking for the recording
+        to stop.
     */
-    void startWavWriter();
+    bool startSegment();
+
+    /*  Closes the current segment's outputs and queues it to be finished
+        in the background.
+    */
+    void finishSegment();
+
+    /*  Returns true if the disk has room for another segment, and for 
+        the final video, at the rate it has been filling up.
+    */
+    bool hasRoomForSegment();
+
+    /*  Asks for the recording to be stopped, and discards any frames 
+        that arrive until it is. Safe to call from any thread.
+    */
+    void requestStop(const juce::String& reason);
 
     //=========================================================================
-    /*  Prompts the user to select a save location for the completed video. 
+    /*  Asks the user where to save a finished recording, and queues it 
+        for export once they choose. If they cancel, the recording is
+        discarded. Other recordings of the same take finished meanwhile
+        share the choice (see getCompanionFile()).
     */
-    juce::File promptUserForSaveLocation();
+    void chooseDestination(std::shared_ptr<Session> finishedSession);
 
-    /*  Runs an FFmpeg process to finalize the video.
-    
-        This function constructs the command-line arguments for
-        FFmpeg to mux raw RGB frames and .wav audio into a final .mp4
-        video file, starts the process, and launches a dialog box 
-        propting the user to wait for it to finish or cancel the 
-        operation.
+    /*  Returns where a video is saved when another of the same take is
+        saved as firstVideo: next to it, with its format in the name.
     */
-    void runFFmpeg(juce::File destination);
+    static juce::File getCompanionFile(const juce::File& firstVideo, 
+                                       const CaptureSettings& settings);
+
+    /*  Adds a recording with a chosen destination to the export queue.
+    */
+    void enqueueExport(std::shared_ptr<Session> finishedSession);
+
+    /*  Passes progress to the callback on the message thread. Safe to 
+        call from any thread.
+    */
+    void reportProgress(const juce::String& name, double progress, const juce::String& status);
 
     //=========================================================================
 
@@ -153,40 +325,167 @@ private:
     int blockBytes;
 
     bool recording = false;
+    CaptureSettings captureSettings; // Set via start()
 
-    // Temporary file locations
-    juce::File temp = juce::File::getSpecialLocation(juce::File::tempDirectory);
-    juce::File rawFrames = temp.getChildFile("mopanning_frames.rgb");
-    juce::File wavAudio = temp.getChildFile("mopanning_audio.wav");
-    juce::File tempVideo = temp.getChildFile("mopanning_temp_video.mp4");
-    
-    // .wav audio writer
-    std::unique_ptr<juce::AudioFormatWriter::ThreadedWriter> wavWriter;
-    std::atomic<juce::AudioFormatWriter::ThreadedWriter*> wavWriterPtr { nullptr };
-    juce::AudioBuffer<float> audioTmp;
-    std::unique_ptr<juce::TimeSliceThread> wavThread;
+    // The recording in progress, with its temp files
+    std::shared_ptr<Session> session;
 
-    // Video output stream, FIFO, and worker thread
+    // The current segment's video output (a live encoder or a file), 
+    // FIFO, and worker thread
+    std::unique_ptr<FFmpegPipe> liveEncoder;
     std::unique_ptr<juce::FileOutputStream> framesOut;
+    std::unique_ptr<FrameStore::Writer> frameStoreOut;
+    std::unique_ptr<RawMatroskaStream> frameStream; // Timestamps for the encoder or .raw file
+    juce::MemoryOutputStream blockHeader; // Reused for each frame sent to the live encoder
     std::atomic<int64_t> videoBytesWritten {0};
     std::atomic<int> frameCount {0};
 
-    FrameQueue* frameQueue;
+    // Segments
+    int segmentIndex = 0;
+    bool segmentOpen = false;
+    juce::int64 framesPerSegment = 1;
+    juce::int64 segmentStartIndex = 0; // On the timeline, of the segment's first frame
+    std::atomic<bool> stopRequested { false };
+
+    // Disk space at the start of the last segment, for measuring how 
+    // fast it is being used
+    juce::int64 lastFreeBytes = 0;
+    double lastFreeBytesMs = 0.0;
+    double bytesPerSecond = 0.0;
+
+    static constexpr juce::int64 minFreeBytes = (juce::int64)1 << 30; // Always left free
+    static constexpr double diskSafetyFactor = 1.5; // Headroom on the projection
+
+    // Frame indices, for finding frames dropped on the way here. The 
+    // timeline index a frame is shown at is its index less timelineShift,
+    // which only grows when gaps are logged rather than filled.
+    juce::int64 nextFrameIndex = 0;
+    juce::int64 timelineShift = 0;
+    std::atomic<juce::int64> numFramesMissing { 0 };
+    std::atomic<juce::int64> numFramesFilled { 0 };
+
+    // Unchanged frames
+    juce::uint64 lastFrameHash = 0;
+    juce::int64 lastWrittenIndex = -1; // On the timeline
+    juce::int64 lastCoveredIndex = -1; // Of the last frame written or left out
+    std::atomic<juce::int64> numFramesElided { 0 };
+
+    // The longest a frame is held for, so a segment cut off by a crash
+    // loses little of the picture at its end
+    static constexpr int maxHeldSeconds = 1;
+
+    FrameQueue* frameQueue = nullptr;
 
     std::unique_ptr<Worker> videoWorkerThread;
 
-    juce::ChildProcess ffProcess;
+    // Segments being finished while recording carries on
+    juce::ThreadPool segmentPool { juce::ThreadPoolOptions{}
+                                       .withThreadName("VideoSegments")
+                                       .withNumberOfThreads(1)
+                                       .withDesiredThreadPriority(juce::Thread::Priority::low) };
+
+    // Export queue, run one at a time at low priority
+    juce::ThreadPool exportPool { juce::ThreadPoolOptions{}
+                                      .withThreadName("VideoExport")
+                                      .withNumberOfThreads(1)
+                                      .withDesiredThreadPriority(juce::Thread::Priority::low) };
+    std::atomic<int> numPendingExports { 0 };
+    int numAwaitingDestination = 0; // Message thread only
+    std::function<void(const ExportProgress&)> exportProgressCallback; // Message thread only
+    juce::WeakReference<VideoWriter> selfReference; // For callbacks from other threads
+
+    // How long to wait for running exports to stop when cancelling them
+    static constexpr int exportShutdownTimeoutMs = 10000;
 
     //=========================================================================
+    JUCE_DECLARE_WEAK_REFERENCEABLE(VideoWriter)
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VideoWriter)
 };
 
 
 //=============================================================================
-/*  Runs a loop to dequeue video frames and write them to a .rgb file.
+/*  One recording's temp files and format, from when it starts until it 
+    has been exported. Deleting it deletes its temp directory, so jobs 
+    working on it keep a reference.
+*/
+struct VideoWriter::Session
+{
+    explicit Session(const juce::File& dir) : directory(dir) {}
+
+    ~Session()
+    {
+        directory.deleteRecursively();
+    }
+
+    /*  Returns the file for the given segment with the given extension:
+        .mkv for the encoded video, .raw (a RawMatroskaStream) or .mpfs
+        for frames waiting to be encoded, and .log for FFmpeg's output.
+    */
+    juce::File getSegmentFile(int index, const juce::String& extension) const
+    {
+        return directory.getChildFile("segment_" + juce::String(index).paddedLeft('0', 4) 
+                                      + extension);
+    }
+
+    juce::File directory;
+    juce::File segmentList = directory.getChildFile("segments.ffconcat");
+    juce::File encoderLog = directory.getChildFile("encoder.log");
+    juce::File tempVideo = directory.getChildFile("video.mp4");
+
+    std::shared_ptr<Take> take; // The audio, and where the video goes
+    CaptureSettings settings;
+    bool encodedLive = false;
+    bool storedCompressed = false;
+    int numFrames = 0;
+    int numSegments = 0;
+    juce::int64 lengthInFrames = 0; // In capture frames, including any missing or left out
+
+    std::atomic<int> numSegmentsPending { 0 }; // Not finished yet
+    std::atomic<bool> cancelled { false }; // Not going to be exported
+
+    juce::File destination; // Chosen by the user
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Session)
+};
+
+
+//=============================================================================
+/*  The audio of one performance, shared by every video recorded from 
+    it, and where those videos are saved. Deleting it deletes its temp 
+    directory, so each session keeps a reference.
+
+    The user chooses where the first video to stop is saved, and the 
+    rest are saved next to it. Apart from the files, only used on the 
+    message thread.
+*/
+struct VideoWriter::Take
+{
+    Take();
+
+    ~Take()
+    {
+        directory.deleteRecursively();
+    }
+
+    juce::File directory;
+    juce::File wavAudio = directory.getChildFile("audio.wav");
+    juce::File timeline = directory.getChildFile("timeline.txt"); // See AudioCapture
+
+    // Finished recordings waiting for the user to choose, with the 
+    // writers that will export them
+    std::vector<std::pair<juce::WeakReference<VideoWriter>, std::shared_ptr<Session>>> waiting;
+    bool isChoosing = false;
+    juce::File destination; // Of the first video, once chosen
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Take)
+};
+
+
+//=============================================================================
+/*  Runs a loop to dequeue video frames and write them out.
     
     This worker thread continuously checks for new frames in the FIFO 
-    buffer, dequeues them, and writes them to disk.
+    buffer, dequeues them, and writes them to the live encoder or disk.
 */
 class VideoWriter::Worker : public juce::Thread
 {
@@ -208,40 +507,99 @@ private:
 
 
 //=============================================================================
-/*  Shows a window with a cancel button while processing video.
+/*  Finishes one segment of a recording while the next is recorded.
+
+    For a live-encoded segment it waits for the encoder to get through 
+    the frames it was sent. Otherwise it encodes the segment's frames 
+    from disk into the segment's .mkv, then deletes them. It gives up if
+    the recording is cancelled.
+*/
+class VideoWriter::SegmentJob : public juce::ThreadPoolJob
+{
+public:
+    //=========================================================================
+    SegmentJob(std::shared_ptr<Session> s, int segmentIndex, 
+               std::unique_ptr<FFmpegPipe> encoder)
+        : juce::ThreadPoolJob("Finish segment"), session(std::move(s)), 
+          index(segmentIndex), liveEncoder(std::move(encoder))
+    {
+    }
+
+    ~SegmentJob() override;
+
+    JobStatus runJob() override;
+
+private:
+    //=========================================================================
+    /*  Each of these returns false if it failed or was cancelled.
+    */
+    bool waitForEncoder(FFmpegPipe& encoder, int timeoutMs);
+    bool encodeFrames();
+
+    bool shouldStop() { return shouldExit() || session->cancelled.load(); }
+
+    //=========================================================================
+    std::shared_ptr<Session> session;
+    const int index;
+    std::unique_ptr<FFmpegPipe> liveEncoder; // Null if the frames are on disk
+
+    // How long to wait for the live encoder to finish the frames it has
+    // been sent
+    static constexpr int encoderFinishTimeoutMs = 30000;
+    static constexpr int pollIntervalMs = 10;
+
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SegmentJob)
+};
+
+
+//=============================================================================
+/*  Turns a finished recording into the final video file.
     
-    This class creates a modal progress window that repeatedly checks
-    the FFmpeg process status and allows the user to cancel the 
-    operation.
+    It waits for the recording's segments to be finished, then runs 
+    FFmpeg to join them and mux them with the audio into an .mp4, 
+    reporting progress as it goes, and moves the result to the chosen
+    destination. It checks for cancellation throughout, killing FFmpeg 
+    if asked to stop.
 */
-class VideoWriter::RenderingWindow : public juce::ThreadWithProgressWindow
+class VideoWriter::FinalizeJob : public juce::ThreadPoolJob
 {
 public:
     //=========================================================================
-    RenderingWindow(VideoWriter& vw)
-        : ThreadWithProgressWindow("Writing the video file...", true, true),
-          parent(vw)
+    FinalizeJob(VideoWriter& vw, std::shared_ptr<Session> s)
+        : juce::ThreadPoolJob("Finalize video"), parent(vw), session(std::move(s))
     {
     }
 
-    void run() override;
+    ~FinalizeJob() override;
+
+    JobStatus runJob() override;
 
 private:
+    //=========================================================================
+    /*  Each of these returns false if it failed or was cancelled.
+    */
+    bool waitForSegments();
+    bool writeSegmentList();
+    bool runFFmpeg(const juce::StringArray& args);
+
+    juce::StringArray buildArgs() const;
+    void report(double progress, const juce::String& status);
+
     //=========================================================================
     VideoWriter& parent;
+    std::shared_ptr<Session> session;
+    juce::String outcome = "Cancelled"; // Reported when the job is deleted
 
     // The total number of frames we will need to process
-    const int totalFrames = std::max(1, parent.frameCount.load());
+    const int totalFrames = std::max(1, session->numFrames);
 
-    // The last frame number we reported progress for
-    int lastFrame = 0;
-    
     // A buffer for reading FFmpeg output for status updates
     static constexpr int bufferSize = 512;
     char buffer[bufferSize];
 
-    //=========================================================================
-    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RenderingWindow)
-};
-
+    static constexpr int pollIntervalMs = 10;
 
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FinalizeJob)
+};
\ No newline at end of file
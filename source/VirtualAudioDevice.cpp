@@ -0,0 +1,316 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#include "VirtualAudioDevice.h"
+
+
+//=============================================================================
+VirtualAudioDevice::VirtualAudioDevice(const juce::String& name,
+                                       const VirtualDeviceSettings& s)
+    : juce::AudioIODevice(name, "Virtual"),
+      juce::Thread("Virtual audio device"),
+      settings(s)
+{
+}
+
+VirtualAudioDevice::~VirtualAudioDevice()
+{
+    close();
+}
+
+//=============================================================================
+juce::StringArray VirtualAudioDevice::getOutputChannelNames()
+{
+    juce::StringArray names;
+    for (int ch = 0; ch < settings.numOutputChannels; ++ch)
+        names.add("Output " + juce::String(ch + 1));
+    return names;
+}
+
+juce::StringArray VirtualAudioDevice::getInputChannelNames()
+{
+    juce::StringArray names;
+    for (int ch = 0; ch < settings.numInputChannels; ++ch)
+        names.add("Input " + juce::String(ch + 1));
+    return names;
+}
+
+juce::Array<double> VirtualAudioDevice::getAvailableSampleRates()
+{
+    juce::Array<double> rates { 44100.0, 48000.0, 88200.0, 96000.0 };
+    rates.addIfNotAlreadyThere(settings.sampleRate);
+    rates.sort();
+    return rates;
+}
+
+juce::Array<int> VirtualAudioDevice::getAvailableBufferSizes()
+{
+    juce::Array<int> sizes { 32, 64, 128, 256, 480, 512, 1024, 2048, 4096 };
+    sizes.addIfNotAlreadyThere(settings.blockSize);
+    sizes.sort();
+    return sizes;
+}
+
+//=============================================================================
+juce::String VirtualAudioDevice::open(const juce::BigInteger& inputChannels,
+                                      const juce::BigInteger& outputChannels,
+                                      double sampleRate, int bufferSizeSamples)
+{
+    close();
+    lastError.clear();
+
+    currentSampleRate = sampleRate > 0.0 ? sampleRate : settings.sampleRate;
+    currentBlockSize = bufferSizeSamples > 0 ? bufferSizeSamples : settings.blockSize;
+
+    activeInputs = inputChannels;
+    activeInputs.setRange(settings.numInputChannels,
+                          std::max(activeInputs.getHighestBit() + 1 - settings.numInputChannels, 0),
+                          false);
+    activeOutputs = outputChannels;
+    activeOutputs.setRange(settings.numOutputChannels,
+                           std::max(activeOutputs.getHighestBit() + 1 - settings.numOutputChannels, 0),
+                           false);
+
+    inputBuffer.setSize(std::max(activeInputs.countNumberOfSetBits(), 1), currentBlockSize);
+    outputBuffer.setSize(std::max(activeOutputs.countNumberOfSetBits(), 1), currentBlockSize);
+
+    // Preload the input file so reading it costs nothing on the device thread
+    if (settings.source == VirtualDeviceSettings::audioFile)
+    {
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+
+        std::unique_ptr<juce::AudioFormatReader> reader(
+            formatManager.createReaderFor(settings.file));
+
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+        {
+            lastError = "Couldn't read " + settings.file.getFullPathName();
+            return lastError;
+        }
+
+        if (reader->sampleRate != currentSampleRate)
+            DBG("Virtual device: " << settings.file.getFileName() << " is "
+                << reader->sampleRate << " Hz but the device runs at "
+                << currentSampleRate << " Hz; it will play at the wrong speed.");
+
+        fileData.setSize((int)reader->numChannels, (int)reader->lengthInSamples);
+        reader->read(&fileData, 0, (int)reader->lengthInSamples, 0, true, true);
+        filePosition = 0;
+    }
+
+    tonePhases.assign(settings.tones.size(), 0.0);
+
+    deviceIsOpen = true;
+    return {};
+}
+
+void VirtualAudioDevice::close()
+{
+    stop();
+    deviceIsOpen = false;
+}
+
+void VirtualAudioDevice::start(juce::AudioIODeviceCallback* callback)
+{
+    if (!deviceIsOpen || callback == nullptr)
+        return;
+
+    stop();
+
+    callback->audioDeviceAboutToStart(this);
+
+    {
+        const juce::ScopedLock sl(callbackLock);
+        currentCallback = callback;
+    }
+
+    startThread(juce::Thread::Priority::highest);
+}
+
+void VirtualAudioDevice::stop()
+{
+    stopThread(1000);
+
+    juce::AudioIODeviceCallback* oldCallback = nullptr;
+    {
+        const juce::ScopedLock sl(callbackLock);
+        std::swap(oldCallback, currentCallback);
+    }
+
+    if (oldCallback != nullptr)
+        oldCallback->audioDeviceStopped();
+}
+
+//=============================================================================
+void VirtualAudioDevice::run()
+{
+    const double blockMs = 1000.0 * currentBlockSize / currentSampleRate;
+    const double startMs = juce::Time::getMillisecondCounterHiRes();
+    juce::int64 blockCount = 0;
+
+    while (!threadShouldExit())
+    {
+        // Schedule against the start time so timing errors don't accumulate
+        if (!settings.freeRunning)
+            waitUntil(startMs + blockMs * (double)blockCount);
+
+        if (threadShouldExit())
+            break;
+
+        renderInputs(currentBlockSize);
+        outputBuffer.clear();
+
+        const auto hostTimeNs = (juce::uint64)(juce::Time::getMillisecondCounterHiRes() * 1.0e6);
+        juce::AudioIODeviceCallbackContext context;
+        context.hostTimeNs = &hostTimeNs;
+
+        {
+            const juce::ScopedLock sl(callbackLock);
+
+            if (currentCallback != nullptr)
+                currentCallback->audioDeviceIOCallbackWithContext(
+                    inputBuffer.getArrayOfReadPointers(), activeInputs.countNumberOfSetBits(),
+                    outputBuffer.getArrayOfWritePointers(), activeOutputs.countNumberOfSetBits(),
+                    currentBlockSize, context);
+        }
+
+        ++blockCount;
+    }
+}
+
+void VirtualAudioDevice::waitUntil(double targetMs)
+{
+    for (;;)
+    {
+        const double remaining = targetMs - juce::Time::getMillisecondCounterHiRes();
+
+        if (remaining <= 0.0 || threadShouldExit())
+            return;
+
+        // Sleep while there is plenty of time left, then spin the rest
+        if (remaining > 2.0)
+            wait((int)(remaining - 1.0));
+        else
+            juce::Thread::yield();
+    }
+}
+
+//=============================================================================
+void VirtualAudioDevice::renderInputs(int numSamples)
+{
+    switch (settings.source)
+    {
+        case VirtualDeviceSettings::sines:     renderSines(numSamples); break;
+        case VirtualDeviceSettings::noise:     renderNoise(numSamples); break;
+        case VirtualDeviceSettings::audioFile: renderFile(numSamples);  break;
+    }
+}
+
+/*  Every pair of input channels gets the same stereo mix of the tones,
+    and an odd channel left over gets the mono sum.
+*/
+void VirtualAudioDevice::renderSines(int numSamples)
+{
+    inputBuffer.clear();
+
+    const int numChannels = activeInputs.countNumberOfSetBits();
+    if (numChannels == 0)
+        return;
+
+    float* left = inputBuffer.getWritePointer(0);
+    float* right = inputBuffer.getWritePointer(std::min(1, numChannels - 1));
+
+    for (size_t t = 0; t < settings.tones.size(); ++t)
+    {
+        const auto& tone = settings.tones[t];
+
+        // Equal power pan
+        const double angle = (juce::jlimit(-1.0f, 1.0f, tone.pan) + 1.0)
+                             * juce::MathConstants<double>::pi * 0.25;
+        const float leftGain = tone.amplitude * (float)std::cos(angle);
+        const float rightGain = tone.amplitude * (float)std::sin(angle);
+
+        const double increment = juce::MathConstants<double>::twoPi
+                                 * tone.frequency / currentSampleRate;
+        const double itdPhase = juce::MathConstants<double>::twoPi
+                                * tone.frequency * tone.itdMs * 0.001;
+
+        double phase = tonePhases[t];
+        for (int i = 0; i < numSamples; ++i)
+        {
+            left[i] += leftGain * (float)std::sin(phase - itdPhase);
+
+            if (right != left)
+                right[i] += rightGain * (float)std::sin(phase);
+            else
+                left[i] += rightGain * (float)std::sin(phase);
+
+            phase += increment;
+        }
+        tonePhases[t] = std::fmod(phase, juce::MathConstants<double>::twoPi);
+    }
+
+    for (int ch = 2; ch < numChannels; ++ch)
+    {
+        if (ch % 2 == 0 && ch + 1 == numChannels)
+        {
+            inputBuffer.copyFrom(ch, 0, left, numSamples, 0.5f);
+            if (right != left)
+                inputBuffer.addFrom(ch, 0, right, numSamples, 0.5f);
+        }
+        else
+        {
+            inputBuffer.copyFrom(ch, 0, inputBuffer, ch % 2, 0, numSamples);
+        }
+    }
+}
+
+void VirtualAudioDevice::renderNoise(int numSamples)
+{
+    const int numChannels = activeInputs.countNumberOfSetBits();
+
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        float* dest = inputBuffer.getWritePointer(ch);
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = (random.nextFloat() * 2.0f - 1.0f) * 0.25f;
+    }
+}
+
+void VirtualAudioDevice::renderFile(int numSamples)
+{
+    const int numChannels = activeInputs.countNumberOfSetBits();
+    const int fileLength = fileData.getNumSamples();
+    const int numFileChannels = fileData.getNumChannels();
+
+    int done = 0;
+    while (done < numSamples)
+    {
+        const int n = std::min(numSamples - done, fileLength - filePosition);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            inputBuffer.copyFrom(ch, done, fileData, ch % numFileChannels, filePosition, n);
+
+        done += n;
+        filePosition = (filePosition + n) % fileLength;
+    }
+}
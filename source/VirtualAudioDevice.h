@@ -0,0 +1,205 @@
+/*=============================================================================
+
+    This file is part of the MoPanning audio visuaization tool.
+    Copyright (C) 2025 Owen Ohlson and Mckinley Wood
+
+    This program is free software: you can redistribute it and/or modify 
+    it under the terms of the GNU Affero General Public License as 
+    published by the Free Software Foundation, either version 3 of the 
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but 
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+    Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public 
+    License along with this program. If not, see 
+    <https://www.gnu.org/licenses/>.
+
+=============================================================================*/
+
+#pragma once
+#include <JuceHeader.h>
+
+
+//=============================================================================
+/*  Settings for the virtual audio device.
+*/
+struct VirtualDeviceSettings
+{
+    /*  A test tone. Positive pan is to the right, and a positive ITD
+        delays the left channel (i.e. also moves the source right).
+    */
+    struct Tone
+    {
+        float frequency; // Hz
+        float amplitude; // Linear gain
+        float pan;       // In range [-1,1]
+        float itdMs;     // Interaural time difference in milliseconds
+    };
+
+    enum Source
+    {
+        sines, // The tones below on every pair of input channels
+        noise, // Uncorrelated white noise on every input channel
+        audioFile // The file below, looped, channels wrapped around
+    };
+
+    int numInputChannels = 2;
+    int numOutputChannels = 2;
+    double sampleRate = 48000.0;
+    int blockSize = 512;
+
+    /*  If true, callbacks run back to back instead of in real time, so
+        the whole processing path can be load tested and profiled.
+    */
+    bool freeRunning = false;
+
+    Source source = sines;
+    juce::File file;
+    std::vector<Tone> tones
+    {
+        {  220.0f, 0.2f, -0.8f, 0.0f },
+        {  440.0f, 0.2f, -0.4f, 0.0f },
+        {  880.0f, 0.2f,  0.0f, 0.0f },
+        { 1760.0f, 0.2f,  0.4f, 0.0f },
+        { 3520.0f, 0.2f,  0.8f, 0.0f }
+    };
+};
+
+
+//=============================================================================
+/*  An audio device with no hardware behind it.
+
+    A high-priority thread calls the audio callback once per block
+    period (or as fast as possible in free-running mode), with the
+    inputs filled from test signals or a file. The outputs are
+    discarded. This lets the app run on machines with no sound card,
+    such as build and benchmark servers.
+*/
+class VirtualAudioDevice : public juce::AudioIODevice,
+                           private juce::Thread
+{
+public:
+    //=========================================================================
+    VirtualAudioDevice(const juce::String& deviceName,
+                       const VirtualDeviceSettings& settings);
+    ~VirtualAudioDevice() override;
+
+    //=========================================================================
+    juce::StringArray getOutputChannelNames() override;
+    juce::StringArray getInputChannelNames() override;
+    juce::Array<double> getAvailableSampleRates() override;
+    juce::Array<int> getAvailableBufferSizes() override;
+    int getDefaultBufferSize() override { return settings.blockSize; }
+
+    juce::String open(const juce::BigInteger& inputChannels,
+                      const juce::BigInteger& outputChannels,
+                      double sampleRate, int bufferSizeSamples) override;
+    void close() override;
+    bool isOpen() override { return deviceIsOpen; }
+
+    void start(juce::AudioIODeviceCallback* callback) override;
+    void stop() override;
+    bool isPlaying() override { return currentCallback != nullptr; }
+
+    juce::String getLastError() override { return lastError; }
+
+    int getCurrentBufferSizeSamples() override { return currentBlockSize; }
+    double getCurrentSampleRate() override { return currentSampleRate; }
+    int getCurrentBitDepth() override { return 32; }
+
+    juce::BigInteger getActiveOutputChannels() const override { return activeOutputs; }
+    juce::BigInteger getActiveInputChannels() const override { return activeInputs; }
+
+    int getOutputLatencyInSamples() override { return 0; }
+    int getInputLatencyInSamples() override { return 0; }
+
+private:
+    //=========================================================================
+    /*  Calls the audio callback once per block until the thread is
+        asked to stop.
+    */
+    void run() override;
+
+    /*  Waits until the given time on the high resolution clock, sleeping
+        for most of it and spinning for the last millisecond.
+    */
+    void waitUntil(double targetMs);
+
+    /*  Fills the input buffer with the next block of the test signal.
+    */
+    void renderInputs(int numSamples);
+    void renderSines(int numSamples);
+    void renderNoise(int numSamples);
+    void renderFile(int numSamples);
+
+    //=========================================================================
+    VirtualDeviceSettings settings;
+
+    bool deviceIsOpen = false;
+    juce::String lastError;
+
+    double currentSampleRate = 0.0;
+    int currentBlockSize = 0;
+    juce::BigInteger activeInputs, activeOutputs;
+
+    juce::AudioBuffer<float> inputBuffer, outputBuffer;
+    juce::AudioBuffer<float> fileData; // The whole input file, preloaded
+    int filePosition = 0;
+
+    std::vector<double> tonePhases;
+    juce::Random random;
+
+    juce::CriticalSection callbackLock;
+    juce::AudioIODeviceCallback* currentCallback = nullptr;
+
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VirtualAudioDevice)
+};
+
+
+//=============================================================================
+/*  The device type that provides a VirtualAudioDevice to the
+    AudioDeviceManager.
+*/
+class VirtualAudioDeviceType : public juce::AudioIODeviceType
+{
+public:
+    //=========================================================================
+    static constexpr const char* typeName = "Virtual";
+    static constexpr const char* deviceName = "Virtual Device";
+
+    explicit VirtualAudioDeviceType(const VirtualDeviceSettings& s)
+        : juce::AudioIODeviceType(typeName), settings(s) {}
+
+    //=========================================================================
+    void scanForDevices() override {}
+
+    juce::StringArray getDeviceNames(bool) const override { return { deviceName }; }
+    int getDefaultDeviceIndex(bool) const override { return 0; }
+
+    int getIndexOfDevice(juce::AudioIODevice* device, bool) const override
+    {
+        return dynamic_cast<VirtualAudioDevice*>(device) != nullptr ? 0 : -1;
+    }
+
+    bool hasSeparateInputsAndOutputs() const override { return false; }
+
+    juce::AudioIODevice* createDevice(const juce::String& outputDeviceName,
+                                      const juce::String& inputDeviceName) override
+    {
+        if (outputDeviceName != deviceName && inputDeviceName != deviceName)
+            return nullptr;
+
+        return new VirtualAudioDevice(deviceName, settings);
+    }
+
+private:
+    //=========================================================================
+    VirtualDeviceSettings settings;
+
+    //=========================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VirtualAudioDeviceType)
+};